@@ -13,40 +13,98 @@
 
 
 typedef struct {
-    ngx_array_t                *access;  /* array of PyCodeObject * */
-    ngx_array_t                *log;     /* array of PyCodeObject * */
-    PyCodeObject               *content;
+    ngx_int_t                   index;
+    PyCodeObject               *code;
+} ngx_http_python_async_t;
+
+
+typedef struct {
+    ngx_python_batch_t         *batch;
+    ngx_array_t                *vars;    /* array of ngx_int_t */
+} ngx_http_python_log_batch_t;
+
+
+typedef struct {
+    ngx_array_t                  *async;   /* ngx_http_python_async_t */
+    ngx_array_t                  *access;  /* array of PyObject * */
+    ngx_array_t                  *log;     /* array of PyObject * */
+    ngx_http_python_log_batch_t  *log_batch;
+    PyObject                     *content;
+    ngx_flag_t                    request_buffering;
+    size_t                        send_buffer;
+    size_t                        output_buffer;
+    ngx_python_ctx_conf_t         python;
 } ngx_http_python_loc_conf_t;
 
 
 typedef struct {
+    PyCodeObject               *code;
+
+    /* per-worker memo of values by key */
+    ngx_http_complex_value_t   *key;
+    ngx_msec_t                  ttl;
+    ngx_uint_t                  max;
+    ngx_uint_t                  nodes;
+    ngx_rbtree_t                rbtree;
+    ngx_rbtree_node_t           sentinel;
+    ngx_queue_t                 lru;
+} ngx_http_python_var_t;
+
+
+typedef struct {
+    ngx_str_node_t              sn;
+    ngx_queue_t                 queue;
+    ngx_msec_t                  expire;
+    ngx_str_t                   value;
+} ngx_http_python_memo_node_t;
+
+
+typedef struct {
+    ngx_uint_t                  async;
     ngx_uint_t                  phase;
     ngx_uint_t                  passed;
     PyObject                   *request;
+    PyObject                   *args;
     ngx_python_ctx_t           *python;
 } ngx_http_python_ctx_t;
 
 
+static ngx_int_t ngx_http_python_preaccess_handler(ngx_http_request_t *r);
 static ngx_int_t ngx_http_python_access_handler(ngx_http_request_t *r);
 static ngx_int_t ngx_http_python_log_handler(ngx_http_request_t *r);
 static ngx_int_t ngx_http_python_content_handler(ngx_http_request_t *r);
 static void ngx_http_python_content_event_handler(ngx_http_request_t *r);
+static void ngx_http_python_read_handler(ngx_http_request_t *r);
 static ngx_int_t ngx_http_python_variable(ngx_http_request_t *r,
     ngx_http_variable_value_t *v, uintptr_t data);
-static PyObject *ngx_http_python_eval(ngx_http_request_t *r, PyCodeObject *code,
-    ngx_event_t *wake);
+static ngx_int_t ngx_http_python_async_variable(ngx_http_request_t *r,
+    ngx_http_variable_value_t *v, uintptr_t data);
+static ngx_int_t ngx_http_python_variable_value(ngx_http_request_t *r,
+    PyObject *ret, ngx_http_variable_value_t *v);
+static ngx_int_t ngx_http_python_memo_get(ngx_http_request_t *r,
+    ngx_http_python_var_t *pv, ngx_str_t *key, ngx_http_variable_value_t *v);
+static void ngx_http_python_memo_set(ngx_http_request_t *r,
+    ngx_http_python_var_t *pv, ngx_str_t *key, ngx_http_variable_value_t *v);
+static void ngx_http_python_memo_delete(ngx_http_python_var_t *pv,
+    ngx_http_python_memo_node_t *node);
+static PyObject *ngx_http_python_eval(ngx_http_request_t *r,
+    PyObject *handler, ngx_event_t *wake);
 
 static void *ngx_http_python_create_loc_conf(ngx_conf_t *cf);
 static char *ngx_http_python_merge_loc_conf(ngx_conf_t *cf, void *parent,
     void *child);
 static char *ngx_http_python_set(ngx_conf_t *cf, ngx_command_t *cmd,
     void *conf);
+static char *ngx_http_python_set_async(ngx_conf_t *cf, ngx_command_t *cmd,
+    void *conf);
 static char *ngx_http_python_access(ngx_conf_t *cf, ngx_command_t *cmd,
     void *conf);
 static char *ngx_http_python_log(ngx_conf_t *cf, ngx_command_t *cmd,
     void *conf);
 static char *ngx_http_python_content(ngx_conf_t *cf, ngx_command_t *cmd,
     void *conf);
+static char *ngx_http_python_log_batch(ngx_conf_t *cf, ngx_command_t *cmd,
+    void *conf);
 static ngx_int_t ngx_http_python_init(ngx_conf_t *cf);
 
 
@@ -71,12 +129,19 @@ static ngx_command_t  ngx_http_python_commands[] = {
       NULL },
 
     { ngx_string("python_set"),
-      NGX_HTTP_MAIN_CONF|NGX_CONF_TAKE2,
+      NGX_HTTP_MAIN_CONF|NGX_CONF_2MORE,
       ngx_http_python_set,
       NGX_HTTP_MAIN_CONF_OFFSET,
       0,
       NULL },
 
+    { ngx_string("python_set_async"),
+      NGX_HTTP_MAIN_CONF|NGX_HTTP_SRV_CONF|NGX_HTTP_LOC_CONF|NGX_CONF_TAKE2,
+      ngx_http_python_set_async,
+      NGX_HTTP_LOC_CONF_OFFSET,
+      0,
+      NULL },
+
     { ngx_string("python_access"),
       NGX_HTTP_MAIN_CONF|NGX_HTTP_SRV_CONF|NGX_HTTP_LOC_CONF|NGX_CONF_TAKE1,
       ngx_http_python_access,
@@ -84,6 +149,13 @@ static ngx_command_t  ngx_http_python_commands[] = {
       0,
       NULL },
 
+    { ngx_string("python_access_handler"),
+      NGX_HTTP_MAIN_CONF|NGX_HTTP_SRV_CONF|NGX_HTTP_LOC_CONF|NGX_CONF_TAKE1,
+      ngx_http_python_access,
+      NGX_HTTP_LOC_CONF_OFFSET,
+      0,
+      NGX_PYTHON_CALLABLE },
+
     { ngx_string("python_log"),
       NGX_HTTP_MAIN_CONF|NGX_HTTP_SRV_CONF|NGX_HTTP_LOC_CONF|NGX_CONF_TAKE1,
       ngx_http_python_log,
@@ -91,6 +163,20 @@ static ngx_command_t  ngx_http_python_commands[] = {
       0,
       NULL },
 
+    { ngx_string("python_log_handler"),
+      NGX_HTTP_MAIN_CONF|NGX_HTTP_SRV_CONF|NGX_HTTP_LOC_CONF|NGX_CONF_TAKE1,
+      ngx_http_python_log,
+      NGX_HTTP_LOC_CONF_OFFSET,
+      0,
+      NGX_PYTHON_CALLABLE },
+
+    { ngx_string("python_log_batch"),
+      NGX_HTTP_MAIN_CONF|NGX_HTTP_SRV_CONF|NGX_HTTP_LOC_CONF|NGX_CONF_2MORE,
+      ngx_http_python_log_batch,
+      NGX_HTTP_LOC_CONF_OFFSET,
+      0,
+      NULL },
+
     { ngx_string("python_content"),
       NGX_HTTP_LOC_CONF|NGX_HTTP_LIF_CONF|NGX_HTTP_LMT_CONF|NGX_CONF_TAKE1,
       ngx_http_python_content,
@@ -98,6 +184,69 @@ static ngx_command_t  ngx_http_python_commands[] = {
       0,
       NULL },
 
+    { ngx_string("python_content_handler"),
+      NGX_HTTP_LOC_CONF|NGX_HTTP_LIF_CONF|NGX_HTTP_LMT_CONF|NGX_CONF_TAKE1,
+      ngx_http_python_content,
+      NGX_HTTP_LOC_CONF_OFFSET,
+      0,
+      NGX_PYTHON_CALLABLE },
+
+    { ngx_string("python_request_buffering"),
+      NGX_HTTP_MAIN_CONF|NGX_HTTP_SRV_CONF|NGX_HTTP_LOC_CONF|NGX_CONF_FLAG,
+      ngx_conf_set_flag_slot,
+      NGX_HTTP_LOC_CONF_OFFSET,
+      offsetof(ngx_http_python_loc_conf_t, request_buffering),
+      NULL },
+
+    { ngx_string("python_send_buffer"),
+      NGX_HTTP_MAIN_CONF|NGX_HTTP_SRV_CONF|NGX_HTTP_LOC_CONF|NGX_CONF_TAKE1,
+      ngx_conf_set_size_slot,
+      NGX_HTTP_LOC_CONF_OFFSET,
+      offsetof(ngx_http_python_loc_conf_t, send_buffer),
+      NULL },
+
+    { ngx_string("python_output_buffer"),
+      NGX_HTTP_MAIN_CONF|NGX_HTTP_SRV_CONF|NGX_HTTP_LOC_CONF|NGX_CONF_TAKE1,
+      ngx_conf_set_size_slot,
+      NGX_HTTP_LOC_CONF_OFFSET,
+      offsetof(ngx_http_python_loc_conf_t, output_buffer),
+      NULL },
+
+    { ngx_string("python_stack_size"),
+      NGX_HTTP_MAIN_CONF|NGX_HTTP_SRV_CONF|NGX_HTTP_LOC_CONF|NGX_CONF_TAKE1,
+      ngx_conf_set_size_slot,
+      NGX_HTTP_LOC_CONF_OFFSET,
+      offsetof(ngx_http_python_loc_conf_t, python.stack_size),
+      NULL },
+
+    { ngx_string("python_stack_usage"),
+      NGX_HTTP_MAIN_CONF|NGX_HTTP_SRV_CONF|NGX_HTTP_LOC_CONF|NGX_CONF_FLAG,
+      ngx_conf_set_flag_slot,
+      NGX_HTTP_LOC_CONF_OFFSET,
+      offsetof(ngx_http_python_loc_conf_t, python.stack_usage),
+      NULL },
+
+    { ngx_string("python_blocking"),
+      NGX_HTTP_MAIN_CONF|NGX_HTTP_SRV_CONF|NGX_HTTP_LOC_CONF|NGX_CONF_FLAG,
+      ngx_conf_set_flag_slot,
+      NGX_HTTP_LOC_CONF_OFFSET,
+      offsetof(ngx_http_python_loc_conf_t, python.blocking),
+      NULL },
+
+    { ngx_string("python_time_slice"),
+      NGX_HTTP_MAIN_CONF|NGX_HTTP_SRV_CONF|NGX_HTTP_LOC_CONF|NGX_CONF_TAKE1,
+      ngx_conf_set_msec_slot,
+      NGX_HTTP_LOC_CONF_OFFSET,
+      offsetof(ngx_http_python_loc_conf_t, python.time_slice),
+      NULL },
+
+    { ngx_string("python_error_limit"),
+      NGX_HTTP_MAIN_CONF|NGX_HTTP_SRV_CONF|NGX_HTTP_LOC_CONF|NGX_CONF_TAKE1,
+      ngx_conf_set_num_slot,
+      NGX_HTTP_LOC_CONF_OFFSET,
+      offsetof(ngx_http_python_loc_conf_t, python.error_limit),
+      NULL },
+
       ngx_null_command
 };
 
@@ -133,12 +282,72 @@ ngx_module_t  ngx_http_python_module = {
 };
 
 
+static ngx_int_t
+ngx_http_python_preaccess_handler(ngx_http_request_t *r)
+{
+    PyObject                     *ret;
+    ngx_http_python_ctx_t        *ctx;
+    ngx_http_python_async_t      *async;
+    ngx_http_variable_value_t    *v;
+    ngx_http_python_loc_conf_t   *plcf;
+
+    plcf = ngx_http_get_module_loc_conf(r, ngx_http_python_module);
+
+    if (plcf->async == NULL) {
+        return NGX_DECLINED;
+    }
+
+    ngx_log_debug0(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                   "http python preaccess handler");
+
+    async = plcf->async->elts;
+
+    ctx = ngx_http_get_module_ctx(r, ngx_http_python_module);
+    if (ctx == NULL) {
+        ctx = ngx_pcalloc(r->pool, sizeof(ngx_http_python_ctx_t));
+        if (ctx == NULL) {
+            return NGX_ERROR;
+        }
+
+        ngx_http_set_ctx(r, ctx, ngx_http_python_module);
+    }
+
+    /*
+     * the values are evaluated in a coroutine, which allows blocking
+     * operations, and are stored as cached values of the variables
+     */
+
+    while (ctx->async < plcf->async->nelts) {
+        ret = ngx_http_python_eval(r, (PyObject *) async[ctx->async].code,
+                                   r->connection->write);
+
+        if (ret == NGX_PYTHON_AGAIN) {
+            return NGX_AGAIN;
+        }
+
+        if (ret == NULL) {
+            return NGX_HTTP_INTERNAL_SERVER_ERROR;
+        }
+
+        v = &r->variables[async[ctx->async].index];
+
+        if (ngx_http_python_variable_value(r, ret, v) != NGX_OK) {
+            return NGX_HTTP_INTERNAL_SERVER_ERROR;
+        }
+
+        ctx->async++;
+    }
+
+    return NGX_DECLINED;
+}
+
+
 static ngx_int_t
 ngx_http_python_access_handler(ngx_http_request_t *r)
 {
     PyObject                     *ret;
     ngx_int_t                     rc;
-    PyCodeObject                **pcode;
+    PyObject                    **handler;
     ngx_http_python_ctx_t        *ctx;
     ngx_http_python_loc_conf_t   *plcf;
 
@@ -151,7 +360,7 @@ ngx_http_python_access_handler(ngx_http_request_t *r)
     ngx_log_debug0(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
                    "http python access handler");
 
-    pcode = plcf->access->elts;
+    handler = plcf->access->elts;
 
     ctx = ngx_http_get_module_ctx(r, ngx_http_python_module);
     if (ctx == NULL) {
@@ -164,7 +373,8 @@ ngx_http_python_access_handler(ngx_http_request_t *r)
     }
 
     while (ctx->phase < plcf->access->nelts) {
-        ret = ngx_http_python_eval(r, pcode[ctx->phase], r->connection->write);
+        ret = ngx_http_python_eval(r, handler[ctx->phase],
+                                   r->connection->write);
 
         if (ret == NGX_PYTHON_AGAIN) {
             return NGX_AGAIN;
@@ -198,13 +408,54 @@ ngx_http_python_access_handler(ngx_http_request_t *r)
 static ngx_int_t
 ngx_http_python_log_handler(ngx_http_request_t *r)
 {
+    ngx_int_t                    *index;
     ngx_uint_t                    n;
-    PyObject                     *ret;
-    PyCodeObject                **pcode;
+    PyObject                     *ret, *record, *item;
+    PyObject                    **handler;
+    ngx_http_variable_value_t    *v;
     ngx_http_python_loc_conf_t   *plcf;
 
     plcf = ngx_http_get_module_loc_conf(r, ngx_http_python_module);
 
+    if (plcf->log_batch) {
+        ngx_log_debug0(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                       "http python log batch");
+
+        /* a record is a tuple of variable values */
+
+        index = plcf->log_batch->vars->elts;
+
+        record = PyTuple_New(plcf->log_batch->vars->nelts);
+        if (record == NULL) {
+            goto failed;
+        }
+
+        for (n = 0; n < plcf->log_batch->vars->nelts; n++) {
+            v = ngx_http_get_indexed_variable(r, index[n]);
+
+            if (v == NULL || v->not_found) {
+                item = Py_None;
+                Py_INCREF(item);
+
+            } else {
+                item = PyString_FromStringAndSize((char *) v->data, v->len);
+                if (item == NULL) {
+                    Py_DECREF(record);
+                    goto failed;
+                }
+            }
+
+            PyTuple_SET_ITEM(record, n, item);
+        }
+
+        if (ngx_python_batch_add(plcf->log_batch->batch, record) != NGX_OK) {
+            Py_DECREF(record);
+            goto failed;
+        }
+
+        Py_DECREF(record);
+    }
+
     if (plcf->log == NULL) {
         return NGX_OK;
     }
@@ -212,25 +463,39 @@ ngx_http_python_log_handler(ngx_http_request_t *r)
     ngx_log_debug0(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
                    "http python log handler");
 
-    pcode = plcf->log->elts;
+    handler = plcf->log->elts;
 
     for (n = 0; n < plcf->log->nelts; n++) {
-        ret = ngx_http_python_eval(r, pcode[n], NULL);
+        ret = ngx_http_python_eval(r, handler[n], NULL);
         Py_XDECREF(ret);
     }
 
     return NGX_OK;
+
+failed:
+
+    ngx_log_error(NGX_LOG_ERR, r->connection->log, 0, "python error: %s",
+                  ngx_python_get_error(r->pool));
+
+    return NGX_OK;
 }
 
 
 static ngx_int_t
 ngx_http_python_content_handler(ngx_http_request_t *r)
 {
-    ngx_int_t  rc;
+    ngx_int_t                    rc;
+    ngx_http_python_loc_conf_t  *plcf;
 
     ngx_log_debug0(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
                    "http python content handler");
 
+    plcf = ngx_http_get_module_loc_conf(r, ngx_http_python_module);
+
+    if (!plcf->request_buffering) {
+        r->request_body_no_buffering = 1;
+    }
+
     rc = ngx_http_read_client_request_body(r,
                                          ngx_http_python_content_event_handler);
 
@@ -254,6 +519,16 @@ ngx_http_python_content_event_handler(ngx_http_request_t *r)
 
     plcf = ngx_http_get_module_loc_conf(r, ngx_http_python_module);
 
+    if (r->reading_body) {
+        r->read_event_handler = ngx_http_python_read_handler;
+
+    } else {
+
+        /* a client closing connection terminates a suspended handler */
+
+        r->read_event_handler = ngx_http_test_reading;
+    }
+
     ret = ngx_http_python_eval(r, plcf->content, r->connection->write);
 
     if (ret == NGX_PYTHON_AGAIN) {
@@ -274,24 +549,86 @@ ngx_http_python_content_event_handler(ngx_http_request_t *r)
 }
 
 
+static void
+ngx_http_python_read_handler(ngx_http_request_t *r)
+{
+    ngx_http_python_ctx_t  *ctx;
+
+    ngx_log_debug0(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                   "http python read handler");
+
+    /* unbuffered request body is read by the coroutine waiting in r.read() */
+
+    ctx = ngx_http_get_module_ctx(r, ngx_http_python_module);
+
+    if (ctx == NULL
+        || ctx->request == NULL
+        || ngx_http_python_request_wakeup(ctx->request) != NGX_OK)
+    {
+        ngx_http_block_reading(r);
+    }
+}
+
+
 static ngx_int_t
 ngx_http_python_variable(ngx_http_request_t *r, ngx_http_variable_value_t *v,
     uintptr_t data)
 {
-    PyCodeObject  *code = (PyCodeObject *) data;
+    ngx_http_python_var_t  *pv = (ngx_http_python_var_t *) data;
 
-    u_char      *p;
-    PyObject    *ret, *str;
-    Py_ssize_t   size;
+    PyObject   *ret;
+    ngx_str_t   key;
 
     ngx_log_debug0(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
                    "http python variable handler");
 
-    ret = ngx_http_python_eval(r, code, NULL);
+    if (pv->key) {
+        if (ngx_http_complex_value(r, pv->key, &key) != NGX_OK) {
+            return NGX_ERROR;
+        }
+
+        if (ngx_http_python_memo_get(r, pv, &key, v) == NGX_OK) {
+            return NGX_OK;
+        }
+    }
+
+    ret = ngx_http_python_eval(r, (PyObject *) pv->code, NULL);
     if (ret == NULL) {
         return NGX_ERROR;
     }
 
+    if (ngx_http_python_variable_value(r, ret, v) != NGX_OK) {
+        return NGX_ERROR;
+    }
+
+    if (pv->key) {
+        ngx_http_python_memo_set(r, pv, &key, v);
+    }
+
+    return NGX_OK;
+}
+
+
+static ngx_int_t
+ngx_http_python_async_variable(ngx_http_request_t *r,
+    ngx_http_variable_value_t *v, uintptr_t data)
+{
+    /* the value is set at the preaccess phase */
+
+    v->not_found = 1;
+
+    return NGX_OK;
+}
+
+
+static ngx_int_t
+ngx_http_python_variable_value(ngx_http_request_t *r, PyObject *ret,
+    ngx_http_variable_value_t *v)
+{
+    u_char      *p;
+    PyObject    *str;
+    Py_ssize_t   size;
+
     str = PyObject_Str(ret);
     Py_DECREF(ret);
 
@@ -329,16 +666,127 @@ ngx_http_python_variable(ngx_http_request_t *r, ngx_http_variable_value_t *v,
 }
 
 
+static ngx_int_t
+ngx_http_python_memo_get(ngx_http_request_t *r, ngx_http_python_var_t *pv,
+    ngx_str_t *key, ngx_http_variable_value_t *v)
+{
+    uint32_t                      hash;
+    ngx_http_python_memo_node_t  *node;
+
+    hash = ngx_crc32_short(key->data, key->len);
+
+    node = (ngx_http_python_memo_node_t *)
+               ngx_str_rbtree_lookup(&pv->rbtree, key, hash);
+
+    if (node == NULL) {
+        ngx_log_debug1(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                       "http python memo miss \"%V\"", key);
+        return NGX_DECLINED;
+    }
+
+    if (pv->ttl && (ngx_msec_int_t) (node->expire - ngx_current_msec) <= 0) {
+        ngx_log_debug1(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                       "http python memo expired \"%V\"", key);
+
+        ngx_http_python_memo_delete(pv, node);
+        return NGX_DECLINED;
+    }
+
+    ngx_log_debug1(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                   "http python memo hit \"%V\"", key);
+
+    ngx_queue_remove(&node->queue);
+    ngx_queue_insert_head(&pv->lru, &node->queue);
+
+    /* the node may be evicted while the request is still running */
+
+    v->len = node->value.len;
+    v->data = ngx_pnalloc(r->pool, node->value.len);
+    if (v->data == NULL) {
+        return NGX_ERROR;
+    }
+
+    ngx_memcpy(v->data, node->value.data, node->value.len);
+
+    v->valid = 1;
+    v->no_cacheable = 0;
+    v->not_found = 0;
+
+    return NGX_OK;
+}
+
+
+static void
+ngx_http_python_memo_set(ngx_http_request_t *r, ngx_http_python_var_t *pv,
+    ngx_str_t *key, ngx_http_variable_value_t *v)
+{
+    u_char                       *p;
+    ngx_queue_t                  *q;
+    ngx_http_python_memo_node_t  *node;
+
+    if (pv->max == 0) {
+        return;
+    }
+
+    while (pv->nodes >= pv->max) {
+        q = ngx_queue_last(&pv->lru);
+        node = ngx_queue_data(q, ngx_http_python_memo_node_t, queue);
+
+        ngx_http_python_memo_delete(pv, node);
+    }
+
+    node = ngx_alloc(sizeof(ngx_http_python_memo_node_t) + key->len + v->len,
+                     r->connection->log);
+    if (node == NULL) {
+        return;
+    }
+
+    p = (u_char *) (node + 1);
+
+    node->sn.str.len = key->len;
+    node->sn.str.data = p;
+    p = ngx_cpymem(p, key->data, key->len);
+
+    node->value.len = v->len;
+    node->value.data = p;
+    ngx_memcpy(p, v->data, v->len);
+
+    node->sn.node.key = ngx_crc32_short(key->data, key->len);
+    node->expire = ngx_current_msec + pv->ttl;
+
+    ngx_rbtree_insert(&pv->rbtree, &node->sn.node);
+    ngx_queue_insert_head(&pv->lru, &node->queue);
+
+    pv->nodes++;
+}
+
+
+static void
+ngx_http_python_memo_delete(ngx_http_python_var_t *pv,
+    ngx_http_python_memo_node_t *node)
+{
+    ngx_rbtree_delete(&pv->rbtree, &node->sn.node);
+    ngx_queue_remove(&node->queue);
+
+    pv->nodes--;
+
+    ngx_free(node);
+}
+
+
 static PyObject *
-ngx_http_python_eval(ngx_http_request_t *r, PyCodeObject *code,
+ngx_http_python_eval(ngx_http_request_t *r, PyObject *handler,
     ngx_event_t *wake)
 {
-    PyObject                  *result, *old;
-    ngx_http_python_ctx_t     *ctx;
-    ngx_http_core_loc_conf_t  *clcf;
+    PyObject                    *result, *old;
+    ngx_pool_cleanup_t          *cln;
+    ngx_http_python_ctx_t       *ctx;
+    ngx_http_core_loc_conf_t    *clcf;
+    ngx_http_python_loc_conf_t  *plcf;
 
     ngx_log_debug2(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
-                   "http python eval start code:%p, wake:%p", code, wake);
+                   "http python eval start handler:%p, wake:%p",
+                   handler, wake);
 
     ctx = ngx_http_get_module_ctx(r, ngx_http_python_module);
     if (ctx == NULL) {
@@ -357,8 +805,12 @@ ngx_http_python_eval(ngx_http_request_t *r, PyCodeObject *code,
         }
     }
 
+    plcf = ngx_http_get_module_loc_conf(r, ngx_http_python_module);
+
     if (ctx->request == NULL) {
-        ctx->request = ngx_http_python_request_create(r);
+        ctx->request = ngx_http_python_request_create(r, ctx->python,
+                                                      plcf->send_buffer,
+                                                      plcf->output_buffer);
         if (ctx->request == NULL) {
             return NULL;
         }
@@ -369,15 +821,45 @@ ngx_http_python_eval(ngx_http_request_t *r, PyCodeObject *code,
     ngx_python_set_resolver(ctx->python, clcf->resolver,
                             clcf->resolver_timeout);
 
-    old = ngx_python_set_value(ctx->python, "r", ctx->request);
+    ngx_python_set_ctx_conf(ctx->python, &plcf->python);
+
+    if (PyCode_Check(handler)) {
+        old = ngx_python_set_value(ctx->python, "r", ctx->request);
+
+        result = ngx_python_eval(ctx->python, (PyCodeObject *) handler, wake);
+
+        ngx_python_reset_value(ctx->python, "r", old);
+
+    } else {
+
+        /* a callable is called with the request object as an argument */
+
+        if (ctx->args == NULL) {
+            ctx->args = PyTuple_Pack(1, ctx->request);
+            if (ctx->args == NULL) {
+                return NULL;
+            }
+
+            cln = ngx_pool_cleanup_add(r->pool, 0);
+            if (cln == NULL) {
+                Py_CLEAR(ctx->args);
+                return NULL;
+            }
+
+            cln->handler = ngx_python_decref;
+            cln->data = ctx->args;
+        }
+
+        result = ngx_python_call(ctx->python, handler, ctx->args, wake);
+    }
 
-    result = ngx_python_eval(ctx->python, code, wake);
+    /* buffered output is sent once the handler yields or returns */
 
-    ngx_python_reset_value(ctx->python, "r", old);
+    ngx_http_python_request_flush(ctx->request);
 
     ngx_log_debug3(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
-                   "http python eval end code:%p, wake:%p, result:%p",
-                   code, wake, result);
+                   "http python eval end handler:%p, wake:%p, result:%p",
+                   handler, wake, result);
 
     return result;
 }
@@ -399,8 +881,15 @@ ngx_http_python_create_loc_conf(ngx_conf_t *cf)
      *     plcf->content = NULL;
      */
 
+    plcf->async = NGX_CONF_UNSET_PTR;
     plcf->access = NGX_CONF_UNSET_PTR;
     plcf->log = NGX_CONF_UNSET_PTR;
+    plcf->log_batch = NGX_CONF_UNSET_PTR;
+    plcf->request_buffering = NGX_CONF_UNSET;
+    plcf->send_buffer = NGX_CONF_UNSET_SIZE;
+    plcf->output_buffer = NGX_CONF_UNSET_SIZE;
+
+    ngx_python_create_ctx_conf(&plcf->python);
 
     return plcf;
 }
@@ -412,19 +901,27 @@ ngx_http_python_merge_loc_conf(ngx_conf_t *cf, void *parent, void *child)
     ngx_http_python_loc_conf_t *prev = parent;
     ngx_http_python_loc_conf_t *conf = child;
 
+    ngx_conf_merge_ptr_value(conf->async, prev->async, NULL);
     ngx_conf_merge_ptr_value(conf->access, prev->access, NULL);
     ngx_conf_merge_ptr_value(conf->log, prev->log, NULL);
+    ngx_conf_merge_ptr_value(conf->log_batch, prev->log_batch, NULL);
+    ngx_conf_merge_value(conf->request_buffering, prev->request_buffering, 1);
+    ngx_conf_merge_size_value(conf->send_buffer, prev->send_buffer, 0);
+    ngx_conf_merge_size_value(conf->output_buffer, prev->output_buffer, 0);
 
-    return NGX_CONF_OK;
+    return ngx_python_merge_ctx_conf(cf, &conf->python, &prev->python);
 }
 
 
 static char *
 ngx_http_python_set(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
 {
-    ngx_str_t            *value;
-    PyCodeObject         *code;
-    ngx_http_variable_t  *var;
+    ngx_int_t                          n;
+    ngx_str_t                         *value, s;
+    ngx_uint_t                         i, flags;
+    ngx_http_variable_t               *var;
+    ngx_http_python_var_t             *pv;
+    ngx_http_compile_complex_value_t   ccv;
 
     value = cf->args->elts;
 
@@ -437,18 +934,159 @@ ngx_http_python_set(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
     value[1].len--;
     value[1].data++;
 
-    var = ngx_http_add_variable(cf, &value[1], NGX_HTTP_VAR_NOCACHEABLE);
+    pv = ngx_pcalloc(cf->pool, sizeof(ngx_http_python_var_t));
+    if (pv == NULL) {
+        return NGX_CONF_ERROR;
+    }
+
+    /*
+     * set by ngx_pcalloc():
+     *
+     *     pv->key = NULL;
+     *     pv->ttl = 0;
+     *     pv->nodes = 0;
+     */
+
+    pv->max = 1000;
+
+    flags = NGX_HTTP_VAR_NOCACHEABLE;
+
+    for (i = 3; i < cf->args->nelts; i++) {
+
+        if (ngx_strcmp(value[i].data, "cache") == 0) {
+            flags &= ~NGX_HTTP_VAR_NOCACHEABLE;
+            continue;
+        }
+
+        if (ngx_strncmp(value[i].data, "key=", 4) == 0) {
+
+            s.len = value[i].len - 4;
+            s.data = value[i].data + 4;
+
+            pv->key = ngx_palloc(cf->pool, sizeof(ngx_http_complex_value_t));
+            if (pv->key == NULL) {
+                return NGX_CONF_ERROR;
+            }
+
+            ngx_memzero(&ccv, sizeof(ngx_http_compile_complex_value_t));
+
+            ccv.cf = cf;
+            ccv.value = &s;
+            ccv.complex_value = pv->key;
+
+            if (ngx_http_compile_complex_value(&ccv) != NGX_OK) {
+                return NGX_CONF_ERROR;
+            }
+
+            continue;
+        }
+
+        if (ngx_strncmp(value[i].data, "ttl=", 4) == 0) {
+
+            s.len = value[i].len - 4;
+            s.data = value[i].data + 4;
+
+            pv->ttl = ngx_parse_time(&s, 0);
+            if (pv->ttl == (ngx_msec_t) NGX_ERROR) {
+                goto invalid;
+            }
+
+            continue;
+        }
+
+        if (ngx_strncmp(value[i].data, "max=", 4) == 0) {
+
+            n = ngx_atoi(value[i].data + 4, value[i].len - 4);
+            if (n == NGX_ERROR) {
+                goto invalid;
+            }
+
+            pv->max = n;
+
+            continue;
+        }
+
+        goto invalid;
+    }
+
+    var = ngx_http_add_variable(cf, &value[1], flags);
     if (var == NULL) {
         return NGX_CONF_ERROR;
     }
 
-    code = ngx_python_compile(cf, value[2].data);
-    if (code == NULL) {
+    pv->code = ngx_python_compile(cf, value[2].data);
+    if (pv->code == NULL) {
         return NGX_CONF_ERROR;
     }
 
+    ngx_rbtree_init(&pv->rbtree, &pv->sentinel, ngx_str_rbtree_insert_value);
+    ngx_queue_init(&pv->lru);
+
     var->get_handler = ngx_http_python_variable;
-    var->data = (uintptr_t) code;
+    var->data = (uintptr_t) pv;
+
+    return NGX_CONF_OK;
+
+invalid:
+
+    ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                       "invalid parameter \"%V\"", &value[i]);
+
+    return NGX_CONF_ERROR;
+}
+
+
+static char *
+ngx_http_python_set_async(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
+{
+    ngx_http_python_loc_conf_t *plcf = conf;
+
+    ngx_str_t                *value;
+    ngx_http_variable_t      *var;
+    ngx_http_python_async_t  *async;
+
+    value = cf->args->elts;
+
+    if (value[1].data[0] != '$') {
+        ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                           "invalid variable name \"%V\"", &value[1]);
+        return NGX_CONF_ERROR;
+    }
+
+    value[1].len--;
+    value[1].data++;
+
+    /* the variable may be set with different expressions in locations */
+
+    var = ngx_http_add_variable(cf, &value[1], NGX_HTTP_VAR_CHANGEABLE);
+    if (var == NULL) {
+        return NGX_CONF_ERROR;
+    }
+
+    var->get_handler = ngx_http_python_async_variable;
+
+    if (plcf->async == NGX_CONF_UNSET_PTR) {
+        plcf->async = ngx_array_create(cf->pool, 1,
+                                       sizeof(ngx_http_python_async_t));
+        if (plcf->async == NULL) {
+            return NGX_CONF_ERROR;
+        }
+    }
+
+    async = ngx_array_push(plcf->async);
+    if (async == NULL) {
+        return NGX_CONF_ERROR;
+    }
+
+    async->index = ngx_http_get_variable_index(cf, &value[1]);
+    if (async->index == NGX_ERROR) {
+        return NGX_CONF_ERROR;
+    }
+
+    async->code = ngx_python_compile(cf, value[2].data);
+    if (async->code == NULL) {
+        return NGX_CONF_ERROR;
+    }
 
     return NGX_CONF_OK;
 }
@@ -459,25 +1097,25 @@ ngx_http_python_access(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
 {
     ngx_http_python_loc_conf_t *plcf = conf;
 
-    ngx_str_t      *value;
-    PyCodeObject  **pcode;
+    ngx_str_t   *value;
+    PyObject   **handler;
 
     value = cf->args->elts;
 
     if (plcf->access == NGX_CONF_UNSET_PTR) {
-        plcf->access = ngx_array_create(cf->pool, 1, sizeof(PyCodeObject *));
+        plcf->access = ngx_array_create(cf->pool, 1, sizeof(PyObject *));
         if (plcf->access == NULL) {
             return NGX_CONF_ERROR;
         }
     }
 
-    pcode = ngx_array_push(plcf->access);
-    if (pcode == NULL) {
+    handler = ngx_array_push(plcf->access);
+    if (handler == NULL) {
         return NGX_CONF_ERROR;
     }
 
-    *pcode = ngx_python_compile(cf, value[1].data);
-    if (*pcode == NULL) {
+    *handler = ngx_python_conf_handler(cf, cmd, value[1].data);
+    if (*handler == NULL) {
         return NGX_CONF_ERROR;
     }
 
@@ -490,25 +1128,25 @@ ngx_http_python_log(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
 {
     ngx_http_python_loc_conf_t *plcf = conf;
 
-    ngx_str_t      *value;
-    PyCodeObject  **pcode;
+    ngx_str_t   *value;
+    PyObject   **handler;
 
     value = cf->args->elts;
 
     if (plcf->log == NGX_CONF_UNSET_PTR) {
-        plcf->log = ngx_array_create(cf->pool, 1, sizeof(PyCodeObject *));
+        plcf->log = ngx_array_create(cf->pool, 1, sizeof(PyObject *));
         if (plcf->log == NULL) {
             return NGX_CONF_ERROR;
         }
     }
 
-    pcode = ngx_array_push(plcf->log);
-    if (pcode == NULL) {
+    handler = ngx_array_push(plcf->log);
+    if (handler == NULL) {
         return NGX_CONF_ERROR;
     }
 
-    *pcode = ngx_python_compile(cf, value[1].data);
-    if (*pcode == NULL) {
+    *handler = ngx_python_conf_handler(cf, cmd, value[1].data);
+    if (*handler == NULL) {
         return NGX_CONF_ERROR;
     }
 
@@ -530,7 +1168,7 @@ ngx_http_python_content(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
         return "is duplicate";
     }
 
-    plcf->content = ngx_python_compile(cf, value[1].data);
+    plcf->content = ngx_python_conf_handler(cf, cmd, value[1].data);
     if (plcf->content == NULL) {
         return NGX_CONF_ERROR;
     }
@@ -543,6 +1181,101 @@ ngx_http_python_content(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
 }
 
 
+static char *
+ngx_http_python_log_batch(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
+{
+    ngx_http_python_loc_conf_t *plcf = conf;
+
+    ngx_int_t                    *index, n;
+    ngx_str_t                    *value, s;
+    ngx_uint_t                    i, size;
+    ngx_msec_t                    interval;
+    ngx_http_python_log_batch_t  *lb;
+
+    if (plcf->log_batch != NGX_CONF_UNSET_PTR) {
+        return "is duplicate";
+    }
+
+    lb = ngx_palloc(cf->pool, sizeof(ngx_http_python_log_batch_t));
+    if (lb == NULL) {
+        return NGX_CONF_ERROR;
+    }
+
+    lb->vars = ngx_array_create(cf->pool, 4, sizeof(ngx_int_t));
+    if (lb->vars == NULL) {
+        return NGX_CONF_ERROR;
+    }
+
+    value = cf->args->elts;
+
+    size = 100;
+    interval = 1000;
+
+    for (i = 2; i < cf->args->nelts; i++) {
+
+        if (value[i].data[0] == '$') {
+            value[i].len--;
+            value[i].data++;
+
+            index = ngx_array_push(lb->vars);
+            if (index == NULL) {
+                return NGX_CONF_ERROR;
+            }
+
+            *index = ngx_http_get_variable_index(cf, &value[i]);
+            if (*index == NGX_ERROR) {
+                return NGX_CONF_ERROR;
+            }
+
+            continue;
+        }
+
+        if (ngx_strncmp(value[i].data, "size=", 5) == 0) {
+
+            n = ngx_atoi(value[i].data + 5, value[i].len - 5);
+            if (n == NGX_ERROR || n == 0) {
+                goto invalid;
+            }
+
+            size = n;
+
+            continue;
+        }
+
+        if (ngx_strncmp(value[i].data, "interval=", 9) == 0) {
+
+            s.len = value[i].len - 9;
+            s.data = value[i].data + 9;
+
+            interval = ngx_parse_time(&s, 0);
+            if (interval == (ngx_msec_t) NGX_ERROR) {
+                goto invalid;
+            }
+
+            continue;
+        }
+
+        goto invalid;
+    }
+
+    lb->batch = ngx_python_batch_create(cf, value[1].data, size, interval);
+    if (lb->batch == NULL) {
+        return NGX_CONF_ERROR;
+    }
+
+    plcf->log_batch = lb;
+
+    return NGX_CONF_OK;
+
+invalid:
+
+    ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                       "invalid parameter \"%V\"", &value[i]);
+
+    return NGX_CONF_ERROR;
+}
+
+
 static ngx_int_t
 ngx_http_python_init(ngx_conf_t *cf)
 {
@@ -559,6 +1292,13 @@ ngx_http_python_init(ngx_conf_t *cf)
 
     cmcf = ngx_http_conf_get_module_main_conf(cf, ngx_http_core_module);
 
+    h = ngx_array_push(&cmcf->phases[NGX_HTTP_PREACCESS_PHASE].handlers);
+    if (h == NULL) {
+        return NGX_ERROR;
+    }
+
+    *h = ngx_http_python_preaccess_handler;
+
     h = ngx_array_push(&cmcf->phases[NGX_HTTP_ACCESS_PHASE].handlers);
     if (h == NULL) {
         return NGX_ERROR;
@@ -8,6 +8,7 @@
 #include <ngx_config.h>
 #include <ngx_core.h>
 #include <ngx_http.h>
+#include <nginx.h>
 #include "ngx_http_python_request.h"
 
 
@@ -16,20 +17,60 @@
  *
  *   hi{}
  *   ho{}
+ *     keys()
+ *     items()
+ *     get_all()
  *   var{}
  *   arg{}
  *   ctx{}
  *   status
+ *   body
+ *   bodyFile
  *   log()
+ *   read()
+ *   readinto()
  *   sendHeader()
  *   send()
+ *   sendv()
+ *   sendFile()
  */
 
 
+/*
+ * Data of objects supporting the buffer protocol is sent without copying.
+ * The buffer is pinned until nginx consumes it, which is checked on
+ * subsequent sends and when the request is finalized.
+ */
+
+typedef struct ngx_http_python_request_pin_s  ngx_http_python_request_pin_t;
+
+struct ngx_http_python_request_pin_s {
+    ngx_buf_t                        buf;
+    Py_buffer                        view;
+    ngx_http_python_request_pin_t   *next;
+};
+
+
 typedef struct {
     PyObject_HEAD
-    ngx_http_request_t          *request;
-    PyObject                    *ctx;
+    ngx_http_request_t              *request;
+    PyObject                        *ctx;
+    PyObject                        *hi;
+    PyObject                        *ho;
+    PyObject                        *arg;
+    PyObject                        *var;
+    PyObject                        *body;
+    ngx_http_python_request_pin_t   *pinned;
+    ngx_http_python_request_pin_t   *free;
+    ngx_python_ctx_t                *python;
+    size_t                           send_buffer;
+    size_t                           output_buffer;
+    ngx_chain_t                     *buffered;
+    ngx_chain_t                     *free_bufs;
+    ngx_chain_t                     *busy_bufs;
+#if !(NGX_PYTHON_SYNC)
+    ngx_python_ctx_t                *reader;
+#endif
 } ngx_http_python_request_t;
 
 
@@ -52,12 +93,63 @@ typedef struct {
 } ngx_http_python_request_var_t;
 
 
+/*
+ * The body object references request body memory directly.  The number of
+ * buffers exported through the new buffer protocol is counted: if some are
+ * still alive when the request is finalized, the data is copied to memory
+ * owned by the object, otherwise the object is detached from the data.
+ */
+
+typedef struct {
+    PyObject_HEAD
+    u_char                      *data;
+    size_t                       len;
+    ngx_uint_t                   exports;
+    ngx_uint_t                   copied;  /* unsigned  copied:1; */
+} ngx_http_python_request_body_t;
+
+
+typedef struct ngx_http_python_header_out_s  ngx_http_python_header_out_t;
+
+typedef ngx_int_t (*ngx_http_python_header_out_pt)(ngx_http_request_t *r,
+    ngx_http_python_header_out_t *hh, ngx_str_t *value);
+
+
+struct ngx_http_python_header_out_s {
+    ngx_str_t                       name;
+    ngx_uint_t                      offset;
+    ngx_http_python_header_out_pt   handler;
+};
+
+
 static PyObject *ngx_http_python_request_log(ngx_http_python_request_t* self,
     PyObject* args);
 static PyObject *ngx_http_python_request_send_header(
     ngx_http_python_request_t* self);
 static PyObject *ngx_http_python_request_send(ngx_http_python_request_t* self,
     PyObject* args);
+static PyObject *ngx_http_python_request_read(ngx_http_python_request_t* self,
+    PyObject* args);
+static PyObject *ngx_http_python_request_readinto(
+    ngx_http_python_request_t* self, PyObject* args);
+static PyObject *ngx_http_python_request_sendv(
+    ngx_http_python_request_t* self, PyObject* args);
+static PyObject *ngx_http_python_request_send_file(
+    ngx_http_python_request_t* self, PyObject* args);
+static ngx_buf_t *ngx_http_python_request_buf(
+    ngx_http_python_request_t *self, PyObject *data);
+static void ngx_http_python_request_unpin(ngx_http_python_request_t *self,
+    ngx_uint_t all);
+static ngx_int_t ngx_http_python_request_append(
+    ngx_http_python_request_t *self, PyObject *data);
+static ngx_int_t ngx_http_python_request_output(
+    ngx_http_python_request_t *self, ngx_chain_t *in, int flags);
+static ngx_int_t ngx_http_python_request_drain(
+    ngx_http_python_request_t *self);
+static ssize_t ngx_http_python_request_wait_body(
+    ngx_http_python_request_t *self);
+static ngx_int_t ngx_http_python_request_copy_body(ngx_http_request_t *r,
+    u_char *p, size_t size);
 static PyObject *ngx_http_python_request_hi(ngx_http_python_request_t *self);
 static PyObject *ngx_http_python_request_ho(ngx_http_python_request_t *self);
 static PyObject *ngx_http_python_request_arg(ngx_http_python_request_t *self);
@@ -67,14 +159,47 @@ static PyObject *ngx_http_python_request_get_status(
     ngx_http_python_request_t *self);
 static int ngx_http_python_request_set_status(ngx_http_python_request_t *self,
     PyObject *value);
+static PyObject *ngx_http_python_request_body(ngx_http_python_request_t *self);
+static PyObject *ngx_http_python_request_body_file(
+    ngx_http_python_request_t *self);
 static void ngx_http_python_request_dealloc(ngx_http_python_request_t *self);
 
 static PyObject *ngx_http_python_request_hdr_subscript(
     ngx_http_python_request_hdr_t *self, PyObject *key);
 static int ngx_http_python_request_hdr_ass_subscript(
     ngx_http_python_request_hdr_t *self, PyObject *key, PyObject *value);
+static Py_ssize_t ngx_http_python_request_hdr_length(
+    ngx_http_python_request_hdr_t *self);
+static PyObject *ngx_http_python_request_hdr_keys(
+    ngx_http_python_request_hdr_t *self);
+static PyObject *ngx_http_python_request_hdr_items(
+    ngx_http_python_request_hdr_t *self);
+static PyObject *ngx_http_python_request_hdr_get_all(
+    ngx_http_python_request_hdr_t *self, PyObject *args);
+static PyObject *ngx_http_python_request_hdr_list(
+    ngx_http_python_request_hdr_t *self, ngx_uint_t type, u_char *data,
+    size_t len);
+static int ngx_http_python_request_hdr_append(PyObject *list, ngx_uint_t type,
+    ngx_table_elt_t *h);
 static ngx_table_elt_t *ngx_http_python_find_header(ngx_list_t *headers,
     u_char *data, size_t len);
+static ngx_http_python_header_out_t *ngx_http_python_find_header_out(
+    u_char *data, size_t len);
+static ngx_int_t ngx_http_python_set_header(ngx_http_request_t *r,
+    ngx_str_t *key, ngx_str_t *value, ngx_table_elt_t **ph);
+static ngx_int_t ngx_http_python_set_header_out(ngx_http_request_t *r,
+    ngx_http_python_header_out_t *hh, ngx_str_t *value);
+static ngx_int_t ngx_http_python_set_content_type(ngx_http_request_t *r,
+    ngx_http_python_header_out_t *hh, ngx_str_t *value);
+static ngx_int_t ngx_http_python_set_content_length(ngx_http_request_t *r,
+    ngx_http_python_header_out_t *hh, ngx_str_t *value);
+static ngx_int_t ngx_http_python_set_last_modified(ngx_http_request_t *r,
+    ngx_http_python_header_out_t *hh, ngx_str_t *value);
+static ngx_int_t ngx_http_python_init_headers_out(ngx_conf_t *cf);
+static ngx_table_elt_t *ngx_http_python_find_header_in(ngx_http_request_t *r,
+    u_char *data, size_t len);
+static ngx_int_t ngx_http_python_header_hash(u_char *data, size_t len,
+    u_char *lowcase, ngx_uint_t *hash);
 static void ngx_http_python_request_hdr_dealloc(
     ngx_http_python_request_hdr_t *self);
 
@@ -88,6 +213,24 @@ static PyObject *ngx_http_python_request_var_subscript(
 static void ngx_http_python_request_var_dealloc(
     ngx_http_python_request_var_t *self);
 
+static Py_ssize_t ngx_http_python_request_body_length(
+    ngx_http_python_request_body_t *self);
+static PyObject *ngx_http_python_request_body_str(
+    ngx_http_python_request_body_t *self);
+static Py_ssize_t ngx_http_python_request_body_getreadbuffer(
+    ngx_http_python_request_body_t *self, Py_ssize_t segment, void **ptr);
+static Py_ssize_t ngx_http_python_request_body_getsegcount(
+    ngx_http_python_request_body_t *self, Py_ssize_t *lenp);
+static int ngx_http_python_request_body_getbuffer(
+    ngx_http_python_request_body_t *self, Py_buffer *view, int flags);
+static void ngx_http_python_request_body_releasebuffer(
+    ngx_http_python_request_body_t *self, Py_buffer *view);
+static void ngx_http_python_request_body_detach(
+    ngx_http_python_request_body_t *self, ngx_log_t *log);
+static void ngx_http_python_request_body_dealloc(
+    ngx_http_python_request_body_t *self);
+
+
 static void ngx_http_python_request_cleanup(void *data);
 
 
@@ -108,6 +251,26 @@ static PyMethodDef ngx_http_python_request_methods[] = {
       METH_VARARGS,
       "send a piece of response body to the client" },
 
+    { "sendv",
+      (PyCFunction) ngx_http_python_request_sendv,
+      METH_VARARGS,
+      "send a sequence of response body pieces to the client" },
+
+    { "sendFile",
+      (PyCFunction) ngx_http_python_request_send_file,
+      METH_VARARGS,
+      "send a file or its part to the client" },
+
+    { "read",
+      (PyCFunction) ngx_http_python_request_read,
+      METH_VARARGS,
+      "read a piece of request body" },
+
+    { "readinto",
+      (PyCFunction) ngx_http_python_request_readinto,
+      METH_VARARGS,
+      "read a piece of request body into a writable buffer" },
+
     { NULL, NULL, 0, NULL }
 };
 
@@ -150,6 +313,18 @@ static PyGetSetDef ngx_http_python_request_getset[] = {
       "HTTP response status",
       NULL },
 
+    { "body",
+      (getter) ngx_http_python_request_body,
+      NULL,
+      "HTTP request body in memory",
+      NULL },
+
+    { "bodyFile",
+      (getter) ngx_http_python_request_body_file,
+      NULL,
+      "HTTP request body temporary file",
+      NULL },
+
     { NULL, NULL, NULL, NULL, NULL }
 };
 
@@ -211,8 +386,29 @@ static PyTypeObject  ngx_http_python_request_type = {
 #endif
 
 
+static PyMethodDef ngx_http_python_request_hdr_methods[] = {
+
+    { "keys",
+      (PyCFunction) ngx_http_python_request_hdr_keys,
+      METH_NOARGS,
+      "return a list of header names" },
+
+    { "items",
+      (PyCFunction) ngx_http_python_request_hdr_items,
+      METH_NOARGS,
+      "return a list of header (name, value) pairs" },
+
+    { "get_all",
+      (PyCFunction) ngx_http_python_request_hdr_get_all,
+      METH_VARARGS,
+      "return a list of values of all headers with the name" },
+
+    { NULL, NULL, 0, NULL }
+};
+
+
 static PyMappingMethods ngx_http_python_request_hdr_mapping = {
-    NULL,                                          /*mp_length*/
+    (lenfunc) ngx_http_python_request_hdr_length,  /*mp_length*/
     (binaryfunc) ngx_http_python_request_hdr_subscript,
                                                    /*mp_subscript*/
     (objobjargproc) ngx_http_python_request_hdr_ass_subscript,
@@ -227,7 +423,8 @@ static PyTypeObject  ngx_http_python_request_hdr_type = {
     .tp_dealloc = (destructor) ngx_http_python_request_hdr_dealloc,
     .tp_as_mapping = &ngx_http_python_request_hdr_mapping,
     .tp_flags = Py_TPFLAGS_DEFAULT,
-    .tp_doc = "HTTP headers"
+    .tp_doc = "HTTP headers",
+    .tp_methods = ngx_http_python_request_hdr_methods
 };
 
 
@@ -356,9 +553,92 @@ static PyTypeObject  ngx_http_python_request_var_type = {
 #endif
 
 
+
+static PyMappingMethods ngx_http_python_request_body_mapping = {
+    (lenfunc) ngx_http_python_request_body_length, /*mp_length*/
+    NULL,                                          /*mp_subscript*/
+    NULL,                                          /*mp_ass_subscript*/
+};
+
+
+static PyBufferProcs ngx_http_python_request_body_buffer = {
+    (readbufferproc) ngx_http_python_request_body_getreadbuffer,
+                                                   /*bf_getreadbuffer*/
+    NULL,                                          /*bf_getwritebuffer*/
+    (segcountproc) ngx_http_python_request_body_getsegcount,
+                                                   /*bf_getsegcount*/
+    (charbufferproc) ngx_http_python_request_body_getreadbuffer,
+                                                   /*bf_getcharbuffer*/
+    (getbufferproc) ngx_http_python_request_body_getbuffer,
+                                                   /*bf_getbuffer*/
+    (releasebufferproc) ngx_http_python_request_body_releasebuffer,
+                                                   /*bf_releasebuffer*/
+};
+
+
+static PyTypeObject  ngx_http_python_request_body_type = {
+    .ob_refcnt = 1,
+    .tp_name = "ngx.HttpRequestBody",
+    .tp_basicsize = sizeof(ngx_http_python_request_body_t),
+    .tp_dealloc = (destructor) ngx_http_python_request_body_dealloc,
+    .tp_as_mapping = &ngx_http_python_request_body_mapping,
+    .tp_str = (reprfunc) ngx_http_python_request_body_str,
+    .tp_as_buffer = &ngx_http_python_request_body_buffer,
+    .tp_flags = Py_TPFLAGS_DEFAULT | Py_TPFLAGS_HAVE_NEWBUFFER,
+    .tp_doc = "HTTP request body"
+};
+
 static PyObject  *ngx_http_python_request_error;
 
 
+/*
+ * Output headers nginx keeps in r->headers_out fields.  Setting them from
+ * Python updates the fields, so that the header filter does not duplicate
+ * them, and the not modified, range and other filters can use them.
+ * Location is left out, since the header filter would make relative
+ * redirects absolute.
+ */
+
+static ngx_http_python_header_out_t  ngx_http_python_headers_out[] = {
+
+    { ngx_string("Server"),
+                 offsetof(ngx_http_headers_out_t, server),
+                 ngx_http_python_set_header_out },
+
+    { ngx_string("Date"),
+                 offsetof(ngx_http_headers_out_t, date),
+                 ngx_http_python_set_header_out },
+
+    { ngx_string("Content-Type"), 0,
+                 ngx_http_python_set_content_type },
+
+    { ngx_string("Content-Length"),
+                 offsetof(ngx_http_headers_out_t, content_length),
+                 ngx_http_python_set_content_length },
+
+    { ngx_string("Content-Encoding"),
+                 offsetof(ngx_http_headers_out_t, content_encoding),
+                 ngx_http_python_set_header_out },
+
+    { ngx_string("Last-Modified"),
+                 offsetof(ngx_http_headers_out_t, last_modified),
+                 ngx_http_python_set_last_modified },
+
+    { ngx_string("ETag"),
+                 offsetof(ngx_http_headers_out_t, etag),
+                 ngx_http_python_set_header_out },
+
+    { ngx_string("Expires"),
+                 offsetof(ngx_http_headers_out_t, expires),
+                 ngx_http_python_set_header_out },
+
+    { ngx_null_string, 0, NULL }
+};
+
+
+static ngx_hash_t  ngx_http_python_headers_out_hash;
+
+
 static PyObject *
 ngx_http_python_request_log(ngx_http_python_request_t* self, PyObject* args)
 {
@@ -413,10 +693,11 @@ ngx_http_python_request_send_header(ngx_http_python_request_t* self)
 static PyObject *
 ngx_http_python_request_send(ngx_http_python_request_t* self, PyObject* args)
 {
-    int                  len, flags;
-    char                *data;
+    int                  flags;
+    PyObject            *data;
+    ngx_int_t            rc;
     ngx_buf_t           *b;
-    ngx_chain_t          cl;
+    ngx_chain_t         *cl;
     ngx_http_request_t  *r;
 
     r = self->request;
@@ -429,45 +710,44 @@ ngx_http_python_request_send(ngx_http_python_request_t* self, PyObject* args)
                    "http python send()");
 
     flags = 0;
-    len = 0;
 
-    if (!PyArg_ParseTuple(args, "z#|i:send", &data, &len, &flags)) {
+    if (!PyArg_ParseTuple(args, "O|i:send", &data, &flags)) {
         return NULL;
     }
 
-    if (len) {
-        b = ngx_create_temp_buf(r->pool, len);
-        if (b == NULL) {
-            PyErr_SetNone(ngx_http_python_request_error);
+    rc = NGX_DECLINED;
+
+    if (self->output_buffer) {
+        rc = ngx_http_python_request_append(self, data);
+
+        if (rc == NGX_ERROR) {
             return NULL;
         }
 
-        b->last = ngx_cpymem(b->last, data, len);
+        if (rc == NGX_OK && (flags & 3) == 0) {
+            Py_RETURN_NONE;
+        }
+    }
 
-    } else {
-        b = ngx_calloc_buf(r->pool);
+    cl = NULL;
+
+    if (rc == NGX_DECLINED) {
+        b = ngx_http_python_request_buf(self, data);
         if (b == NULL) {
-            PyErr_SetNone(ngx_http_python_request_error);
             return NULL;
         }
 
-        b->sync = 1;
-    }
-
-    if (flags & 1) {
-        b->last_in_chain = 1;
-        b->last_buf = (r == r->main);
-    }
+        cl = ngx_alloc_chain_link(r->pool);
+        if (cl == NULL) {
+            PyErr_SetNone(ngx_http_python_request_error);
+            return NULL;
+        }
 
-    if (flags & 2) {
-        b->flush = 1;
+        cl->buf = b;
+        cl->next = NULL;
     }
 
-    cl.buf = b;
-    cl.next = NULL;
-
-    if (ngx_http_output_filter(r, &cl) == NGX_ERROR) {
-        PyErr_SetNone(ngx_http_python_request_error);
+    if (ngx_http_python_request_output(self, cl, flags) != NGX_OK) {
         return NULL;
     }
 
@@ -476,10 +756,13 @@ ngx_http_python_request_send(ngx_http_python_request_t* self, PyObject* args)
 
 
 static PyObject *
-ngx_http_python_request_hi(ngx_http_python_request_t *self)
+ngx_http_python_request_sendv(ngx_http_python_request_t* self, PyObject* args)
 {
-    ngx_http_request_t             *r;
-    ngx_http_python_request_hdr_t  *ph;
+    int                  flags;
+    PyObject            *data, *it, *item;
+    ngx_buf_t           *b;
+    ngx_chain_t         *out, *cl, *ln, **ll;
+    ngx_http_request_t  *r;
 
     r = self->request;
     if (r == NULL) {
@@ -487,86 +770,113 @@ ngx_http_python_request_hi(ngx_http_python_request_t *self)
         return NULL;
     }
 
-    ngx_log_debug0(NGX_LOG_DEBUG_HTTP, r->connection->log, 0, "http python hi");
+    ngx_log_debug0(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                   "http python sendv()");
 
-    ph = PyObject_New(ngx_http_python_request_hdr_t,
-                      &ngx_http_python_request_hdr_type);
-    if (ph == NULL) {
+    flags = 0;
+
+    if (!PyArg_ParseTuple(args, "O|i:sendv", &data, &flags)) {
         return NULL;
     }
 
-    ph->pr = self;
-    ph->out = 0;
+    it = PyObject_GetIter(data);
+    if (it == NULL) {
+        return NULL;
+    }
 
-    Py_INCREF(self);
+    /* all pieces are passed to the output filter chain at once */
 
-    return (PyObject *) ph;
-}
+    out = NULL;
+    ll = &out;
 
+    for ( ;; ) {
+        item = PyIter_Next(it);
+        if (item == NULL) {
+            if (PyErr_Occurred()) {
+                goto failed;
+            }
 
-static PyObject *
-ngx_http_python_request_ho(ngx_http_python_request_t *self)
-{
-    ngx_http_request_t             *r;
-    ngx_http_python_request_hdr_t  *ph;
+            break;
+        }
 
-    r = self->request;
-    if (r == NULL) {
-        PyErr_SetString(ngx_http_python_request_error, "request finalized");
-        return NULL;
-    }
+        /* the iterator may run arbitrary code */
 
-    ngx_log_debug0(NGX_LOG_DEBUG_HTTP, r->connection->log, 0, "http python ho");
+        if (self->request == NULL) {
+            PyErr_SetString(ngx_http_python_request_error,
+                            "request finalized");
+            Py_DECREF(item);
+            Py_DECREF(it);
+            return NULL;
+        }
 
-    ph = PyObject_New(ngx_http_python_request_hdr_t,
-                      &ngx_http_python_request_hdr_type);
-    if (ph == NULL) {
-        return NULL;
-    }
+        b = ngx_http_python_request_buf(self, item);
 
-    ph->pr = self;
-    ph->out = 1;
+        Py_DECREF(item);
+
+        if (b == NULL) {
+            goto failed;
+        }
 
-    Py_INCREF(self);
+        cl = ngx_alloc_chain_link(r->pool);
+        if (cl == NULL) {
+            PyErr_SetNone(ngx_http_python_request_error);
+            goto failed;
+        }
 
-    return (PyObject *) ph;
-}
+        cl->buf = b;
+        *ll = cl;
+        ll = &cl->next;
+    }
 
+    Py_DECREF(it);
 
-static PyObject *
-ngx_http_python_request_arg(ngx_http_python_request_t *self)
-{
-    ngx_http_request_t             *r;
-    ngx_http_python_request_arg_t  *pa;
+    *ll = NULL;
 
-    r = self->request;
-    if (r == NULL) {
-        PyErr_SetString(ngx_http_python_request_error, "request finalized");
+    if (ngx_http_python_request_output(self, out, flags) != NGX_OK) {
         return NULL;
     }
 
-    ngx_log_debug0(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
-                   "http python arg");
+    Py_RETURN_NONE;
+
+failed:
 
-    pa = PyObject_New(ngx_http_python_request_arg_t,
-                      &ngx_http_python_request_arg_type);
-    if (pa == NULL) {
+    Py_DECREF(it);
+
+    if (self->request == NULL) {
         return NULL;
     }
 
-    pa->pr = self;
+    /* pieces which were not sent are released on the next send */
+
+    *ll = NULL;
 
-    Py_INCREF(self);
+    for (cl = out; cl; /* void */) {
+        ln = cl;
+        cl = cl->next;
+
+        ln->buf->pos = ln->buf->last;
+        ngx_free_chain(r->pool, ln);
+    }
 
-    return (PyObject *) pa;
+    return NULL;
 }
 
 
 static PyObject *
-ngx_http_python_request_var(ngx_http_python_request_t *self)
+ngx_http_python_request_send_file(ngx_http_python_request_t* self,
+    PyObject* args)
 {
-    ngx_http_request_t             *r;
-    ngx_http_python_request_var_t  *pv;
+    int                        flags;
+    char                      *path;
+    off_t                      start, end;
+    size_t                     len;
+    ngx_buf_t                 *b;
+    ngx_str_t                  name;
+    ngx_chain_t               *cl;
+    PY_LONG_LONG               offset, length;
+    ngx_http_request_t        *r;
+    ngx_open_file_info_t       of;
+    ngx_http_core_loc_conf_t  *clcf;
 
     r = self->request;
     if (r == NULL) {
@@ -575,227 +885,1866 @@ ngx_http_python_request_var(ngx_http_python_request_t *self)
     }
 
     ngx_log_debug0(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
-                   "http python var");
+                   "http python sendFile()");
+
+    offset = 0;
+    length = -1;
+    flags = 0;
+
+    if (!PyArg_ParseTuple(args, "s|LLi:sendFile", &path, &offset, &length,
+                          &flags))
+    {
+        return NULL;
+    }
 
-    pv = PyObject_New(ngx_http_python_request_var_t,
-                      &ngx_http_python_request_var_type);
-    if (pv == NULL) {
+    if (offset < 0) {
+        PyErr_SetString(PyExc_ValueError, "negative offset");
         return NULL;
     }
 
-    pv->pr = self;
+    /* the name is referenced by the file cleanup and the buffer */
 
-    Py_INCREF(self);
+    len = ngx_strlen(path);
 
-    return (PyObject *) pv;
-}
+    name.len = len;
+    name.data = ngx_pnalloc(r->pool, len + 1);
+    if (name.data == NULL) {
+        PyErr_SetNone(ngx_http_python_request_error);
+        return NULL;
+    }
 
+    ngx_memcpy(name.data, path, len + 1);
 
-static PyObject *
-ngx_http_python_request_ctx(ngx_http_python_request_t *self)
-{
-    ngx_http_request_t  *r;
+    clcf = ngx_http_get_module_loc_conf(r, ngx_http_core_module);
 
-    r = self->request;
-    if (r == NULL) {
-        PyErr_SetString(ngx_http_python_request_error, "request finalized");
+    ngx_memzero(&of, sizeof(ngx_open_file_info_t));
+
+    of.read_ahead = clcf->read_ahead;
+    of.directio = clcf->directio;
+    of.valid = clcf->open_file_cache_valid;
+    of.min_uses = clcf->open_file_cache_min_uses;
+    of.errors = clcf->open_file_cache_errors;
+    of.events = clcf->open_file_cache_events;
+
+    if (ngx_http_set_disable_symlinks(r, clcf, &name, &of) != NGX_OK) {
+        PyErr_SetNone(ngx_http_python_request_error);
         return NULL;
     }
 
-    ngx_log_debug0(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
-                   "http python ctx");
+    if (ngx_open_cached_file(clcf->open_file_cache, &name, &of, r->pool)
+        != NGX_OK)
+    {
+        if (of.err == 0) {
+            PyErr_SetNone(ngx_http_python_request_error);
+            return NULL;
+        }
 
-    Py_INCREF(self->ctx);
+        errno = of.err;
+        return PyErr_SetFromErrnoWithFilename(PyExc_IOError, path);
+    }
 
-    return self->ctx;
-}
+    if (!of.is_file) {
+        errno = NGX_EISDIR;
+        return PyErr_SetFromErrnoWithFilename(PyExc_IOError, path);
+    }
 
+    start = ngx_min((off_t) offset, of.size);
+    end = of.size;
 
-static PyObject *
-ngx_http_python_request_get_status(ngx_http_python_request_t *self)
-{
-    ngx_http_request_t  *r;
+    if (length >= 0 && (off_t) length < end - start) {
+        end = start + length;
+    }
 
-    r = self->request;
-    if (r == NULL) {
-        PyErr_SetString(ngx_http_python_request_error, "request finalized");
+    ngx_log_debug3(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                   "http python sendFile \"%V\" %O-%O", &name, start, end);
+
+    b = ngx_calloc_buf(r->pool);
+    if (b == NULL) {
+        PyErr_SetNone(ngx_http_python_request_error);
         return NULL;
     }
 
-    ngx_log_debug0(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
-                   "http python get status");
+    if (start < end) {
+        b->file = ngx_pcalloc(r->pool, sizeof(ngx_file_t));
+        if (b->file == NULL) {
+            PyErr_SetNone(ngx_http_python_request_error);
+            return NULL;
+        }
 
-    return PyLong_FromLong(r->headers_out.status);
-}
+        b->file_pos = start;
+        b->file_last = end;
 
+        b->in_file = 1;
 
-static int
-ngx_http_python_request_set_status(ngx_http_python_request_t *self,
-    PyObject *value)
-{
-    long                 status;
-    ngx_http_request_t  *r;
+        b->file->fd = of.fd;
+        b->file->name = name;
+        b->file->log = r->connection->log;
+        b->file->directio = of.is_directio;
 
-    r = self->request;
-    if (r == NULL) {
-        PyErr_SetString(ngx_http_python_request_error, "request finalized");
-        return -1;
+    } else {
+        b->sync = 1;
     }
 
-    ngx_log_debug0(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
-                   "http python set status");
-
-    status = PyLong_AsLong(value);
-    if (status < 0) {
-        return -1;
+    cl = ngx_alloc_chain_link(r->pool);
+    if (cl == NULL) {
+        PyErr_SetNone(ngx_http_python_request_error);
+        return NULL;
     }
 
-    r->headers_out.status = status;
+    cl->buf = b;
+    cl->next = NULL;
 
-    return 0;
+    if (ngx_http_python_request_output(self, cl, flags) != NGX_OK) {
+        return NULL;
+    }
+
+    Py_RETURN_NONE;
 }
 
 
-static void
-ngx_http_python_request_dealloc(ngx_http_python_request_t *self)
+static ngx_buf_t *
+ngx_http_python_request_buf(ngx_http_python_request_t *self, PyObject *data)
 {
-    Py_DECREF(self->ctx);
+    const char                     *p;
+    Py_ssize_t                      len;
+    ngx_buf_t                      *b;
+    ngx_http_request_t             *r;
+    ngx_http_python_request_pin_t  *pin;
 
-    self->ob_type->tp_free((PyObject*) self);
-}
+    r = self->request;
+    p = NULL;
 
+    ngx_http_python_request_unpin(self, 0);
 
-static PyObject *
-ngx_http_python_request_hdr_subscript(ngx_http_python_request_hdr_t *self,
-    PyObject *key)
+    if (data != Py_None
+        && !PyUnicode_Check(data)
+        && PyObject_CheckBuffer(data))
+    {
+        pin = self->free;
+
+        if (pin) {
+            self->free = pin->next;
+
+        } else {
+            pin = ngx_palloc(r->pool, sizeof(ngx_http_python_request_pin_t));
+            if (pin == NULL) {
+                PyErr_SetNone(ngx_http_python_request_error);
+                return NULL;
+            }
+        }
+
+        if (PyObject_GetBuffer(data, &pin->view, PyBUF_SIMPLE) < 0) {
+            pin->next = self->free;
+            self->free = pin;
+            return NULL;
+        }
+
+        if (pin->view.len) {
+            ngx_log_debug2(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                           "http python send pin:%p len:%z",
+                           pin->view.buf, pin->view.len);
+
+            b = &pin->buf;
+            ngx_memzero(b, sizeof(ngx_buf_t));
+
+            b->start = pin->view.buf;
+            b->pos = b->start;
+            b->last = b->start + pin->view.len;
+            b->end = b->last;
+            b->memory = 1;
+            b->tag = (ngx_buf_tag_t) ngx_http_python_request_buf;
+
+            pin->next = self->pinned;
+            self->pinned = pin;
+
+            return b;
+        }
+
+        PyBuffer_Release(&pin->view);
+
+        pin->next = self->free;
+        self->free = pin;
+
+        len = 0;
+
+    } else if (data == Py_None) {
+        len = 0;
+
+    } else if (PyObject_AsCharBuffer(data, &p, &len) < 0) {
+        return NULL;
+    }
+
+    if (len) {
+        b = ngx_create_temp_buf(r->pool, len);
+        if (b == NULL) {
+            PyErr_SetNone(ngx_http_python_request_error);
+            return NULL;
+        }
+
+        b->last = ngx_cpymem(b->last, p, len);
+
+    } else {
+        b = ngx_calloc_buf(r->pool);
+        if (b == NULL) {
+            PyErr_SetNone(ngx_http_python_request_error);
+            return NULL;
+        }
+
+        b->sync = 1;
+    }
+
+    return b;
+}
+
+
+static ngx_int_t
+ngx_http_python_request_append(ngx_http_python_request_t *self,
+    PyObject *data)
+{
+    const char          *p;
+    Py_ssize_t           len;
+    Py_buffer            view;
+    ngx_int_t            rc;
+    ngx_buf_t           *b;
+    ngx_chain_t         *cl;
+    ngx_http_request_t  *r;
+
+    /*
+     * Small pieces are copied to the output buffer, which is sent when
+     * full, on SEND_FLUSH or SEND_LAST, and when the handler yields or
+     * returns.  Returns NGX_DECLINED for pieces to be sent as is.
+     */
+
+    if (data == Py_None) {
+        return NGX_OK;
+    }
+
+    view.obj = NULL;
+
+    if (!PyUnicode_Check(data) && PyObject_CheckBuffer(data)) {
+        if (PyObject_GetBuffer(data, &view, PyBUF_SIMPLE) < 0) {
+            return NGX_ERROR;
+        }
+
+        p = view.buf;
+        len = view.len;
+
+    } else if (PyObject_AsCharBuffer(data, &p, &len) < 0) {
+        return NGX_ERROR;
+    }
+
+    if ((size_t) len >= self->output_buffer) {
+        rc = NGX_DECLINED;
+        goto done;
+    }
+
+    rc = NGX_OK;
+
+    if (len == 0) {
+        goto done;
+    }
+
+    cl = self->buffered;
+
+    if (cl && (size_t) (cl->buf->end - cl->buf->last) < (size_t) len) {
+        if (ngx_http_python_request_output(self, NULL, 0) != NGX_OK) {
+            rc = NGX_ERROR;
+            goto done;
+        }
+
+        cl = NULL;
+    }
+
+    if (cl == NULL) {
+        r = self->request;
+
+        cl = ngx_chain_get_free_buf(r->pool, &self->free_bufs);
+        if (cl == NULL) {
+            PyErr_SetNone(ngx_http_python_request_error);
+            rc = NGX_ERROR;
+            goto done;
+        }
+
+        b = cl->buf;
+
+        if (b->start == NULL) {
+            b->start = ngx_palloc(r->pool, self->output_buffer);
+            if (b->start == NULL) {
+                PyErr_SetNone(ngx_http_python_request_error);
+                rc = NGX_ERROR;
+                goto done;
+            }
+
+            b->pos = b->start;
+            b->last = b->start;
+            b->end = b->start + self->output_buffer;
+            b->temporary = 1;
+            b->tag = (ngx_buf_tag_t) ngx_http_python_request_output;
+
+        } else {
+
+            /* a reused buffer may have been sent with SEND_FLUSH */
+
+            b->flush = 0;
+        }
+
+        self->buffered = cl;
+    }
+
+    cl->buf->last = ngx_cpymem(cl->buf->last, p, len);
+
+done:
+
+    PyBuffer_Release(&view);
+
+    return rc;
+}
+
+
+static ngx_int_t
+ngx_http_python_request_output(ngx_http_python_request_t *self,
+    ngx_chain_t *in, int flags)
+{
+    ngx_int_t            rc;
+    ngx_buf_t           *b;
+    ngx_chain_t         *out, *cl;
+    ngx_http_request_t  *r;
+
+    r = self->request;
+
+    /* the output buffer goes before the pieces passed */
+
+    out = in;
+
+    if (self->buffered) {
+        out = self->buffered;
+        out->next = in;
+
+        self->buffered = NULL;
+    }
+
+    if (out == NULL) {
+        if ((flags & 3) == 0) {
+            return NGX_OK;
+        }
+
+        b = ngx_calloc_buf(r->pool);
+        if (b == NULL) {
+            PyErr_SetNone(ngx_http_python_request_error);
+            return NGX_ERROR;
+        }
+
+        b->sync = 1;
+
+        out = ngx_alloc_chain_link(r->pool);
+        if (out == NULL) {
+            PyErr_SetNone(ngx_http_python_request_error);
+            return NGX_ERROR;
+        }
+
+        out->buf = b;
+        out->next = NULL;
+    }
+
+    for (cl = out; cl->next; cl = cl->next) { /* void */ }
+
+    b = cl->buf;
+
+    if (flags & 1) {
+        b->last_in_chain = 1;
+        b->last_buf = (r == r->main);
+    }
+
+    if (flags & 2) {
+        b->flush = 1;
+    }
+
+    rc = ngx_http_output_filter(r, out);
+
+    ngx_chain_update_chains(r->pool, &self->free_bufs, &self->busy_bufs, &out,
+                            (ngx_buf_tag_t) ngx_http_python_request_output);
+
+    if (rc == NGX_ERROR) {
+        PyErr_SetNone(ngx_http_python_request_error);
+        return NGX_ERROR;
+    }
+
+    if (rc == NGX_AGAIN) {
+        return ngx_http_python_request_drain(self);
+    }
+
+    return NGX_OK;
+}
+
+
+void
+ngx_http_python_request_flush(PyObject *request)
+{
+    ngx_http_python_request_t  *pr = (ngx_http_python_request_t *) request;
+
+    if (pr->request == NULL || pr->buffered == NULL) {
+        return;
+    }
+
+    ngx_log_debug0(NGX_LOG_DEBUG_HTTP, pr->request->connection->log, 0,
+                   "http python flush output buffer");
+
+    if (ngx_http_python_request_output(pr, NULL, 0) != NGX_OK) {
+
+        /* the connection error is handled by nginx */
+
+        PyErr_Clear();
+    }
+}
+
+
+static ngx_int_t
+ngx_http_python_request_drain(ngx_http_python_request_t *self)
+{
+#if !(NGX_PYTHON_SYNC)
+    off_t                      size;
+    ngx_chain_t               *cl;
+    ngx_event_t               *wev;
+    ngx_connection_t          *c;
+    ngx_http_request_t        *r;
+    ngx_http_core_loc_conf_t  *clcf;
+
+    /*
+     * Output not sent to a slow client is accumulated in memory.  Once it
+     * exceeds python_send_buffer, the handler waits until the client reads
+     * enough of it.  The request write event resumes the handler
+     * coroutine, so spawned tasks do not wait.
+     */
+
+    if (self->send_buffer == 0 || ngx_python_get_ctx() != self->python) {
+        return NGX_OK;
+    }
+
+    r = self->request;
+    c = r->connection;
+    wev = c->write;
+
+    for ( ;; ) {
+        size = 0;
+
+        for (cl = r->out; cl; cl = cl->next) {
+            size += ngx_buf_size(cl->buf);
+        }
+
+        if (size <= (off_t) self->send_buffer) {
+            if (wev->timer_set && !wev->delayed) {
+                ngx_del_timer(wev);
+            }
+
+            return NGX_OK;
+        }
+
+        ngx_log_debug1(NGX_LOG_DEBUG_HTTP, c->log, 0,
+                       "http python send wait unsent:%O", size);
+
+        clcf = ngx_http_get_module_loc_conf(r, ngx_http_core_module);
+
+        if (!wev->delayed) {
+            ngx_add_timer(wev, clcf->send_timeout);
+        }
+
+        if (ngx_handle_write_event(wev, clcf->send_lowat) != NGX_OK) {
+            PyErr_SetNone(ngx_http_python_request_error);
+            return NGX_ERROR;
+        }
+
+        if (ngx_python_yield() != NGX_OK) {
+            return NGX_ERROR;
+        }
+
+        if (self->request == NULL) {
+            PyErr_SetString(ngx_http_python_request_error,
+                            "request finalized");
+            return NGX_ERROR;
+        }
+
+        if (wev->timedout) {
+            c->timedout = 1;
+            PyErr_SetString(ngx_http_python_request_error,
+                            "client timed out");
+            return NGX_ERROR;
+        }
+
+        if (!wev->delayed
+            && ngx_http_output_filter(r, NULL) == NGX_ERROR)
+        {
+            PyErr_SetNone(ngx_http_python_request_error);
+            return NGX_ERROR;
+        }
+    }
+
+#else
+
+    return NGX_OK;
+
+#endif
+}
+
+
+static void
+ngx_http_python_request_unpin(ngx_http_python_request_t *self, ngx_uint_t all)
+{
+    ngx_http_python_request_pin_t  *pin, **pp;
+
+    pp = &self->pinned;
+
+    while (*pp) {
+        pin = *pp;
+
+        if (!all && ngx_buf_size(&pin->buf)) {
+            pp = &pin->next;
+            continue;
+        }
+
+        *pp = pin->next;
+
+        PyBuffer_Release(&pin->view);
+
+        pin->next = self->free;
+        self->free = pin;
+    }
+}
+
+
+static PyObject *
+ngx_http_python_request_read(ngx_http_python_request_t* self, PyObject* args)
+{
+    ssize_t              n;
+    PyObject            *data;
+    Py_ssize_t           size;
+    ngx_http_request_t  *r;
+
+    r = self->request;
+    if (r == NULL) {
+        PyErr_SetString(ngx_http_python_request_error, "request finalized");
+        return NULL;
+    }
+
+    ngx_log_debug0(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                   "http python read()");
+
+    size = -1;
+
+    if (!PyArg_ParseTuple(args, "|n:read", &size)) {
+        return NULL;
+    }
+
+    n = ngx_http_python_request_wait_body(self);
+    if (n == NGX_ERROR) {
+        return NULL;
+    }
+
+    if (size < 0 || size > n) {
+        size = n;
+    }
+
+    data = PyString_FromStringAndSize(NULL, size);
+    if (data == NULL) {
+        return NULL;
+    }
+
+    if (ngx_http_python_request_copy_body(self->request,
+                                          (u_char *) PyString_AS_STRING(data),
+                                          size)
+        != NGX_OK)
+    {
+        Py_DECREF(data);
+        return NULL;
+    }
+
+    return data;
+}
+
+
+static PyObject *
+ngx_http_python_request_readinto(ngx_http_python_request_t* self,
+    PyObject* args)
+{
+    ssize_t              n;
+    Py_buffer            buf;
+    ngx_http_request_t  *r;
+
+    r = self->request;
+    if (r == NULL) {
+        PyErr_SetString(ngx_http_python_request_error, "request finalized");
+        return NULL;
+    }
+
+    ngx_log_debug0(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                   "http python readinto()");
+
+    if (!PyArg_ParseTuple(args, "w*:readinto", &buf)) {
+        return NULL;
+    }
+
+    n = ngx_http_python_request_wait_body(self);
+
+    if (n > buf.len) {
+        n = buf.len;
+    }
+
+    if (n != NGX_ERROR
+        && ngx_http_python_request_copy_body(self->request, buf.buf, n)
+           != NGX_OK)
+    {
+        n = NGX_ERROR;
+    }
+
+    PyBuffer_Release(&buf);
+
+    if (n == NGX_ERROR) {
+        return NULL;
+    }
+
+    return PyInt_FromSsize_t(n);
+}
+
+
+static ssize_t
+ngx_http_python_request_wait_body(ngx_http_python_request_t *self)
+{
+    off_t                     size;
+    ngx_int_t                 rc;
+    ngx_uint_t                wait;
+    ngx_chain_t              *cl;
+    ngx_http_request_t       *r;
+    ngx_http_request_body_t  *rb;
+
+    /*
+     * Waits until some request body data is available.  Returns its size,
+     * which is 0 if the whole body has been read.  In unbuffered mode,
+     * nginx only reads body data from the client when previously read
+     * data is consumed.
+     */
+
+    wait = 0;
+
+    for ( ;; ) {
+        r = self->request;
+        if (r == NULL) {
+            PyErr_SetString(ngx_http_python_request_error,
+                            "request finalized");
+            return NGX_ERROR;
+        }
+
+        rb = r->request_body;
+        if (rb == NULL) {
+            PyErr_SetString(ngx_http_python_request_error,
+                            "request body is not available");
+            return NGX_ERROR;
+        }
+
+        size = 0;
+
+        for (cl = rb->bufs; cl; cl = cl->next) {
+            size += ngx_buf_size(cl->buf);
+        }
+
+        if (size || !r->reading_body) {
+            return (ssize_t) size;
+        }
+
+        if (wait) {
+#if (NGX_PYTHON_SYNC)
+            PyErr_SetString(ngx_http_python_request_error,
+                            "blocking calls are not allowed");
+            return NGX_ERROR;
+#else
+            ngx_log_debug0(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                           "http python read wait");
+
+            self->reader = ngx_python_get_ctx();
+
+            rc = ngx_python_yield();
+
+            self->reader = NULL;
+
+            if (rc != NGX_OK) {
+                return NGX_ERROR;
+            }
+
+            wait = 0;
+            continue;
+#endif
+        }
+
+        rc = ngx_http_read_unbuffered_request_body(r);
+
+        ngx_log_debug1(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                       "http python read body rc:%i", rc);
+
+        if (rc >= NGX_HTTP_SPECIAL_RESPONSE) {
+            PyErr_Format(ngx_http_python_request_error,
+                         "request body read failed with status %d", (int) rc);
+            return NGX_ERROR;
+        }
+
+        wait = 1;
+    }
+}
+
+
+static ngx_int_t
+ngx_http_python_request_copy_body(ngx_http_request_t *r, u_char *p,
+    size_t size)
+{
+    size_t                    n;
+    ssize_t                   rc;
+    ngx_buf_t                *b;
+    ngx_http_request_body_t  *rb;
+
+    /* consumed buffers are removed from the body chain */
+
+    rb = r->request_body;
+
+    while (rb->bufs) {
+        b = rb->bufs->buf;
+
+        if (size && ngx_buf_in_memory(b)) {
+            n = ngx_min(size, (size_t) (b->last - b->pos));
+
+            p = ngx_cpymem(p, b->pos, n);
+            b->pos += n;
+            size -= n;
+
+            if (b->in_file) {
+                b->file_pos += n;
+            }
+
+        } else if (size && b->in_file) {
+            n = (size_t) ngx_min((off_t) size, b->file_last - b->file_pos);
+
+            rc = ngx_read_file(b->file, p, n, b->file_pos);
+
+            if (rc != (ssize_t) n) {
+                PyErr_SetString(ngx_http_python_request_error,
+                                "request body file read failed");
+                return NGX_ERROR;
+            }
+
+            p += n;
+            b->file_pos += n;
+            size -= n;
+        }
+
+        if (ngx_buf_size(b)) {
+            break;
+        }
+
+        rb->bufs = rb->bufs->next;
+    }
+
+    return NGX_OK;
+}
+
+
+ngx_int_t
+ngx_http_python_request_wakeup(PyObject *request)
+{
+#if !(NGX_PYTHON_SYNC)
+    ngx_http_python_request_t  *pr = (ngx_http_python_request_t *) request;
+
+    if (pr->reader) {
+        ngx_python_wakeup(pr->reader);
+        return NGX_OK;
+    }
+#endif
+
+    return NGX_DECLINED;
+}
+
+
+static PyObject *
+ngx_http_python_request_hi(ngx_http_python_request_t *self)
+{
+    ngx_http_request_t             *r;
+    ngx_http_python_request_hdr_t  *ph;
+
+    r = self->request;
+    if (r == NULL) {
+        PyErr_SetString(ngx_http_python_request_error, "request finalized");
+        return NULL;
+    }
+
+    ngx_log_debug0(NGX_LOG_DEBUG_HTTP, r->connection->log, 0, "http python hi");
+
+    if (self->hi == NULL) {
+        ph = PyObject_New(ngx_http_python_request_hdr_t,
+                          &ngx_http_python_request_hdr_type);
+        if (ph == NULL) {
+            return NULL;
+        }
+
+        ph->pr = self;
+        ph->out = 0;
+
+        Py_INCREF(self);
+
+        self->hi = (PyObject *) ph;
+    }
+
+    Py_INCREF(self->hi);
+
+    return self->hi;
+}
+
+
+static PyObject *
+ngx_http_python_request_ho(ngx_http_python_request_t *self)
+{
+    ngx_http_request_t             *r;
+    ngx_http_python_request_hdr_t  *ph;
+
+    r = self->request;
+    if (r == NULL) {
+        PyErr_SetString(ngx_http_python_request_error, "request finalized");
+        return NULL;
+    }
+
+    ngx_log_debug0(NGX_LOG_DEBUG_HTTP, r->connection->log, 0, "http python ho");
+
+    if (self->ho == NULL) {
+        ph = PyObject_New(ngx_http_python_request_hdr_t,
+                          &ngx_http_python_request_hdr_type);
+        if (ph == NULL) {
+            return NULL;
+        }
+
+        ph->pr = self;
+        ph->out = 1;
+
+        Py_INCREF(self);
+
+        self->ho = (PyObject *) ph;
+    }
+
+    Py_INCREF(self->ho);
+
+    return self->ho;
+}
+
+
+static PyObject *
+ngx_http_python_request_arg(ngx_http_python_request_t *self)
+{
+    ngx_http_request_t             *r;
+    ngx_http_python_request_arg_t  *pa;
+
+    r = self->request;
+    if (r == NULL) {
+        PyErr_SetString(ngx_http_python_request_error, "request finalized");
+        return NULL;
+    }
+
+    ngx_log_debug0(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                   "http python arg");
+
+    if (self->arg == NULL) {
+        pa = PyObject_New(ngx_http_python_request_arg_t,
+                          &ngx_http_python_request_arg_type);
+        if (pa == NULL) {
+            return NULL;
+        }
+
+        pa->pr = self;
+
+        Py_INCREF(self);
+
+        self->arg = (PyObject *) pa;
+    }
+
+    Py_INCREF(self->arg);
+
+    return self->arg;
+}
+
+
+static PyObject *
+ngx_http_python_request_var(ngx_http_python_request_t *self)
+{
+    ngx_http_request_t             *r;
+    ngx_http_python_request_var_t  *pv;
+
+    r = self->request;
+    if (r == NULL) {
+        PyErr_SetString(ngx_http_python_request_error, "request finalized");
+        return NULL;
+    }
+
+    ngx_log_debug0(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                   "http python var");
+
+    if (self->var == NULL) {
+        pv = PyObject_New(ngx_http_python_request_var_t,
+                          &ngx_http_python_request_var_type);
+        if (pv == NULL) {
+            return NULL;
+        }
+
+        pv->pr = self;
+
+        Py_INCREF(self);
+
+        self->var = (PyObject *) pv;
+    }
+
+    Py_INCREF(self->var);
+
+    return self->var;
+}
+
+
+static PyObject *
+ngx_http_python_request_ctx(ngx_http_python_request_t *self)
+{
+    ngx_http_request_t  *r;
+
+    r = self->request;
+    if (r == NULL) {
+        PyErr_SetString(ngx_http_python_request_error, "request finalized");
+        return NULL;
+    }
+
+    ngx_log_debug0(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                   "http python ctx");
+
+    Py_INCREF(self->ctx);
+
+    return self->ctx;
+}
+
+
+static PyObject *
+ngx_http_python_request_get_status(ngx_http_python_request_t *self)
+{
+    ngx_http_request_t  *r;
+
+    r = self->request;
+    if (r == NULL) {
+        PyErr_SetString(ngx_http_python_request_error, "request finalized");
+        return NULL;
+    }
+
+    ngx_log_debug0(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                   "http python get status");
+
+    return PyLong_FromLong(r->headers_out.status);
+}
+
+
+static int
+ngx_http_python_request_set_status(ngx_http_python_request_t *self,
+    PyObject *value)
+{
+    long                 status;
+    ngx_http_request_t  *r;
+
+    r = self->request;
+    if (r == NULL) {
+        PyErr_SetString(ngx_http_python_request_error, "request finalized");
+        return -1;
+    }
+
+    ngx_log_debug0(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                   "http python set status");
+
+    status = PyLong_AsLong(value);
+    if (status < 0) {
+        return -1;
+    }
+
+    r->headers_out.status = status;
+
+    return 0;
+}
+
+
+static PyObject *
+ngx_http_python_request_body(ngx_http_python_request_t *self)
+{
+    u_char                          *p, *last;
+    size_t                           len;
+    ngx_buf_t                       *b;
+    ngx_chain_t                     *cl;
+    ngx_http_request_t              *r;
+    ngx_http_python_request_body_t  *pb;
+
+    r = self->request;
+    if (r == NULL) {
+        PyErr_SetString(ngx_http_python_request_error, "request finalized");
+        return NULL;
+    }
+
+    ngx_log_debug0(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                   "http python body");
+
+    if (r->request_body == NULL || r->request_body->temp_file) {
+        Py_RETURN_NONE;
+    }
+
+    /*
+     * The body object references the request body buffer directly.  A body
+     * split over several buffers is joined once in the request pool.
+     */
+
+    if (self->body == NULL) {
+        len = 0;
+
+        for (cl = r->request_body->bufs; cl; cl = cl->next) {
+            b = cl->buf;
+
+            if (b->in_file) {
+                Py_RETURN_NONE;
+            }
+
+            len += b->last - b->pos;
+        }
+
+        cl = r->request_body->bufs;
+
+        if (cl == NULL || len == 0) {
+            p = (u_char *) "";
+
+        } else if (cl->next == NULL) {
+            p = cl->buf->pos;
+
+        } else {
+            ngx_log_debug1(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                           "http python body join len:%uz", len);
+
+            p = ngx_pnalloc(r->pool, len);
+            if (p == NULL) {
+                PyErr_SetNone(ngx_http_python_request_error);
+                return NULL;
+            }
+
+            last = p;
+
+            for ( /* void */ ; cl; cl = cl->next) {
+                last = ngx_cpymem(last, cl->buf->pos,
+                                  cl->buf->last - cl->buf->pos);
+            }
+        }
+
+        pb = PyObject_New(ngx_http_python_request_body_t,
+                          &ngx_http_python_request_body_type);
+        if (pb == NULL) {
+            return NULL;
+        }
+
+        pb->data = p;
+        pb->len = len;
+        pb->exports = 0;
+        pb->copied = 0;
+
+        self->body = (PyObject *) pb;
+    }
+
+    Py_INCREF(self->body);
+
+    return self->body;
+}
+
+
+static PyObject *
+ngx_http_python_request_body_file(ngx_http_python_request_t *self)
+{
+    ngx_temp_file_t     *tf;
+    ngx_http_request_t  *r;
+
+    r = self->request;
+    if (r == NULL) {
+        PyErr_SetString(ngx_http_python_request_error, "request finalized");
+        return NULL;
+    }
+
+    ngx_log_debug0(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                   "http python body file");
+
+    if (r->request_body == NULL || r->request_body->temp_file == NULL) {
+        Py_RETURN_NONE;
+    }
+
+    tf = r->request_body->temp_file;
+
+    return PyString_FromStringAndSize((char *) tf->file.name.data,
+                                      tf->file.name.len);
+}
+
+
+static void
+ngx_http_python_request_dealloc(ngx_http_python_request_t *self)
+{
+    Py_DECREF(self->ctx);
+    Py_XDECREF(self->body);
+
+    self->ob_type->tp_free((PyObject*) self);
+}
+
+
+static Py_ssize_t
+ngx_http_python_request_body_length(ngx_http_python_request_body_t *self)
+{
+    return self->len;
+}
+
+
+static PyObject *
+ngx_http_python_request_body_str(ngx_http_python_request_body_t *self)
+{
+    if (self->data == NULL) {
+        PyErr_SetString(ngx_http_python_request_error, "request finalized");
+        return NULL;
+    }
+
+    return PyString_FromStringAndSize((char *) self->data, self->len);
+}
+
+
+static Py_ssize_t
+ngx_http_python_request_body_getreadbuffer(
+    ngx_http_python_request_body_t *self, Py_ssize_t segment, void **ptr)
+{
+    /* old style buffers ask for the pointer on every access */
+
+    if (self->data == NULL) {
+        PyErr_SetString(ngx_http_python_request_error, "request finalized");
+        return -1;
+    }
+
+    if (segment != 0) {
+        PyErr_SetString(PyExc_SystemError,
+                        "accessing non-existent body segment");
+        return -1;
+    }
+
+    *ptr = self->data;
+
+    return self->len;
+}
+
+
+static Py_ssize_t
+ngx_http_python_request_body_getsegcount(ngx_http_python_request_body_t *self,
+    Py_ssize_t *lenp)
+{
+    if (lenp) {
+        *lenp = self->len;
+    }
+
+    return 1;
+}
+
+
+static int
+ngx_http_python_request_body_getbuffer(ngx_http_python_request_body_t *self,
+    Py_buffer *view, int flags)
+{
+    if (self->data == NULL) {
+        PyErr_SetString(ngx_http_python_request_error, "request finalized");
+        return -1;
+    }
+
+    if (PyBuffer_FillInfo(view, (PyObject *) self, self->data, self->len,
+                          1, flags)
+        < 0)
+    {
+        return -1;
+    }
+
+    self->exports++;
+
+    return 0;
+}
+
+
+static void
+ngx_http_python_request_body_releasebuffer(
+    ngx_http_python_request_body_t *self, Py_buffer *view)
+{
+    self->exports--;
+}
+
+
+static void
+ngx_http_python_request_body_detach(ngx_http_python_request_body_t *self,
+    ngx_log_t *log)
+{
+    u_char  *p;
+
+    if (self->exports == 0) {
+        self->data = NULL;
+        return;
+    }
+
+    if (self->len == 0) {
+        return;
+    }
+
+    ngx_log_debug2(NGX_LOG_DEBUG_HTTP, log, 0,
+                   "http python body copy len:%uz, exports:%ui",
+                   self->len, self->exports);
+
+    p = PyMem_Malloc(self->len);
+    if (p == NULL) {
+        ngx_log_error(NGX_LOG_ALERT, log, 0,
+                      "could not copy request body referenced by %ui buffer(s)",
+                      self->exports);
+        self->data = NULL;
+        return;
+    }
+
+    ngx_memcpy(p, self->data, self->len);
+
+    self->data = p;
+    self->copied = 1;
+}
+
+
+static void
+ngx_http_python_request_body_dealloc(ngx_http_python_request_body_t *self)
+{
+    if (self->copied) {
+        PyMem_Free(self->data);
+    }
+
+    self->ob_type->tp_free((PyObject*) self);
+}
+
+
+static PyObject *
+ngx_http_python_request_hdr_subscript(ngx_http_python_request_hdr_t *self,
+    PyObject *key)
+{
+    char                          *data;
+    Py_ssize_t                     len;
+    ngx_table_elt_t               *h;
+    ngx_http_request_t            *r;
+    ngx_http_python_header_out_t  *hh;
+
+    r = self->pr->request;
+    if (r == NULL) {
+        PyErr_SetString(ngx_http_python_request_error, "request finalized");
+        return NULL;
+    }
+
+    ngx_log_debug0(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                   "http python hdr subscript()");
+
+    if (PyString_AsStringAndSize(key, &data, &len) < 0 ) {
+        return NULL;
+    }
+
+    if (self->out) {
+        hh = ngx_http_python_find_header_out((u_char *) data, len);
+
+        if (hh && hh->handler == ngx_http_python_set_content_type) {
+            return PyString_FromStringAndSize(
+                                 (char *) r->headers_out.content_type.data,
+                                 r->headers_out.content_type.len);
+        }
+
+        h = ngx_http_python_find_header(&r->headers_out.headers,
+                                        (u_char *) data, len);
+
+    } else {
+        h = ngx_http_python_find_header_in(r, (u_char *) data, len);
+    }
+
+    if (h == NULL || h->hash == 0) {
+        return PyString_FromStringAndSize(NULL, 0);
+    }
+
+    return PyString_FromStringAndSize((char *) h->value.data, h->value.len);
+}
+
+
+static int
+ngx_http_python_request_hdr_ass_subscript(ngx_http_python_request_hdr_t *self,
+    PyObject *key, PyObject *value)
+{
+    char                          *data, *vdata;
+    PyObject                      *vs;
+    ngx_int_t                      rc;
+    ngx_str_t                      name, v;
+    Py_ssize_t                     len, vlen;
+    ngx_http_request_t            *r;
+    ngx_http_python_header_out_t  *hh;
+
+    r = self->pr->request;
+    if (r == NULL) {
+        PyErr_SetString(ngx_http_python_request_error, "request finalized");
+        return -1;
+    }
+
+    if (!self->out) {
+        PyErr_SetString(ngx_http_python_request_error, "read-only header");
+        return -1;
+    }
+
+    ngx_log_debug0(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                   "http python hdr ass_subscript()");
+
+    if (PyString_AsStringAndSize(key, &data, &len) < 0) {
+        return -1;
+    }
+
+    vs = NULL;
+    vdata = NULL;
+    vlen = 0;
+
+    if (value) {
+        vs = PyObject_Str(value);
+        if (vs == NULL) {
+            return -1;
+        }
+
+        if (PyString_AsStringAndSize(vs, &vdata, &vlen) < 0) {
+            Py_DECREF(vs);
+            return -1;
+        }
+    }
+
+    v.data = (u_char *) vdata;
+    v.len = vlen;
+
+    hh = ngx_http_python_find_header_out((u_char *) data, len);
+
+    if (hh) {
+        rc = hh->handler(r, hh, &v);
+
+    } else {
+        name.data = (u_char *) data;
+        name.len = len;
+
+        rc = ngx_http_python_set_header(r, &name, &v, NULL);
+    }
+
+    Py_XDECREF(vs);
+
+    return rc == NGX_OK ? 0 : -1;
+}
+
+
+static Py_ssize_t
+ngx_http_python_request_hdr_length(ngx_http_python_request_hdr_t *self)
 {
-    char                *data;
-    Py_ssize_t           len;
-    ngx_list_t          *headers;
+    ngx_uint_t           i, n;
+    ngx_list_part_t     *part;
     ngx_table_elt_t     *h;
     ngx_http_request_t  *r;
 
     r = self->pr->request;
     if (r == NULL) {
         PyErr_SetString(ngx_http_python_request_error, "request finalized");
-        return NULL;
+        return -1;
     }
 
-    ngx_log_debug0(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
-                   "http python hdr subscript()");
+    part = self->out ? &r->headers_out.headers.part
+                     : &r->headers_in.headers.part;
 
-    if (PyString_AsStringAndSize(key, &data, &len) < 0 ) {
-        return NULL;
+    n = (self->out && r->headers_out.content_type.len) ? 1 : 0;
+
+    for ( /* void */ ; part; part = part->next) {
+        h = part->elts;
+
+        for (i = 0; i < part->nelts; i++) {
+            if (h[i].hash) {
+                n++;
+            }
+        }
     }
 
-    headers = self->out ? &r->headers_out.headers : &r->headers_in.headers;
+    return n;
+}
 
-    h = ngx_http_python_find_header(headers, (u_char *) data, len);
 
-    if (h == NULL || h->hash == 0) {
-        return PyString_FromStringAndSize(NULL, 0);
+static PyObject *
+ngx_http_python_request_hdr_keys(ngx_http_python_request_hdr_t *self)
+{
+    return ngx_http_python_request_hdr_list(self, 0, NULL, 0);
+}
+
+
+static PyObject *
+ngx_http_python_request_hdr_items(ngx_http_python_request_hdr_t *self)
+{
+    return ngx_http_python_request_hdr_list(self, 1, NULL, 0);
+}
+
+
+static PyObject *
+ngx_http_python_request_hdr_get_all(ngx_http_python_request_hdr_t *self,
+    PyObject *args)
+{
+    char  *data;
+    int    len;
+
+    if (!PyArg_ParseTuple(args, "s#:get_all", &data, &len)) {
+        return NULL;
     }
 
-    return PyString_FromStringAndSize((char *) h->value.data, h->value.len);
+    return ngx_http_python_request_hdr_list(self, 2, (u_char *) data, len);
 }
 
 
-static int
-ngx_http_python_request_hdr_ass_subscript(ngx_http_python_request_hdr_t *self,
-    PyObject *key, PyObject *value)
+static PyObject *
+ngx_http_python_request_hdr_list(ngx_http_python_request_hdr_t *self,
+    ngx_uint_t type, u_char *data, size_t len)
 {
-    char                *data, *vdata;
-    u_char              *p;
-    PyObject            *vs;
-    Py_ssize_t           len, vlen;
-    ngx_list_t          *headers;
-    ngx_table_elt_t     *h;
+    u_char               lowcase[NGX_HTTP_LC_HEADER_LEN];
+    PyObject            *list;
+    ngx_uint_t           i, hash, hashed;
+    ngx_list_part_t     *part;
+    ngx_table_elt_t     *h, ct;
     ngx_http_request_t  *r;
 
+    /* type: 0 - names, 1 - (name, value) pairs, 2 - values of the name */
+
     r = self->pr->request;
     if (r == NULL) {
         PyErr_SetString(ngx_http_python_request_error, "request finalized");
-        return -1;
+        return NULL;
     }
 
-    if (!self->out) {
-        PyErr_SetString(ngx_http_python_request_error, "read-only header");
-        return -1;
-    }
+    ngx_log_debug1(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                   "http python hdr list %ui", type);
 
-    ngx_log_debug0(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
-                   "http python hdr ass_subscript()");
+    hash = 0;
+    hashed = 0;
 
-    vs = NULL;
+    if (type == 2 && !self->out) {
+        hashed = (ngx_http_python_header_hash(data, len, lowcase, &hash)
+                  == NGX_OK);
+    }
 
-    if (PyString_AsStringAndSize(key, &data, &len) < 0) {
-        goto failed;
+    list = PyList_New(0);
+    if (list == NULL) {
+        return NULL;
     }
 
-    vlen = 0;
+    /* the content type is not kept in the output headers list */
 
-    if (value) {
-        vs = PyObject_Str(value);
-        if (vs == NULL) {
-            goto failed;
+    if (self->out && r->headers_out.content_type.len) {
+        ngx_str_set(&ct.key, "Content-Type");
+        ct.value = r->headers_out.content_type;
+
+        if ((type != 2
+             || (len == ct.key.len
+                 && ngx_strncasecmp(ct.key.data, data, len) == 0))
+            && ngx_http_python_request_hdr_append(list, type, &ct) < 0)
+        {
+            Py_DECREF(list);
+            return NULL;
         }
+    }
 
-        if (PyString_AsStringAndSize(vs, &vdata, &vlen) < 0) {
-            goto failed;
+    part = self->out ? &r->headers_out.headers.part
+                     : &r->headers_in.headers.part;
+
+    for ( /* void */ ; part; part = part->next) {
+        h = part->elts;
+
+        for (i = 0; i < part->nelts; i++) {
+            if (h[i].hash == 0) {
+                continue;
+            }
+
+            if (type == 2
+                && ((hashed && h[i].hash != hash)
+                    || h[i].key.len != len
+                    || ngx_strncasecmp(h[i].key.data, data, len) != 0))
+            {
+                continue;
+            }
+
+            if (ngx_http_python_request_hdr_append(list, type, &h[i]) < 0) {
+                Py_DECREF(list);
+                return NULL;
+            }
         }
     }
 
-    headers = &r->headers_out.headers;
+    return list;
+}
+
+
+static int
+ngx_http_python_request_hdr_append(PyObject *list, ngx_uint_t type,
+    ngx_table_elt_t *h)
+{
+    int        rc;
+    PyObject  *item;
+
+    switch (type) {
+
+    case 0:
+        item = PyString_FromStringAndSize((char *) h->key.data, h->key.len);
+        break;
+
+    case 1:
+        item = Py_BuildValue("(s#s#)", h->key.data, (int) h->key.len,
+                             h->value.data, (int) h->value.len);
+        break;
+
+    default: /* 2 */
+        item = PyString_FromStringAndSize((char *) h->value.data,
+                                          h->value.len);
+    }
+
+    if (item == NULL) {
+        return -1;
+    }
+
+    rc = PyList_Append(list, item);
+
+    Py_DECREF(item);
+
+    return rc;
+}
+
+
+static ngx_http_python_header_out_t *
+ngx_http_python_find_header_out(u_char *data, size_t len)
+{
+    u_char      lowcase[NGX_HTTP_LC_HEADER_LEN];
+    ngx_uint_t  key;
+
+    if (len > NGX_HTTP_LC_HEADER_LEN) {
+        return NULL;
+    }
+
+    key = ngx_hash_strlow(lowcase, data, len);
+
+    return ngx_hash_find(&ngx_http_python_headers_out_hash, key, lowcase, len);
+}
+
+
+static ngx_int_t
+ngx_http_python_set_header(ngx_http_request_t *r, ngx_str_t *key,
+    ngx_str_t *value, ngx_table_elt_t **ph)
+{
+    u_char           *p;
+    ngx_table_elt_t  *h;
+
+    /* an empty value removes the header, *ph is set to NULL then */
 
-    h = ngx_http_python_find_header(headers, (u_char *) data, len);
+    h = ngx_http_python_find_header(&r->headers_out.headers, key->data,
+                                    key->len);
 
-    if (vlen == 0) {
+    if (value->len == 0) {
         if (h) {
             h->hash = 0;
         }
 
-        goto done;
+        if (ph) {
+            *ph = NULL;
+        }
+
+        return NGX_OK;
     }
 
     if (h == NULL) {
-        h = ngx_list_push(headers);
+        h = ngx_list_push(&r->headers_out.headers);
         if (h == NULL) {
-            PyErr_SetNone(ngx_http_python_request_error);
             goto failed;
         }
 
-        h->hash = 1;
-
-        p = ngx_pnalloc(r->pool, len);
+        p = ngx_pnalloc(r->pool, key->len);
         if (p == NULL) {
-            PyErr_SetNone(ngx_http_python_request_error);
             goto failed;
         }
 
-        ngx_memcpy(p, data, len);
+        ngx_memcpy(p, key->data, key->len);
         h->key.data = p;
-        h->key.len = len;
+        h->key.len = key->len;
+
+#if (nginx_version >= 1023000)
+        h->next = NULL;
+#endif
     }
 
-    p = ngx_pnalloc(r->pool, vlen);
+    p = ngx_pnalloc(r->pool, value->len);
     if (p == NULL) {
-        PyErr_SetNone(ngx_http_python_request_error);
         goto failed;
     }
 
-    ngx_memcpy(p, vdata, vlen);
+    ngx_memcpy(p, value->data, value->len);
     h->value.data = p;
-    h->value.len = vlen;
+    h->value.len = value->len;
+    h->hash = 1;
 
-done:
+    if (ph) {
+        *ph = h;
+    }
 
-    Py_XDECREF(vs);
-    return 0;
+    return NGX_OK;
 
 failed:
 
-    Py_XDECREF(vs);
-    return -1;
+    PyErr_SetNone(ngx_http_python_request_error);
+    return NGX_ERROR;
+}
+
+
+static ngx_int_t
+ngx_http_python_set_header_out(ngx_http_request_t *r,
+    ngx_http_python_header_out_t *hh, ngx_str_t *value)
+{
+    ngx_table_elt_t  **ph;
+
+    ph = (ngx_table_elt_t **) ((char *) &r->headers_out + hh->offset);
+
+    return ngx_http_python_set_header(r, &hh->name, value, ph);
+}
+
+
+static ngx_int_t
+ngx_http_python_set_content_type(ngx_http_request_t *r,
+    ngx_http_python_header_out_t *hh, ngx_str_t *value)
+{
+    u_char  *p;
+    size_t   len;
+
+    /*
+     * The header filter outputs the type from r->headers_out.content_type.
+     * The charset filter only adds a charset if the value has no parameters.
+     */
+
+    if (value->len == 0) {
+        ngx_str_null(&r->headers_out.content_type);
+
+    } else {
+        p = ngx_pnalloc(r->pool, value->len);
+        if (p == NULL) {
+            PyErr_SetNone(ngx_http_python_request_error);
+            return NGX_ERROR;
+        }
+
+        ngx_memcpy(p, value->data, value->len);
+
+        r->headers_out.content_type.data = p;
+        r->headers_out.content_type.len = value->len;
+    }
+
+    len = value->len;
+
+    p = ngx_strlchr(value->data, value->data + value->len, ';');
+
+    if (p) {
+        for (len = p - value->data; len; len--) {
+            if (value->data[len - 1] != ' ') {
+                break;
+            }
+        }
+    }
+
+    r->headers_out.content_type_len = len;
+    r->headers_out.content_type_hash = 0;
+    r->headers_out.content_type_lowcase = NULL;
+
+    return NGX_OK;
+}
+
+
+static ngx_int_t
+ngx_http_python_set_content_length(ngx_http_request_t *r,
+    ngx_http_python_header_out_t *hh, ngx_str_t *value)
+{
+    off_t  n;
+
+    if (value->len == 0) {
+        n = -1;
+
+    } else {
+        n = ngx_atoof(value->data, value->len);
+
+        if (n == NGX_ERROR) {
+            PyErr_SetString(PyExc_ValueError, "invalid Content-Length");
+            return NGX_ERROR;
+        }
+    }
+
+    if (ngx_http_python_set_header_out(r, hh, value) != NGX_OK) {
+        return NGX_ERROR;
+    }
+
+    r->headers_out.content_length_n = n;
+
+    return NGX_OK;
+}
+
+
+static ngx_int_t
+ngx_http_python_set_last_modified(ngx_http_request_t *r,
+    ngx_http_python_header_out_t *hh, ngx_str_t *value)
+{
+    if (ngx_http_python_set_header_out(r, hh, value) != NGX_OK) {
+        return NGX_ERROR;
+    }
+
+    /* a value that is not a valid date disables conditional requests */
+
+    r->headers_out.last_modified_time = value->len
+                                        ? ngx_parse_http_time(value->data,
+                                                              value->len)
+                                        : -1;
+
+    return NGX_OK;
+}
+
+
+static ngx_int_t
+ngx_http_python_init_headers_out(ngx_conf_t *cf)
+{
+    ngx_pool_t                    *pool;
+    ngx_array_t                    headers;
+    ngx_hash_key_t                *hk;
+    ngx_hash_init_t                hash;
+    ngx_http_python_header_out_t  *hh;
+
+    /*
+     * The hash lives as long as the Python types, which are initialized
+     * once and survive reloads, so it is allocated from its own pool.
+     */
+
+    pool = ngx_create_pool(NGX_DEFAULT_POOL_SIZE, cf->log);
+    if (pool == NULL) {
+        return NGX_ERROR;
+    }
+
+    if (ngx_array_init(&headers, cf->temp_pool, 16, sizeof(ngx_hash_key_t))
+        != NGX_OK)
+    {
+        return NGX_ERROR;
+    }
+
+    for (hh = ngx_http_python_headers_out; hh->name.len; hh++) {
+        hk = ngx_array_push(&headers);
+        if (hk == NULL) {
+            return NGX_ERROR;
+        }
+
+        hk->key = hh->name;
+        hk->key_hash = ngx_hash_key_lc(hh->name.data, hh->name.len);
+        hk->value = hh;
+    }
+
+    hash.hash = &ngx_http_python_headers_out_hash;
+    hash.key = ngx_hash_key;
+    hash.max_size = 512;
+    hash.bucket_size = ngx_align(64, ngx_cacheline_size);
+    hash.name = "python_headers_out_hash";
+    hash.pool = pool;
+    hash.temp_pool = cf->temp_pool;
+
+    return ngx_hash_init(&hash, headers.elts, headers.nelts);
+}
+
+
+static ngx_table_elt_t *
+ngx_http_python_find_header_in(ngx_http_request_t *r, u_char *data,
+    size_t len)
+{
+    u_char                      lowcase[NGX_HTTP_LC_HEADER_LEN];
+    ngx_uint_t                  i, hash;
+    ngx_list_part_t            *part;
+    ngx_table_elt_t            *h, **ph;
+    ngx_http_header_t          *hh;
+    ngx_http_core_main_conf_t  *cmcf;
+
+    if (ngx_http_python_header_hash(data, len, lowcase, &hash) != NGX_OK) {
+        return ngx_http_python_find_header(&r->headers_in.headers, data, len);
+    }
+
+    /* known headers are looked up in their r->headers_in fields */
+
+    if (len <= NGX_HTTP_LC_HEADER_LEN) {
+        cmcf = ngx_http_get_module_main_conf(r, ngx_http_core_module);
+
+        hh = ngx_hash_find(&cmcf->headers_in_hash, hash, lowcase, len);
+
+        if (hh && hh->offset
+#if (nginx_version < 1023000)
+
+            /* multiple headers were kept in arrays */
+
+            && hh->offset != offsetof(ngx_http_headers_in_t, cookies)
+#if (NGX_HTTP_X_FORWARDED_FOR)
+            && hh->offset != offsetof(ngx_http_headers_in_t, x_forwarded_for)
+#endif
+#endif
+           )
+        {
+            ph = (ngx_table_elt_t **) ((char *) &r->headers_in + hh->offset);
+            return *ph;
+        }
+    }
+
+    /* other headers are compared by hash first */
+
+    part = &r->headers_in.headers.part;
+    h = part->elts;
+
+    for (i = 0; /* void */ ; i++) {
+
+        if (i >= part->nelts) {
+            if (part->next == NULL) {
+                return NULL;
+            }
+
+            part = part->next;
+            h = part->elts;
+            i = 0;
+        }
+
+        if (h[i].hash == hash
+            && h[i].key.len == len
+            && ngx_strncasecmp(h[i].key.data, data, len) == 0)
+        {
+            return &h[i];
+        }
+    }
+}
+
+
+static ngx_int_t
+ngx_http_python_header_hash(u_char *data, size_t len, u_char *lowcase,
+    ngx_uint_t *hash)
+{
+    u_char      c;
+    ngx_uint_t  i, key;
+
+    /*
+     * Computes the hash nginx assigns to input headers, and the lowercase
+     * name if it fits.  Underscores are only hashed by nginx if
+     * underscores_in_headers is enabled, such names are scanned as before.
+     */
+
+    key = 0;
+
+    for (i = 0; i < len; i++) {
+        c = ngx_tolower(data[i]);
+
+        if ((c < 'a' || c > 'z') && (c < '0' || c > '9') && c != '-') {
+            return NGX_DECLINED;
+        }
+
+        key = ngx_hash(key, c);
+
+        if (i < NGX_HTTP_LC_HEADER_LEN) {
+            lowcase[i] = c;
+        }
+    }
+
+    *hash = key;
+
+    return NGX_OK;
 }
 
 
@@ -965,6 +2914,16 @@ ngx_http_python_request_init(ngx_conf_t *cf)
         return NGX_ERROR;
     }
 
+    if (PyType_Ready(&ngx_http_python_request_body_type) < 0) {
+        ngx_conf_log_error(NGX_LOG_EMERG, cf, 0, "could not add %s type",
+                           ngx_http_python_request_body_type.tp_name);
+        return NGX_ERROR;
+    }
+
+    if (ngx_http_python_init_headers_out(cf) != NGX_OK) {
+        return NGX_ERROR;
+    }
+
     ngx_http_python_request_error = PyErr_NewException("ngx.HTTPRequestError",
                                                        PyExc_RuntimeError,
                                                        NULL);
@@ -977,7 +2936,8 @@ ngx_http_python_request_init(ngx_conf_t *cf)
 
 
 PyObject *
-ngx_http_python_request_create(ngx_http_request_t *r)
+ngx_http_python_request_create(ngx_http_request_t *r, ngx_python_ctx_t *python,
+    size_t send_buffer, size_t output_buffer)
 {
     ngx_pool_cleanup_t         *cln;
     ngx_http_python_request_t  *pr;
@@ -991,6 +2951,22 @@ ngx_http_python_request_create(ngx_http_request_t *r)
     }
 
     pr->request = r;
+    pr->hi = NULL;
+    pr->ho = NULL;
+    pr->arg = NULL;
+    pr->var = NULL;
+    pr->body = NULL;
+    pr->pinned = NULL;
+    pr->free = NULL;
+    pr->python = python;
+    pr->send_buffer = send_buffer;
+    pr->output_buffer = output_buffer;
+    pr->buffered = NULL;
+    pr->free_bufs = NULL;
+    pr->busy_bufs = NULL;
+#if !(NGX_PYTHON_SYNC)
+    pr->reader = NULL;
+#endif
 
     pr->ctx = PyDict_New();
     if (pr->ctx == NULL) {
@@ -1026,7 +3002,24 @@ ngx_http_python_request_cleanup(void *data)
 {
     ngx_http_python_request_t *pr = data;
 
+    ngx_http_python_request_unpin(pr, 1);
+
+    /* body buffers exported to Python are copied before the pool is freed */
+
+    if (pr->body) {
+        ngx_http_python_request_body_detach(
+                         (ngx_http_python_request_body_t *) pr->body,
+                         pr->request->connection->log);
+    }
+
     pr->request = NULL;
 
+    /* cached proxies reference the request object */
+
+    Py_CLEAR(pr->hi);
+    Py_CLEAR(pr->ho);
+    Py_CLEAR(pr->arg);
+    Py_CLEAR(pr->var);
+
     Py_DECREF(pr);
 }
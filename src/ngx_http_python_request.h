@@ -15,7 +15,10 @@
 
 
 ngx_int_t ngx_http_python_request_init(ngx_conf_t *cf);
-PyObject *ngx_http_python_request_create(ngx_http_request_t *r);
+PyObject *ngx_http_python_request_create(ngx_http_request_t *r,
+    ngx_python_ctx_t *python, size_t send_buffer, size_t output_buffer);
+ngx_int_t ngx_http_python_request_wakeup(PyObject *request);
+void ngx_http_python_request_flush(PyObject *request);
 
 
 #endif /* _NGX_HTTP_PYTHON_REQUEST_H_INCLUDED_ */
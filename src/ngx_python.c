@@ -15,21 +15,36 @@
  * compilation option, macros redefinition causes compilation errors.
  */
 
+#include <frameobject.h>
 #include <ngx_config.h>
 #include <ngx_core.h>
 #include <ngx_event_posted.h>
-#include <ucontext.h>
+#include <nginx.h>
 #include "ngx_python.h"
 
 
 typedef struct {
     PyObject              *ns;
     size_t                 stack_size;
+    ngx_uint_t             stack_pool_min;
+    ngx_uint_t             stack_pool_max;
+    ngx_str_t              include_cache;
+    ngx_flag_t             freeze;
+    ngx_flag_t             gc;
+    ngx_msec_t             gc_interval;
+    ngx_uint_t             gc_requests;
+    ngx_array_t            batches;  /* array of ngx_python_batch_t * */
+    ngx_queue_t            errors;   /* confs with suppressed errors */
+#if (NGX_THREADS)
+    ngx_thread_pool_t     *thread_pool;
+#endif
 } ngx_python_conf_t;
 
 
 struct ngx_python_ctx_s {
     PyCodeObject          *code;
+    PyObject              *func;
+    PyObject              *args;
     PyObject              *ns;
     PyObject              *result;
 
@@ -41,20 +56,28 @@ struct ngx_python_ctx_s {
     ngx_msec_t             resolver_timeout;
 
     size_t                 stack_size;
+    ngx_python_ctx_conf_t *conf;
 
 #if !(NGX_PYTHON_SYNC)
 
-    void                  *stack;
+    ngx_python_stack_t    *stack;
 
-    ucontext_t             uc;
-    ucontext_t             ruc;
+    ngx_python_context_t   uc;
+    ngx_python_context_t   ruc;
 
     int                    recursion_depth;
+    int                    tracing;
     struct _frame         *frame;
     PyObject              *exc_type;
     PyObject              *exc_value;
     PyObject              *exc_traceback;
 
+    ngx_msec_t             slice_start;
+    ngx_uint_t             slice_ticks;
+#if (nginx_version < 1017005)
+    ngx_event_t            slice_event;
+#endif
+
     ngx_uint_t             terminate;  /* unsigned  terminate:1; */
 
 #endif
@@ -70,16 +93,39 @@ typedef struct {
 #if !(NGX_PYTHON_SYNC)
 static ngx_python_ctx_t *ngx_python_set_ctx(ngx_python_ctx_t *ctx);
 static void ngx_python_task_handler();
+static void ngx_python_release_stack(ngx_python_ctx_t *ctx);
+static int ngx_python_trace(PyObject *obj, struct _frame *frame, int what,
+    PyObject *arg);
+static void ngx_python_slice_wakeup(ngx_python_ctx_t *ctx);
+#if (nginx_version < 1017005)
+static void ngx_python_slice_handler(ngx_event_t *ev);
+#endif
+static ngx_msec_t ngx_python_msec(void);
 static void ngx_python_cleanup_ctx(void *data);
 #endif
+static PyObject *ngx_python_run(ngx_python_ctx_t *ctx, PyCodeObject *code,
+    PyObject *func, PyObject *args, ngx_event_t *wake);
+static void ngx_python_log_error(ngx_python_ctx_t *ctx);
+static void ngx_python_error_handler(ngx_event_t *ev);
+static PyTracebackObject *ngx_python_error_traceback(PyObject *traceback);
+static void ngx_python_count_error(PyCodeObject *code);
+static PyObject *ngx_python_errorstats(PyObject *self, PyObject *args);
 static char *ngx_python_include_file(ngx_conf_t *cf, PyObject *ns, char *file);
-static void ngx_python_decref(void *data);
+static char *ngx_python_include_cache(ngx_conf_t *cf, ngx_command_t *cmd,
+    void *conf);
+static char *ngx_python_stack_pool(ngx_conf_t *cf, ngx_command_t *cmd,
+    void *conf);
+#if (NGX_THREADS)
+static char *ngx_python_thread_pool(ngx_conf_t *cf, ngx_command_t *cmd,
+    void *conf);
+#endif
 static PyObject *ngx_python_init_namespace(ngx_conf_t *cf);
 static void ngx_python_cleanup_namespace(void *data);
 
 static void *ngx_python_create_conf(ngx_cycle_t *cycle);
 static char *ngx_python_init_conf(ngx_cycle_t *cycle, void *conf);
 static ngx_int_t ngx_python_init_worker(ngx_cycle_t *cycle);
+static void ngx_python_exit_worker(ngx_cycle_t *cycle);
 
 
 static ngx_command_t  ngx_python_commands[] = {
@@ -98,6 +144,41 @@ static ngx_command_t  ngx_python_commands[] = {
       0,
       NULL },
 
+    { ngx_string("python_include_cache"),
+      NGX_MAIN_CONF|NGX_DIRECT_CONF|NGX_CONF_TAKE1,
+      ngx_python_include_cache,
+      0,
+      0,
+      NULL },
+
+    { ngx_string("python_freeze"),
+      NGX_MAIN_CONF|NGX_DIRECT_CONF|NGX_CONF_FLAG,
+      ngx_conf_set_flag_slot,
+      0,
+      offsetof(ngx_python_conf_t, freeze),
+      NULL },
+
+    { ngx_string("python_gc"),
+      NGX_MAIN_CONF|NGX_DIRECT_CONF|NGX_CONF_FLAG,
+      ngx_conf_set_flag_slot,
+      0,
+      offsetof(ngx_python_conf_t, gc),
+      NULL },
+
+    { ngx_string("python_gc_interval"),
+      NGX_MAIN_CONF|NGX_DIRECT_CONF|NGX_CONF_TAKE1,
+      ngx_conf_set_msec_slot,
+      0,
+      offsetof(ngx_python_conf_t, gc_interval),
+      NULL },
+
+    { ngx_string("python_gc_requests"),
+      NGX_MAIN_CONF|NGX_DIRECT_CONF|NGX_CONF_TAKE1,
+      ngx_conf_set_num_slot,
+      0,
+      offsetof(ngx_python_conf_t, gc_requests),
+      NULL },
+
     { ngx_string("python_stack_size"),
       NGX_MAIN_CONF|NGX_DIRECT_CONF|NGX_CONF_TAKE1,
       ngx_conf_set_size_slot,
@@ -105,6 +186,24 @@ static ngx_command_t  ngx_python_commands[] = {
       offsetof(ngx_python_conf_t, stack_size),
       NULL },
 
+    { ngx_string("python_stack_pool"),
+      NGX_MAIN_CONF|NGX_DIRECT_CONF|NGX_CONF_TAKE2,
+      ngx_python_stack_pool,
+      0,
+      0,
+      NULL },
+
+#if (NGX_THREADS)
+
+    { ngx_string("python_thread_pool"),
+      NGX_MAIN_CONF|NGX_DIRECT_CONF|NGX_CONF_TAKE1,
+      ngx_python_thread_pool,
+      0,
+      0,
+      NULL },
+
+#endif
+
       ngx_null_command
 };
 
@@ -126,24 +225,149 @@ ngx_module_t  ngx_python_module = {
     ngx_python_init_worker,                /* init process */
     NULL,                                  /* init thread */
     NULL,                                  /* exit thread */
-    NULL,                                  /* exit process */
+    ngx_python_exit_worker,                /* exit process */
     NULL,                                  /* exit master */
     NGX_MODULE_V1_PADDING
 };
 
 
+static PyMethodDef  ngx_python_methods[] = {
+
+    { "errorstats",
+      (PyCFunction) ngx_python_errorstats,
+      METH_NOARGS,
+      "return the number of errors per code object" },
+
+    { NULL, NULL, 0, NULL }
+};
+
+
+/* code object -> number of errors raised in it */
+static PyObject  *ngx_python_errors;
+
+
 #if !(NGX_PYTHON_SYNC)
 
 ngx_python_ctx_t  * volatile ngx_python_ctx;
 
+#if (NGX_THREADS)
+static pthread_t  ngx_python_main_thread;
+#endif
+
 
 ngx_python_ctx_t *
 ngx_python_get_ctx()
 {
+#if (NGX_THREADS)
+
+    /* no coroutines in thread pool threads */
+
+    if (ngx_python_in_thread()) {
+        return NULL;
+    }
+
+#endif
+
     return ngx_python_ctx;
 }
 
 
+#if (NGX_THREADS)
+
+ngx_uint_t
+ngx_python_in_thread(void)
+{
+    return !pthread_equal(pthread_self(), ngx_python_main_thread);
+}
+
+
+static PyObject *
+ngx_python_dispatch(PyObject *self, PyObject *args, PyObject *kwds)
+{
+    PyObject  *func;
+
+    /* self is a tuple of the substitute and the original function */
+
+    func = PyTuple_GET_ITEM(self, ngx_python_in_thread() ? 1 : 0);
+
+    return PyObject_Call(func, args, kwds);
+}
+
+#endif
+
+
+ngx_int_t
+ngx_python_substitute(ngx_cycle_t *cycle, PyObject *m, PyMethodDef *def)
+{
+    PyObject     *fun;
+#if (NGX_THREADS)
+    PyObject     *orig, *pair;
+    PyMethodDef  *md;
+#endif
+
+    fun = PyCFunction_NewEx(def, NULL, NULL);
+    if (fun == NULL) {
+        return NGX_ERROR;
+    }
+
+#if (NGX_THREADS)
+
+    /*
+     * Substitutes use nginx events, which are only available in the main
+     * thread.  Calls made from thread pool threads go to the original
+     * functions.
+     */
+
+    orig = PyObject_GetAttrString(m, def->ml_name);
+
+    if (orig == NULL) {
+        PyErr_Clear();
+
+    } else {
+        pair = PyTuple_Pack(2, fun, orig);
+
+        Py_DECREF(orig);
+        Py_DECREF(fun);
+
+        if (pair == NULL) {
+            return NGX_ERROR;
+        }
+
+        /* the method definition lives as long as the worker */
+
+        md = ngx_alloc(sizeof(PyMethodDef), cycle->log);
+        if (md == NULL) {
+            Py_DECREF(pair);
+            return NGX_ERROR;
+        }
+
+        md->ml_name = def->ml_name;
+        md->ml_meth = (PyCFunction) ngx_python_dispatch;
+        md->ml_flags = METH_VARARGS|METH_KEYWORDS;
+        md->ml_doc = def->ml_doc;
+
+        fun = PyCFunction_NewEx(md, pair, NULL);
+
+        Py_DECREF(pair);
+
+        if (fun == NULL) {
+            return NGX_ERROR;
+        }
+    }
+
+#endif
+
+    if (PyObject_SetAttrString(m, def->ml_name, fun) < 0) {
+        Py_DECREF(fun);
+        return NGX_ERROR;
+    }
+
+    Py_DECREF(fun);
+
+    return NGX_OK;
+}
+
+
 static ngx_python_ctx_t *
 ngx_python_set_ctx(ngx_python_ctx_t *ctx)
 {
@@ -171,7 +395,7 @@ ngx_python_yield()
 
     ngx_log_debug0(NGX_LOG_DEBUG_CORE, ctx->log, 0, "python yield");
 
-    if (swapcontext(&ctx->uc, &ctx->ruc)) {
+    if (ngx_python_context_switch(&ctx->uc, &ctx->ruc) != NGX_OK) {
         PyErr_SetFromErrno(PyExc_OSError);
         return NGX_ERROR;
     }
@@ -236,17 +460,72 @@ ngx_python_create_ctx(ngx_pool_t *pool, ngx_log_t *log)
     ctx->ns = pcf->ns;
     ctx->stack_size = pcf->stack_size;
 
+    ngx_python_gc_request();
+
     return ctx;
 }
 
 
+void
+ngx_python_set_ctx_conf(ngx_python_ctx_t *ctx, ngx_python_ctx_conf_t *conf)
+{
+    ctx->conf = conf;
+}
+
+
+ngx_pool_t *
+ngx_python_get_pool(ngx_python_ctx_t *ctx)
+{
+    return ctx->pool;
+}
+
+
 #if !(NGX_PYTHON_SYNC)
 
+ngx_python_ctx_t *
+ngx_python_create_child_ctx(ngx_python_ctx_t *parent)
+{
+    ngx_python_ctx_t  *ctx;
+
+    /*
+     * The child context is allocated from the parent pool, but has
+     * no cleanup handler.  The caller is expected to terminate it with
+     * ngx_python_terminate_ctx() before the pool is destroyed.
+     */
+
+    if (parent->terminate) {
+        PyErr_SetString(PyExc_RuntimeError, "terminated");
+        return NULL;
+    }
+
+    ctx = ngx_pcalloc(parent->pool, sizeof(ngx_python_ctx_t));
+    if (ctx == NULL) {
+        PyErr_NoMemory();
+        return NULL;
+    }
+
+    ctx->pool = parent->pool;
+    ctx->log = parent->log;
+    ctx->ns = parent->ns;
+    ctx->resolver = parent->resolver;
+    ctx->resolver_timeout = parent->resolver_timeout;
+    ctx->stack_size = parent->stack_size;
+    ctx->conf = parent->conf;
+
+    return ctx;
+}
+
+
 static void
 ngx_python_cleanup_ctx(void *data)
 {
-    ngx_python_ctx_t  *ctx = data;
+    ngx_python_terminate_ctx(data);
+}
+
 
+void
+ngx_python_terminate_ctx(ngx_python_ctx_t *ctx)
+{
     PyObject  *result;
 
     ctx->terminate = 1;
@@ -258,6 +537,17 @@ ngx_python_cleanup_ctx(void *data)
     }
 
     Py_XDECREF(result);
+
+#if (nginx_version < 1017005)
+    if (ctx->slice_event.timer_set) {
+        ngx_del_timer(&ctx->slice_event);
+    }
+#endif
+
+    if (ctx->stack) {
+        ngx_python_stack_free(ctx->stack);
+        ctx->stack = NULL;
+    }
 }
 
 #endif
@@ -265,41 +555,83 @@ ngx_python_cleanup_ctx(void *data)
 
 PyObject *
 ngx_python_eval(ngx_python_ctx_t *ctx, PyCodeObject *code, ngx_event_t *wake)
+{
+    return ngx_python_run(ctx, code, NULL, NULL, wake);
+}
+
+
+PyObject *
+ngx_python_call(ngx_python_ctx_t *ctx, PyObject *func, PyObject *args,
+    ngx_event_t *wake)
+{
+    return ngx_python_run(ctx, NULL, func, args, wake);
+}
+
+
+static PyObject *
+ngx_python_run(ngx_python_ctx_t *ctx, PyCodeObject *code, PyObject *func,
+    PyObject *args, ngx_event_t *wake)
 {
     PyObject          *result;
 
 #if !(NGX_PYTHON_SYNC)
 
-    int                recursion_depth;
+    int                recursion_depth, tracing;
+    Py_tracefunc       tracefunc;
     PyObject          *exc_type, *exc_value, *exc_traceback;
+    ngx_msec_t         slice;
     struct _frame     *frame;
     PyThreadState     *ps;
     ngx_python_ctx_t  *pctx;
 
+    if (wake && ctx->result == NULL && ctx->conf && !ctx->conf->blocking) {
+
+        /*
+         * blocking calls are disabled, run the code on the current stack
+         * without creating a coroutine
+         */
+
+        wake = NULL;
+    }
+
     if (wake) {
         if (ctx->result == NULL) {
             if (ctx->stack == NULL) {
-                ctx->stack = ngx_palloc(ctx->pool, ctx->stack_size);
+                ctx->stack = ngx_python_stack_alloc(
+                                 ctx->conf && ctx->conf->stack_size
+                                 ? ctx->conf->stack_size : ctx->stack_size,
+                                 ctx->log);
                 if (ctx->stack == NULL) {
                     return NULL;
                 }
+
+                if (ctx->conf && ctx->conf->stack_usage) {
+                    ngx_python_stack_fill(ctx->stack);
+
+                } else {
+                    ctx->stack->filled = 0;
+                }
             }
 
-            if (getcontext(&ctx->uc) == -1) {
+            if (ngx_python_context_make(&ctx->uc, &ctx->ruc, ctx->stack,
+                                        &ngx_python_task_handler)
+                != NGX_OK)
+            {
                 ngx_log_debug0(NGX_LOG_DEBUG_CORE, ctx->log, ngx_errno,
-                               "getcontext() failed");
+                               "python context make failed");
                 return NULL;
             }
 
-            ctx->uc.uc_stack.ss_size = ctx->stack_size;
-            ctx->uc.uc_stack.ss_sp = ctx->stack;
-            ctx->uc.uc_link = &ctx->ruc;
-
-            makecontext(&ctx->uc, &ngx_python_task_handler, 0);
+            /* references to func and args are held until the task is over */
 
             ctx->code = code;
+            ctx->func = func;
+            ctx->args = args;
             ctx->wake = wake;
             ctx->result = NGX_PYTHON_AGAIN;
+
+            Py_XINCREF(func);
+            Py_XINCREF(args);
         }
 
         pctx = ngx_python_set_ctx(ctx);
@@ -318,11 +650,42 @@ ngx_python_eval(ngx_python_ctx_t *ctx, PyCodeObject *code, ngx_event_t *wake)
         ps->exc_value = ctx->exc_value;
         ps->exc_traceback = ctx->exc_traceback;
 
-        if (swapcontext(&ctx->ruc, &ctx->uc) == -1) {
+        tracing = ps->tracing;
+        ps->tracing = ctx->tracing;
+
+        slice = ctx->conf ? ctx->conf->time_slice : 0;
+
+        tracefunc = ps->c_tracefunc;
+
+        if (tracefunc != NULL && tracefunc != ngx_python_trace) {
+
+            /* a trace function set by sys.settrace() is left in place */
+
+            slice = 0;
+        }
+
+        if (slice) {
+            ctx->slice_start = ngx_python_msec();
+            ctx->slice_ticks = 0;
+
+            PyEval_SetTrace(ngx_python_trace, NULL);
+        }
+
+        if (ngx_python_context_switch(&ctx->ruc, &ctx->uc) != NGX_OK) {
             ngx_log_error(NGX_LOG_ERR, ctx->log, ngx_errno,
-                          "swapcontext() failed");
+                          "python context switch failed");
+        }
+
+        if (slice && ps->c_tracefunc == ngx_python_trace) {
+
+            /* restore the trace function of a coroutine run from another */
+
+            PyEval_SetTrace(tracefunc, NULL);
         }
 
+        ctx->tracing = ps->tracing;
+        ps->tracing = tracing;
+
         ctx->recursion_depth = ps->recursion_depth;
         ctx->frame = ps->frame;
         ctx->exc_type = ps->exc_type;
@@ -339,8 +702,17 @@ ngx_python_eval(ngx_python_ctx_t *ctx, PyCodeObject *code, ngx_event_t *wake)
 
         result = ctx->result;
         if (result != NGX_PYTHON_AGAIN) {
+
+            /* the task is over, its stack can be reused by others */
+
+            ngx_python_release_stack(ctx);
+
             ctx->code = NULL;
             ctx->wake = NULL;
+
+            Py_CLEAR(ctx->func);
+            Py_CLEAR(ctx->args);
+
             ctx->result = NULL;
         }
 
@@ -351,10 +723,21 @@ ngx_python_eval(ngx_python_ctx_t *ctx, PyCodeObject *code, ngx_event_t *wake)
 
 #endif
 
-    result = PyEval_EvalCode(code, ctx->ns, ctx->ns);
+    /*
+     * A coroutine of the context may be suspended at this point, for example
+     * if a log handler runs while the content handler sleeps, so its code
+     * and callable stored in the context are left intact.
+     */
+
+    if (code) {
+        result = PyEval_EvalCode(code, ctx->ns, ctx->ns);
+
+    } else {
+        result = PyObject_Call(func, args, NULL);
+    }
+
     if (result == NULL) {
-        ngx_log_error(NGX_LOG_ERR, ctx->log, 0, "python error: %s",
-                      ngx_python_get_error(ctx->pool));
+        ngx_python_log_error(ctx);
     }
 
 #if !(NGX_PYTHON_SYNC)
@@ -368,88 +751,283 @@ ngx_python_eval(ngx_python_ctx_t *ctx, PyCodeObject *code, ngx_event_t *wake)
 #if !(NGX_PYTHON_SYNC)
 
 static void
-ngx_python_task_handler()
+ngx_python_release_stack(ngx_python_ctx_t *ctx)
 {
-    ngx_python_ctx_t  *ctx;
+    size_t                  used;
+    ngx_uint_t              level;
+    ngx_python_stack_t     *stack;
+    ngx_python_ctx_conf_t  *conf;
 
-    ctx = ngx_python_get_ctx();
+    stack = ctx->stack;
+    conf = ctx->conf;
 
-    ngx_log_debug0(NGX_LOG_DEBUG_CORE, ctx->log, 0, "python task handler");
+    ctx->stack = NULL;
 
-    ctx->result = PyEval_EvalCode(ctx->code, ctx->ns, ctx->ns);
-    if (ctx->result == NULL) {
-        ngx_log_error(NGX_LOG_ERR, ctx->log, 0, "python error: %s",
-                      ngx_python_get_error(ctx->pool));
+    if (stack->filled && conf) {
+        used = ngx_python_stack_used(stack);
+
+        ngx_log_debug2(NGX_LOG_DEBUG_CORE, ctx->log, 0,
+                       "python stack used %uz of %uz", used, stack->size);
+
+        if (used > conf->stack_used) {
+            conf->stack_used = used;
+
+            level = (used > stack->size / 4 * 3) ? NGX_LOG_WARN
+                                                 : NGX_LOG_NOTICE;
+
+            ngx_log_error(level, ctx->log, 0,
+                          "python stack high-water mark is %uz of %uz bytes",
+                          used, stack->size);
+        }
     }
+
+    ngx_python_stack_free(stack);
 }
 
-#endif
 
+/*
+ * A trace function is only installed while a coroutine with a time slice is
+ * running.  Once the slice is over, the coroutine yields from the trace
+ * function and is resumed in the next event loop iteration, after new events
+ * are collected.  Posting it to ngx_posted_events instead would resume it
+ * from the same ngx_event_process_posted() call.  A trace function call
+ * increments the "tracing" counter of the thread state, which is why the
+ * counter is saved and restored along with the coroutine.
+ */
 
-void
-ngx_python_set_resolver(ngx_python_ctx_t *ctx, ngx_resolver_t *resolver,
-    ngx_msec_t timeout)
-{
-    ctx->resolver = resolver;
-    ctx->resolver_timeout = timeout;
-}
+#define NGX_PYTHON_SLICE_TICKS  32
 
 
-ngx_resolver_t *
-ngx_python_get_resolver(ngx_python_ctx_t *ctx, ngx_msec_t *timeout)
+static int
+ngx_python_trace(PyObject *obj, struct _frame *frame, int what, PyObject *arg)
 {
-    *timeout = ctx->resolver_timeout;
-    return ctx->resolver;
-}
+    ngx_msec_t         now;
+    ngx_python_ctx_t  *ctx;
 
+    ctx = ngx_python_get_ctx();
 
-PyObject *
-ngx_python_set_value(ngx_python_ctx_t *ctx, const char *name, PyObject *value)
-{
-    PyObject  *old;
+    /* no coroutine if running a variable handler from a coroutine */
 
-    old = PyDict_GetItemString(ctx->ns, name);
+    if (ctx == NULL || ctx->conf == NULL || ctx->conf->time_slice == 0) {
+        return 0;
+    }
 
-    if (old == NULL) {
-        if (PyDict_SetItemString(ctx->ns, name, value) < 0) {
-            ngx_log_error(NGX_LOG_ERR, ctx->log, 0,
-                          "python error: %s", ngx_python_get_error(ctx->pool));
-        }
+    if (++ctx->slice_ticks < NGX_PYTHON_SLICE_TICKS) {
+        return 0;
     }
 
-    return old;
-}
+    ctx->slice_ticks = 0;
 
+    now = ngx_python_msec();
 
-void
-ngx_python_reset_value(ngx_python_ctx_t *ctx, const char *name, PyObject *old)
-{
-    if (old == NULL) {
-        if (PyDict_DelItemString(ctx->ns, name) < 0) {
-            ngx_log_error(NGX_LOG_ERR, ctx->log, 0,
-                          "python error: %s", ngx_python_get_error(ctx->pool));
-        }
+    if (now - ctx->slice_start < ctx->conf->time_slice) {
+        return 0;
     }
-}
 
+    ngx_log_debug1(NGX_LOG_DEBUG_CORE, ctx->log, 0,
+                   "python time slice expired after %M", now - ctx->slice_start);
 
-ngx_int_t
-ngx_python_active(ngx_conf_t *cf)
-{
-    ngx_python_conf_t  *pcf;
+    ngx_python_slice_wakeup(ctx);
 
-    pcf = (ngx_python_conf_t *) ngx_get_conf(cf->cycle->conf_ctx,
-                                             ngx_python_module);
+    if (ngx_python_yield() != NGX_OK) {
+        return -1;
+    }
 
-    return pcf->ns ? NGX_OK : NGX_DECLINED;
+    return 0;
 }
 
 
-char *
-ngx_python_set_slot(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
+static void
+ngx_python_slice_wakeup(ngx_python_ctx_t *ctx)
 {
-    PyObject   *ret, *ns;
-    ngx_str_t  *value;
+    if (ctx->terminate) {
+        return;
+    }
+
+#if (nginx_version >= 1017005)
+
+    ngx_post_event(ctx->wake, &ngx_posted_next_events);
+
+#else
+
+    ctx->slice_event.handler = ngx_python_slice_handler;
+    ctx->slice_event.data = ctx;
+    ctx->slice_event.log = ctx->log;
+
+    ngx_add_timer(&ctx->slice_event, 1);
+
+#endif
+}
+
+
+#if (nginx_version < 1017005)
+
+static void
+ngx_python_slice_handler(ngx_event_t *ev)
+{
+    ngx_python_ctx_t  *ctx = ev->data;
+
+    ngx_python_wakeup(ctx);
+}
+
+#endif
+
+
+static ngx_msec_t
+ngx_python_msec(void)
+{
+    struct timeval  tv;
+
+    ngx_gettimeofday(&tv);
+
+    return (ngx_msec_t) tv.tv_sec * 1000 + tv.tv_usec / 1000;
+}
+
+
+static void
+ngx_python_task_handler()
+{
+    ngx_python_ctx_t  *ctx;
+
+    ctx = ngx_python_get_ctx();
+
+    ngx_log_debug0(NGX_LOG_DEBUG_CORE, ctx->log, 0, "python task handler");
+
+    if (ctx->code) {
+        ctx->result = PyEval_EvalCode(ctx->code, ctx->ns, ctx->ns);
+
+    } else {
+        ctx->result = PyObject_Call(ctx->func, ctx->args, NULL);
+    }
+
+    if (ctx->result == NULL) {
+        ngx_python_log_error(ctx);
+    }
+}
+
+#endif
+
+
+void
+ngx_python_set_resolver(ngx_python_ctx_t *ctx, ngx_resolver_t *resolver,
+    ngx_msec_t timeout)
+{
+    ctx->resolver = resolver;
+    ctx->resolver_timeout = timeout;
+}
+
+
+ngx_resolver_t *
+ngx_python_get_resolver(ngx_python_ctx_t *ctx, ngx_msec_t *timeout)
+{
+    *timeout = ctx->resolver_timeout;
+    return ctx->resolver;
+}
+
+
+PyObject *
+ngx_python_set_value(ngx_python_ctx_t *ctx, const char *name, PyObject *value)
+{
+    PyObject  *old;
+
+    old = PyDict_GetItemString(ctx->ns, name);
+
+    if (old == NULL) {
+        if (PyDict_SetItemString(ctx->ns, name, value) < 0) {
+            ngx_log_error(NGX_LOG_ERR, ctx->log, 0,
+                          "python error: %s", ngx_python_get_error(ctx->pool));
+        }
+    }
+
+    return old;
+}
+
+
+void
+ngx_python_reset_value(ngx_python_ctx_t *ctx, const char *name, PyObject *old)
+{
+    if (old == NULL) {
+        if (PyDict_DelItemString(ctx->ns, name) < 0) {
+            ngx_log_error(NGX_LOG_ERR, ctx->log, 0,
+                          "python error: %s", ngx_python_get_error(ctx->pool));
+        }
+    }
+}
+
+
+ngx_int_t
+ngx_python_active(ngx_conf_t *cf)
+{
+    ngx_python_conf_t  *pcf;
+
+    pcf = (ngx_python_conf_t *) ngx_get_conf(cf->cycle->conf_ctx,
+                                             ngx_python_module);
+
+    return pcf->ns ? NGX_OK : NGX_DECLINED;
+}
+
+
+ngx_int_t
+ngx_python_add_batch(ngx_conf_t *cf, ngx_python_batch_t *batch)
+{
+    ngx_python_conf_t    *pcf;
+    ngx_python_batch_t  **b;
+
+    pcf = (ngx_python_conf_t *) ngx_get_conf(cf->cycle->conf_ctx,
+                                             ngx_python_module);
+
+    b = ngx_array_push(&pcf->batches);
+    if (b == NULL) {
+        return NGX_ERROR;
+    }
+
+    *b = batch;
+
+    return NGX_OK;
+}
+
+
+void
+ngx_python_create_ctx_conf(ngx_python_ctx_conf_t *conf)
+{
+    /*
+     * set by ngx_pcalloc():
+     *
+     *     conf->stack_used = 0;
+     *     conf->error_time = 0;
+     *     conf->errors = 0;
+     *     conf->errors_suppressed = 0;
+     */
+
+    conf->stack_size = NGX_CONF_UNSET_SIZE;
+    conf->stack_usage = NGX_CONF_UNSET;
+    conf->blocking = NGX_CONF_UNSET;
+    conf->time_slice = NGX_CONF_UNSET_MSEC;
+    conf->error_limit = NGX_CONF_UNSET_UINT;
+}
+
+
+char *
+ngx_python_merge_ctx_conf(ngx_conf_t *cf, ngx_python_ctx_conf_t *conf,
+    ngx_python_ctx_conf_t *prev)
+{
+    /* zero stack size stands for the global python_stack_size */
+
+    ngx_conf_merge_size_value(conf->stack_size, prev->stack_size, 0);
+    ngx_conf_merge_value(conf->stack_usage, prev->stack_usage, 0);
+    ngx_conf_merge_value(conf->blocking, prev->blocking, 1);
+    ngx_conf_merge_msec_value(conf->time_slice, prev->time_slice, 0);
+    ngx_conf_merge_uint_value(conf->error_limit, prev->error_limit, 0);
+
+    return NGX_CONF_OK;
+}
+
+
+char *
+ngx_python_set_slot(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
+{
+    PyObject   *ret, *ns;
+    ngx_str_t  *value;
 
     ns = ngx_python_init_namespace(cf);
     if (ns == NULL) {
@@ -550,19 +1128,36 @@ ngx_python_include_set_slot(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
 static char *
 ngx_python_include_file(ngx_conf_t *cf, PyObject *ns, char *file)
 {
-    FILE      *fp;
-    PyObject  *ret;
+    FILE               *fp;
+    PyObject           *ret;
+    PyCodeObject       *code;
+    ngx_python_conf_t  *pcf;
 
-    fp = fopen(file, "r");
-    if (fp == NULL) {
-        ngx_conf_log_error(NGX_LOG_EMERG, cf, ngx_errno,
-                           "fopen() \"%s\" failed", file);
-        return NGX_CONF_ERROR;
-    }
+    pcf = (ngx_python_conf_t *) ngx_get_conf(cf->cycle->conf_ctx,
+                                             ngx_python_module);
 
-    ret = PyRun_FileExFlags(fp, file, Py_file_input, ns, ns, 0, NULL);
+    if (pcf->include_cache.len) {
+        code = ngx_python_cache_compile(cf, &pcf->include_cache, file);
+        if (code == NULL) {
+            return NGX_CONF_ERROR;
+        }
 
-    fclose(fp);
+        ret = PyEval_EvalCode(code, ns, ns);
+
+        Py_DECREF(code);
+
+    } else {
+        fp = fopen(file, "r");
+        if (fp == NULL) {
+            ngx_conf_log_error(NGX_LOG_EMERG, cf, ngx_errno,
+                               "fopen() \"%s\" failed", file);
+            return NGX_CONF_ERROR;
+        }
+
+        ret = PyRun_FileExFlags(fp, file, Py_file_input, ns, ns, 0, NULL);
+
+        fclose(fp);
+    }
 
     if (ret == NULL) {
         ngx_conf_log_error(NGX_LOG_EMERG, cf, 0, "python error: %s",
@@ -576,6 +1171,93 @@ ngx_python_include_file(ngx_conf_t *cf, PyObject *ns, char *file)
 }
 
 
+static char *
+ngx_python_include_cache(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
+{
+    ngx_python_conf_t *pcf = conf;
+
+    ngx_str_t  *value;
+
+    if (pcf->include_cache.data) {
+        return "is duplicate";
+    }
+
+    value = cf->args->elts;
+
+    pcf->include_cache = value[1];
+
+    if (ngx_conf_full_name(cf->cycle, &pcf->include_cache, 0) != NGX_OK) {
+        return NGX_CONF_ERROR;
+    }
+
+    return NGX_CONF_OK;
+}
+
+
+static char *
+ngx_python_stack_pool(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
+{
+    ngx_python_conf_t *pcf = conf;
+
+    ngx_int_t   n;
+    ngx_str_t  *value;
+
+    if (pcf->stack_pool_min != NGX_CONF_UNSET_UINT) {
+        return "is duplicate";
+    }
+
+    value = cf->args->elts;
+
+    n = ngx_atoi(value[1].data, value[1].len);
+    if (n == NGX_ERROR) {
+        ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                           "invalid minimum stack pool size \"%V\"",
+                           &value[1]);
+        return NGX_CONF_ERROR;
+    }
+
+    pcf->stack_pool_min = n;
+
+    n = ngx_atoi(value[2].data, value[2].len);
+    if (n == NGX_ERROR) {
+        ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                           "invalid maximum stack pool size \"%V\"",
+                           &value[2]);
+        return NGX_CONF_ERROR;
+    }
+
+    pcf->stack_pool_max = n;
+
+    return NGX_CONF_OK;
+}
+
+
+#if (NGX_THREADS)
+
+static char *
+ngx_python_thread_pool(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
+{
+    ngx_python_conf_t *pcf = conf;
+
+    ngx_str_t  *value;
+
+    if (pcf->thread_pool) {
+        return "is duplicate";
+    }
+
+    value = cf->args->elts;
+
+    pcf->thread_pool = ngx_thread_pool_add(cf, &value[1]);
+    if (pcf->thread_pool == NULL) {
+        return NGX_CONF_ERROR;
+    }
+
+    return NGX_CONF_OK;
+}
+
+#endif
+
+
 PyCodeObject *
 ngx_python_compile(ngx_conf_t *cf, u_char *script)
 {
@@ -618,7 +1300,64 @@ ngx_python_compile(ngx_conf_t *cf, u_char *script)
 }
 
 
-static void
+PyObject *
+ngx_python_get_callable(ngx_conf_t *cf, u_char *name)
+{
+    PyObject            *ns, *func;
+    PyCodeObject        *code;
+    ngx_pool_cleanup_t  *cln;
+
+    /* the expression is evaluated once, at configuration time */
+
+    code = ngx_python_compile(cf, name);
+    if (code == NULL) {
+        return NULL;
+    }
+
+    ns = ngx_python_init_namespace(cf);
+    if (ns == NULL) {
+        return NULL;
+    }
+
+    func = PyEval_EvalCode(code, ns, ns);
+    if (func == NULL) {
+        ngx_conf_log_error(NGX_LOG_EMERG, cf, 0, "python error: %s",
+                           ngx_python_get_error(cf->pool));
+        return NULL;
+    }
+
+    if (!PyCallable_Check(func)) {
+        ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                           "python object \"%s\" is not callable", name);
+        Py_DECREF(func);
+        return NULL;
+    }
+
+    cln = ngx_pool_cleanup_add(cf->pool, 0);
+    if (cln == NULL) {
+        Py_DECREF(func);
+        return NULL;
+    }
+
+    cln->handler = ngx_python_decref;
+    cln->data = func;
+
+    return func;
+}
+
+
+PyObject *
+ngx_python_conf_handler(ngx_conf_t *cf, ngx_command_t *cmd, u_char *script)
+{
+    if (cmd->post == NGX_PYTHON_CALLABLE) {
+        return ngx_python_get_callable(cf, script);
+    }
+
+    return (PyObject *) ngx_python_compile(cf, script);
+}
+
+
+void
 ngx_python_decref(void *data)
 {
     PyObject *obj = data;
@@ -649,7 +1388,7 @@ ngx_python_init_namespace(ngx_conf_t *cf)
 
         Py_Initialize();
 
-        m = Py_InitModule("ngx", NULL);
+        m = Py_InitModule("ngx", ngx_python_methods);
         if (m == NULL) {
             return NULL;
         }
@@ -748,23 +1487,103 @@ ngx_python_cleanup_namespace(void *data)
 }
 
 
+static void
+ngx_python_log_error(ngx_python_ctx_t *ctx)
+{
+    time_t                  now;
+    PyObject               *type, *value, *traceback;
+    ngx_event_t            *ev;
+    ngx_python_conf_t      *pcf;
+    PyTracebackObject      *tb;
+    ngx_python_ctx_conf_t  *conf;
+
+    conf = ctx->conf;
+
+    if (conf == NULL || conf->error_limit == 0) {
+        goto log;
+    }
+
+    now = ngx_time();
+
+    if (conf->error_time != now) {
+        conf->error_time = now;
+        conf->errors = 0;
+    }
+
+    if (conf->errors++ < conf->error_limit) {
+        goto log;
+    }
+
+    /*
+     * The number of suppressed errors is logged by a timer armed with the
+     * first one.  The timer is cancelable and does not delay worker exit,
+     * the confs with a pending count are queued to log it on exit instead.
+     */
+
+    if (conf->errors_suppressed++ == 0) {
+        pcf = (ngx_python_conf_t *) ngx_get_conf(ngx_cycle->conf_ctx,
+                                                 ngx_python_module);
+
+        ngx_queue_insert_tail(&pcf->errors, &conf->error_queue);
+
+        ev = &conf->error_event;
+
+        ev->handler = ngx_python_error_handler;
+        ev->data = conf;
+        ev->log = ngx_cycle->log;
+        ev->cancelable = 1;
+
+        ngx_add_timer(ev, 1000);
+    }
+
+    PyErr_Fetch(&type, &value, &traceback);
+
+    tb = ngx_python_error_traceback(traceback);
+    if (tb) {
+        ngx_python_count_error(tb->tb_frame->f_code);
+    }
+
+    Py_XDECREF(type);
+    Py_XDECREF(value);
+    Py_XDECREF(traceback);
+
+    return;
+
+log:
+
+    ngx_log_error(NGX_LOG_ERR, ctx->log, 0, "python error: %s",
+                  ngx_python_get_error(ctx->pool));
+}
+
+
+static void
+ngx_python_error_handler(ngx_event_t *ev)
+{
+    ngx_python_ctx_conf_t  *conf = ev->data;
+
+    ngx_log_error(NGX_LOG_ERR, ev->log, 0, "python %ui error(s) suppressed",
+                  conf->errors_suppressed);
+
+    conf->errors_suppressed = 0;
+
+    ngx_queue_remove(&conf->error_queue);
+}
+
+
 u_char *
 ngx_python_get_error(ngx_pool_t *pool)
 {
-    long         line;
-    char        *text, *file;
-    size_t       len;
-    u_char      *p;
-    PyObject    *type, *value, *traceback, *str, *module, *func, *ret, *frame,
-                *obj;
-    Py_ssize_t   size;
+    long                line;
+    char               *text, *file;
+    size_t              len;
+    u_char             *p;
+    PyObject           *type, *value, *traceback, *str;
+    PyCodeObject       *code;
+    PyTracebackObject  *tb;
 
     /* PyErr_Print(); */
 
     str = NULL;
-    module = NULL;
-    func = NULL;
-    ret = NULL;
 
     text = "";
     file = "";
@@ -785,40 +1604,22 @@ ngx_python_get_error(ngx_pool_t *pool)
         text = PyString_AsString(str);
     }
 
-    module = PyImport_ImportModule("traceback");
-    if (module == NULL) {
-        goto done;
-    }
-
-    func = PyObject_GetAttrString(module, "extract_tb");
-    if (func == NULL || !PyCallable_Check(func)) {
-        goto done;
-    }
+    /* the innermost frame is where the exception was raised */
 
-    ret = PyObject_CallFunctionObjArgs(func, traceback, NULL);
-    if (ret == NULL || !PyList_Check(ret)) {
+    tb = ngx_python_error_traceback(traceback);
+    if (tb == NULL) {
         goto done;
     }
 
-    size = PyList_Size(ret);
-    if (size <= 0) {
-        goto done;
-    }
+    code = tb->tb_frame->f_code;
 
-    frame = PyList_GetItem(ret, size - 1);
-    if (frame == NULL || !PyTuple_Check(frame)) {
-        goto done;
-    }
+    ngx_python_count_error(code);
 
-    obj = PyTuple_GetItem(frame, 0);
-    if (obj &&  PyString_Check(obj)) {
-        file = PyString_AsString(obj);
+    if (PyString_Check(code->co_filename)) {
+        file = PyString_AsString(code->co_filename);
     }
 
-    obj = PyTuple_GetItem(frame, 1);
-    if (obj && PyInt_Check(obj)) {
-        line = PyInt_AsLong(obj);
-    }
+    line = tb->tb_lineno;
 
 done:
 
@@ -837,14 +1638,101 @@ done:
     Py_XDECREF(type);
     Py_XDECREF(value);
     Py_XDECREF(traceback);
-    Py_XDECREF(module);
-    Py_XDECREF(func);
-    Py_XDECREF(ret);
 
     return p;
 }
 
 
+static PyTracebackObject *
+ngx_python_error_traceback(PyObject *traceback)
+{
+    PyTracebackObject  *tb;
+
+    if (traceback == NULL || !PyTraceBack_Check(traceback)) {
+        return NULL;
+    }
+
+    tb = (PyTracebackObject *) traceback;
+
+    while (tb->tb_next) {
+        tb = tb->tb_next;
+    }
+
+    return tb;
+}
+
+
+static void
+ngx_python_count_error(PyCodeObject *code)
+{
+    long       n;
+    PyObject  *count;
+
+    if (ngx_python_errors == NULL) {
+        ngx_python_errors = PyDict_New();
+        if (ngx_python_errors == NULL) {
+            PyErr_Clear();
+            return;
+        }
+    }
+
+    count = PyDict_GetItem(ngx_python_errors, (PyObject *) code);
+
+    n = count ? PyInt_AS_LONG(count) : 0;
+
+    count = PyInt_FromLong(n + 1);
+    if (count == NULL) {
+        PyErr_Clear();
+        return;
+    }
+
+    if (PyDict_SetItem(ngx_python_errors, (PyObject *) code, count) < 0) {
+        PyErr_Clear();
+    }
+
+    Py_DECREF(count);
+}
+
+
+static PyObject *
+ngx_python_errorstats(PyObject *self, PyObject *args)
+{
+    PyObject      *dict, *key, *value, *name;
+    Py_ssize_t     pos;
+    PyCodeObject  *code;
+
+    dict = PyDict_New();
+    if (dict == NULL || ngx_python_errors == NULL) {
+        return dict;
+    }
+
+    pos = 0;
+
+    while (PyDict_Next(ngx_python_errors, &pos, &key, &value)) {
+        code = (PyCodeObject *) key;
+
+        name = PyString_FromFormat("%s:%s:%d",
+                                   PyString_AsString(code->co_filename),
+                                   PyString_AsString(code->co_name),
+                                   code->co_firstlineno);
+        if (name == NULL) {
+            Py_DECREF(dict);
+            return NULL;
+        }
+
+        if (PyDict_SetItem(dict, name, value) < 0) {
+            Py_DECREF(name);
+            Py_DECREF(dict);
+            return NULL;
+        }
+
+        Py_DECREF(name);
+    }
+
+    return dict;
+}
+
+
 static void *
 ngx_python_create_conf(ngx_cycle_t *cycle)
 {
@@ -859,10 +1747,26 @@ ngx_python_create_conf(ngx_cycle_t *cycle)
      * set by ngx_pcalloc():
      *
      *     pcf->ns = NULL;
-     *
+     *     pcf->include_cache = { 0, NULL };
+     *     pcf->thread_pool = NULL;
      */
 
+    if (ngx_array_init(&pcf->batches, cycle->pool, 1,
+                       sizeof(ngx_python_batch_t *))
+        != NGX_OK)
+    {
+        return NULL;
+    }
+
+    ngx_queue_init(&pcf->errors);
+
+    pcf->freeze = NGX_CONF_UNSET;
+    pcf->gc = NGX_CONF_UNSET;
+    pcf->gc_interval = NGX_CONF_UNSET_MSEC;
+    pcf->gc_requests = NGX_CONF_UNSET_UINT;
     pcf->stack_size = NGX_CONF_UNSET_SIZE;
+    pcf->stack_pool_min = NGX_CONF_UNSET_UINT;
+    pcf->stack_pool_max = NGX_CONF_UNSET_UINT;
 
     return pcf;
 }
@@ -873,7 +1777,27 @@ ngx_python_init_conf(ngx_cycle_t *cycle, void *conf)
 {
     ngx_python_conf_t *pcf = conf;
 
+    ngx_conf_init_value(pcf->freeze, 0);
+    ngx_conf_init_value(pcf->gc, 1);
+    ngx_conf_init_msec_value(pcf->gc_interval, 1000);
+    ngx_conf_init_uint_value(pcf->gc_requests, 0);
     ngx_conf_init_size_value(pcf->stack_size, 32768);
+    ngx_conf_init_uint_value(pcf->stack_pool_min, 0);
+    ngx_conf_init_uint_value(pcf->stack_pool_max, 64);
+
+    if (pcf->stack_pool_min > pcf->stack_pool_max) {
+        ngx_log_error(NGX_LOG_EMERG, cycle->log, 0,
+                      "\"python_stack_pool\" minimum is greater than maximum");
+        return NGX_CONF_ERROR;
+    }
+
+    /* workers inherit the configuration namespace by fork() */
+
+    if (Py_IsInitialized()
+        && ngx_python_gc_freeze(cycle, pcf->freeze) != NGX_OK)
+    {
+        return NGX_CONF_ERROR;
+    }
 
     return NGX_CONF_OK;
 }
@@ -882,28 +1806,94 @@ ngx_python_init_conf(ngx_cycle_t *cycle, void *conf)
 static ngx_int_t
 ngx_python_init_worker(ngx_cycle_t *cycle)
 {
-#if !(NGX_PYTHON_SYNC)
-
     ngx_python_conf_t  *pcf;
 
     pcf = (ngx_python_conf_t *) ngx_get_conf(cycle->conf_ctx,
                                              ngx_python_module);
 
-    if (pcf->ns) {
-        if (ngx_python_sleep_install(cycle) != NGX_OK) {
-            return NGX_ERROR;
-        }
+    if (pcf->ns == NULL) {
+        return NGX_OK;
+    }
 
-        if (ngx_python_socket_install(cycle) != NGX_OK) {
-            return NGX_ERROR;
-        }
+    if (ngx_python_gc_install(cycle) != NGX_OK) {
+        return NGX_ERROR;
+    }
 
-        if (ngx_python_resolve_install(cycle) != NGX_OK) {
-            return NGX_ERROR;
-        }
+    if (ngx_python_gc_init(cycle, pcf->gc, pcf->gc_interval, pcf->gc_requests)
+        != NGX_OK)
+    {
+        return NGX_ERROR;
+    }
+
+#if !(NGX_PYTHON_SYNC)
+
+#if (NGX_THREADS)
+    ngx_python_main_thread = pthread_self();
+#endif
+
+    if (ngx_python_stack_init(cycle, pcf->stack_size, pcf->stack_pool_min,
+                              pcf->stack_pool_max)
+        != NGX_OK)
+    {
+        return NGX_ERROR;
+    }
+
+    if (ngx_python_sleep_install(cycle) != NGX_OK) {
+        return NGX_ERROR;
+    }
+
+    if (ngx_python_socket_install(cycle) != NGX_OK) {
+        return NGX_ERROR;
+    }
+
+    if (ngx_python_resolve_install(cycle) != NGX_OK) {
+        return NGX_ERROR;
     }
 
+    if (ngx_python_spawn_install(cycle) != NGX_OK) {
+        return NGX_ERROR;
+    }
+
+#if (NGX_THREADS)
+    if (ngx_python_thread_install(cycle, pcf->thread_pool) != NGX_OK) {
+        return NGX_ERROR;
+    }
+#endif
+
 #endif
 
     return NGX_OK;
 }
+
+
+static void
+ngx_python_exit_worker(ngx_cycle_t *cycle)
+{
+    ngx_uint_t              i;
+    ngx_queue_t            *q;
+    ngx_python_conf_t      *pcf;
+    ngx_python_batch_t    **batch;
+    ngx_python_ctx_conf_t  *conf;
+
+    pcf = (ngx_python_conf_t *) ngx_get_conf(cycle->conf_ctx,
+                                             ngx_python_module);
+
+    batch = pcf->batches.elts;
+
+    for (i = 0; i < pcf->batches.nelts; i++) {
+        ngx_python_batch_flush(batch[i]);
+    }
+
+    /* cancelable timers are not run on exit, log pending counts here */
+
+    while (!ngx_queue_empty(&pcf->errors)) {
+        q = ngx_queue_head(&pcf->errors);
+        conf = ngx_queue_data(q, ngx_python_ctx_conf_t, error_queue);
+
+        if (conf->error_event.timer_set) {
+            ngx_del_timer(&conf->error_event);
+        }
+
+        ngx_python_error_handler(&conf->error_event);
+    }
+}
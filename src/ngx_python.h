@@ -10,30 +10,136 @@
 
 #include <ngx_config.h>
 #include <ngx_core.h>
+#include <ngx_event.h>
+#if (NGX_THREADS)
+#include <ngx_thread_pool.h>
+#endif
 #include <Python.h>
 
 
 #define NGX_PYTHON_AGAIN  (void *) -1
 
-typedef struct ngx_python_ctx_s  ngx_python_ctx_t;
+/* cmd->post of directives which take a callable instead of an expression */
+#define NGX_PYTHON_CALLABLE  (void *) 1
+
+
+#if !(NGX_PYTHON_SYNC)
+
+#ifndef NGX_PYTHON_UCONTEXT
+#if ((__x86_64__ || __aarch64__) && (__GNUC__ || __clang__))
+#define NGX_PYTHON_UCONTEXT  0
+#else
+#define NGX_PYTHON_UCONTEXT  1
+#endif
+#endif
+
+#if (NGX_PYTHON_UCONTEXT)
+#include <ucontext.h>
+#endif
+
+#endif
+
+typedef struct ngx_python_ctx_s    ngx_python_ctx_t;
+typedef struct ngx_python_batch_s  ngx_python_batch_t;
+
+
+typedef struct {
+    size_t                 stack_size;
+    ngx_flag_t             stack_usage;
+    ngx_flag_t             blocking;
+    ngx_msec_t             time_slice;
+    ngx_uint_t             error_limit;
+
+    /* stack high-water mark in the current worker */
+    size_t                 stack_used;
+
+    /* errors logged and suppressed by the current worker this second */
+    time_t                 error_time;
+    ngx_uint_t             errors;
+    ngx_uint_t             errors_suppressed;
+    ngx_event_t            error_event;
+    ngx_queue_t            error_queue;
+} ngx_python_ctx_conf_t;
 
 
 #if !(NGX_PYTHON_SYNC)
 
+typedef struct {
+    u_char                *start;
+    size_t                 size;
+    ngx_queue_t            queue;
+    void                  *pool;
+    unsigned               filled:1;
+} ngx_python_stack_t;
+
+
+#if (NGX_PYTHON_UCONTEXT)
+
+typedef ucontext_t  ngx_python_context_t;
+
+#else
+
+typedef struct ngx_python_context_s  ngx_python_context_t;
+
+struct ngx_python_context_s {
+    void                  *sp;
+    void                 (*func)(void);
+    ngx_python_context_t  *link;
+};
+
+#endif
+
+
 ngx_python_ctx_t *ngx_python_get_ctx();
+#if (NGX_THREADS)
+ngx_uint_t ngx_python_in_thread(void);
+#endif
+ngx_int_t ngx_python_substitute(ngx_cycle_t *cycle, PyObject *m,
+    PyMethodDef *def);
 ngx_int_t ngx_python_yield();
 void ngx_python_wakeup(ngx_python_ctx_t *ctx);
+ngx_python_ctx_t *ngx_python_create_child_ctx(ngx_python_ctx_t *parent);
+void ngx_python_terminate_ctx(ngx_python_ctx_t *ctx);
 
 ngx_int_t ngx_python_sleep_install(ngx_cycle_t *cycle);
 ngx_int_t ngx_python_socket_install(ngx_cycle_t *cycle);
 ngx_int_t ngx_python_resolve_install(ngx_cycle_t *cycle);
+ngx_int_t ngx_python_spawn_install(ngx_cycle_t *cycle);
+#if (NGX_THREADS)
+ngx_int_t ngx_python_thread_install(ngx_cycle_t *cycle,
+    ngx_thread_pool_t *tp);
+#endif
 PyObject *ngx_python_socket_create_wrapper(ngx_connection_t *c);
 
+ngx_int_t ngx_python_stack_init(ngx_cycle_t *cycle, size_t size,
+    ngx_uint_t min, ngx_uint_t max);
+ngx_python_stack_t *ngx_python_stack_alloc(size_t size, ngx_log_t *log);
+void ngx_python_stack_free(ngx_python_stack_t *stack);
+void ngx_python_stack_fill(ngx_python_stack_t *stack);
+size_t ngx_python_stack_used(ngx_python_stack_t *stack);
+
+ngx_int_t ngx_python_context_make(ngx_python_context_t *uc,
+    ngx_python_context_t *link, ngx_python_stack_t *stack, void (*func)(void));
+#if (NGX_PYTHON_UCONTEXT)
+ngx_int_t ngx_python_context_switch(ngx_python_context_t *from,
+    ngx_python_context_t *to);
+#else
+void ngx_python_context_jump(ngx_python_context_t *from,
+    ngx_python_context_t *to);
+#define ngx_python_context_switch(from, to)                                   \
+    (ngx_python_context_jump(from, to), NGX_OK)
+#endif
+
 #endif
 
 ngx_python_ctx_t *ngx_python_create_ctx(ngx_pool_t *pool, ngx_log_t *log);
+void ngx_python_set_ctx_conf(ngx_python_ctx_t *ctx,
+    ngx_python_ctx_conf_t *conf);
+ngx_pool_t *ngx_python_get_pool(ngx_python_ctx_t *ctx);
 PyObject *ngx_python_eval(ngx_python_ctx_t *ctx, PyCodeObject *code,
     ngx_event_t *wake);
+PyObject *ngx_python_call(ngx_python_ctx_t *ctx, PyObject *func,
+    PyObject *args, ngx_event_t *wake);
 void ngx_python_set_resolver(ngx_python_ctx_t *ctx, ngx_resolver_t *resolver,
     ngx_msec_t timeout);
 ngx_resolver_t *ngx_python_get_resolver(ngx_python_ctx_t *ctx,
@@ -48,7 +154,26 @@ char *ngx_python_set_slot(ngx_conf_t *cf, ngx_command_t *cmd, void *conf);
 char *ngx_python_include_set_slot(ngx_conf_t *cf, ngx_command_t *cmd,
     void *conf);
 PyCodeObject *ngx_python_compile(ngx_conf_t *cf, u_char *script);
+PyCodeObject *ngx_python_cache_compile(ngx_conf_t *cf, ngx_str_t *dir,
+    char *file);
+PyObject *ngx_python_get_callable(ngx_conf_t *cf, u_char *name);
+PyObject *ngx_python_conf_handler(ngx_conf_t *cf, ngx_command_t *cmd,
+    u_char *script);
+void ngx_python_decref(void *data);
 ngx_int_t ngx_python_active(ngx_conf_t *cf);
+ngx_int_t ngx_python_add_batch(ngx_conf_t *cf, ngx_python_batch_t *batch);
+ngx_python_batch_t *ngx_python_batch_create(ngx_conf_t *cf, u_char *name,
+    ngx_uint_t size, ngx_msec_t interval);
+ngx_int_t ngx_python_batch_add(ngx_python_batch_t *batch, PyObject *record);
+void ngx_python_batch_flush(ngx_python_batch_t *batch);
+ngx_int_t ngx_python_gc_freeze(ngx_cycle_t *cycle, ngx_flag_t freeze);
+ngx_int_t ngx_python_gc_init(ngx_cycle_t *cycle, ngx_flag_t gc,
+    ngx_msec_t interval, ngx_uint_t requests);
+void ngx_python_gc_request(void);
+ngx_int_t ngx_python_gc_install(ngx_cycle_t *cycle);
+void ngx_python_create_ctx_conf(ngx_python_ctx_conf_t *conf);
+char *ngx_python_merge_ctx_conf(ngx_conf_t *cf, ngx_python_ctx_conf_t *conf,
+    ngx_python_ctx_conf_t *prev);
 
 
 #endif /* _NGX_PYTHON_H_INCLUDED_ */
@@ -0,0 +1,177 @@
+
+/*
+ * Copyright (C) Roman Arutyunyan
+ */
+
+
+#include <Python.h>
+#include <ngx_config.h>
+#include <ngx_core.h>
+#include <ngx_event.h>
+#include "ngx_python.h"
+
+
+/*
+ * A batch collects records in a per-worker list.  The list is passed to
+ * the batch function from a posted event once the batch size is reached
+ * or from a timer once the batch interval has passed since the first
+ * record.  The function is called out of any request or session, and
+ * blocking operations are not allowed in it.  The remaining records are
+ * passed to the function when the worker exits.
+ */
+
+
+struct ngx_python_batch_s {
+    PyObject              *func;
+    PyObject              *records;
+    ngx_uint_t             size;
+    ngx_msec_t             interval;
+    ngx_event_t            event;
+};
+
+
+static void ngx_python_batch_handler(ngx_event_t *ev);
+static void ngx_python_batch_cleanup(void *data);
+
+
+ngx_python_batch_t *
+ngx_python_batch_create(ngx_conf_t *cf, u_char *name, ngx_uint_t size,
+    ngx_msec_t interval)
+{
+    ngx_pool_cleanup_t  *cln;
+    ngx_python_batch_t  *batch;
+
+    batch = ngx_pcalloc(cf->pool, sizeof(ngx_python_batch_t));
+    if (batch == NULL) {
+        return NULL;
+    }
+
+    batch->func = ngx_python_get_callable(cf, name);
+    if (batch->func == NULL) {
+        return NULL;
+    }
+
+    batch->records = PyList_New(0);
+    if (batch->records == NULL) {
+        ngx_conf_log_error(NGX_LOG_EMERG, cf, 0, "python error: %s",
+                           ngx_python_get_error(cf->pool));
+        return NULL;
+    }
+
+    cln = ngx_pool_cleanup_add(cf->pool, 0);
+    if (cln == NULL) {
+        Py_DECREF(batch->records);
+        return NULL;
+    }
+
+    cln->handler = ngx_python_batch_cleanup;
+    cln->data = batch;
+
+    batch->size = size;
+    batch->interval = interval;
+
+    batch->event.handler = ngx_python_batch_handler;
+    batch->event.data = batch;
+    batch->event.log = cf->cycle->log;
+    batch->event.cancelable = 1;
+
+    if (ngx_python_add_batch(cf, batch) != NGX_OK) {
+        return NULL;
+    }
+
+    return batch;
+}
+
+
+ngx_int_t
+ngx_python_batch_add(ngx_python_batch_t *batch, PyObject *record)
+{
+    if (PyList_Append(batch->records, record) < 0) {
+        return NGX_ERROR;
+    }
+
+    if ((ngx_uint_t) PyList_GET_SIZE(batch->records) >= batch->size) {
+        ngx_post_event(&batch->event, &ngx_posted_events);
+
+    } else if (batch->interval && !batch->event.timer_set) {
+        ngx_add_timer(&batch->event, batch->interval);
+    }
+
+    return NGX_OK;
+}
+
+
+void
+ngx_python_batch_flush(ngx_python_batch_t *batch)
+{
+    PyObject    *records, *ret;
+    ngx_log_t   *log;
+    ngx_pool_t  *pool;
+
+    log = batch->event.log;
+
+    if (batch->event.timer_set) {
+        ngx_del_timer(&batch->event);
+    }
+
+    if (batch->event.posted) {
+        ngx_delete_posted_event(&batch->event);
+    }
+
+    if (PyList_GET_SIZE(batch->records) == 0) {
+        return;
+    }
+
+    ngx_log_debug1(NGX_LOG_DEBUG_CORE, log, 0, "python batch flush n:%z",
+                   PyList_GET_SIZE(batch->records));
+
+    records = PyList_New(0);
+    if (records == NULL) {
+        PyErr_Clear();
+        return;
+    }
+
+    /* records added by the function go to the next batch */
+
+    ret = batch->records;
+    batch->records = records;
+    records = ret;
+
+    ret = PyObject_CallFunctionObjArgs(batch->func, records, NULL);
+
+    Py_DECREF(records);
+
+    if (ret) {
+        Py_DECREF(ret);
+        return;
+    }
+
+    pool = ngx_create_pool(NGX_DEFAULT_POOL_SIZE, log);
+    if (pool == NULL) {
+        PyErr_Clear();
+        return;
+    }
+
+    ngx_log_error(NGX_LOG_ERR, log, 0, "python error: %s",
+                  ngx_python_get_error(pool));
+
+    ngx_destroy_pool(pool);
+}
+
+
+static void
+ngx_python_batch_handler(ngx_event_t *ev)
+{
+    ngx_log_debug0(NGX_LOG_DEBUG_CORE, ev->log, 0, "python batch handler");
+
+    ngx_python_batch_flush(ev->data);
+}
+
+
+static void
+ngx_python_batch_cleanup(void *data)
+{
+    ngx_python_batch_t  *batch = data;
+
+    Py_DECREF(batch->records);
+}
@@ -0,0 +1,339 @@
+
+/*
+ * Copyright (C) Roman Arutyunyan
+ */
+
+
+#include <Python.h>
+#include <marshal.h>
+#include <ngx_config.h>
+#include <ngx_core.h>
+#include <ngx_md5.h>
+#include "ngx_python.h"
+
+
+/*
+ * Code objects compiled from python_include files are marshalled to
+ * the cache directory.  The cache file name is the MD5 hash of the source
+ * file path.  The cache file holds a tuple of the Python magic number,
+ * source file mtime, size and path, followed by the code object.  Cached
+ * code is only used if all of them match.
+ */
+
+
+static PyCodeObject *ngx_python_cache_read(ngx_conf_t *cf, u_char *name,
+    char *file, time_t mtime, off_t size);
+static void ngx_python_cache_write(ngx_conf_t *cf, u_char *name, char *file,
+    time_t mtime, off_t size, PyCodeObject *code);
+static PyCodeObject *ngx_python_cache_parse(ngx_conf_t *cf, ngx_fd_t fd,
+    char *file, off_t size);
+static uint64_t ngx_python_cache_usec(void);
+
+
+PyCodeObject *
+ngx_python_cache_compile(ngx_conf_t *cf, ngx_str_t *dir, char *file)
+{
+    u_char           *p, *name, hash[16];
+    off_t             size;
+    time_t            mtime;
+    ngx_fd_t          fd;
+    ngx_md5_t         md5;
+    PyCodeObject     *code;
+    uint64_t          start;
+    ngx_file_info_t   fi;
+
+    fd = ngx_open_file(file, NGX_FILE_RDONLY, NGX_FILE_OPEN, 0);
+    if (fd == NGX_INVALID_FILE) {
+        ngx_conf_log_error(NGX_LOG_EMERG, cf, ngx_errno,
+                           ngx_open_file_n " \"%s\" failed", file);
+        return NULL;
+    }
+
+    code = NULL;
+
+    if (ngx_fd_info(fd, &fi) == NGX_FILE_ERROR) {
+        ngx_conf_log_error(NGX_LOG_EMERG, cf, ngx_errno,
+                           ngx_fd_info_n " \"%s\" failed", file);
+        goto done;
+    }
+
+    mtime = ngx_file_mtime(&fi);
+    size = ngx_file_size(&fi);
+
+    name = ngx_pnalloc(cf->temp_pool, dir->len + 1 + 2 * 16 + sizeof(".pyc"));
+    if (name == NULL) {
+        goto done;
+    }
+
+    ngx_md5_init(&md5);
+    ngx_md5_update(&md5, file, ngx_strlen(file));
+    ngx_md5_final(hash, &md5);
+
+    p = ngx_cpymem(name, dir->data, dir->len);
+    *p++ = '/';
+    p = ngx_hex_dump(p, hash, 16);
+    ngx_memcpy(p, ".pyc", sizeof(".pyc"));
+
+    start = ngx_python_cache_usec();
+
+    code = ngx_python_cache_read(cf, name, file, mtime, size);
+
+    if (code) {
+        ngx_log_debug3(NGX_LOG_DEBUG_CORE, cf->log, 0,
+                       "python include cache hit \"%s\" \"%s\" time:%uLus",
+                       file, name, ngx_python_cache_usec() - start);
+        goto done;
+    }
+
+    code = ngx_python_cache_parse(cf, fd, file, size);
+    if (code == NULL) {
+        goto done;
+    }
+
+    ngx_log_debug3(NGX_LOG_DEBUG_CORE, cf->log, 0,
+                   "python include cache miss \"%s\" \"%s\" "
+                   "compile time:%uLus",
+                   file, name, ngx_python_cache_usec() - start);
+
+    ngx_python_cache_write(cf, name, file, mtime, size, code);
+
+done:
+
+    if (ngx_close_file(fd) == NGX_FILE_ERROR) {
+        ngx_log_error(NGX_LOG_ALERT, cf->log, ngx_errno,
+                      ngx_close_file_n " \"%s\" failed", file);
+    }
+
+    return code;
+}
+
+
+static PyCodeObject *
+ngx_python_cache_read(ngx_conf_t *cf, u_char *name, char *file, time_t mtime,
+    off_t size)
+{
+    char             *path;
+    long              magic;
+    u_char           *buf;
+    off_t             len;
+    ssize_t           n;
+    ngx_fd_t          fd;
+    PyObject         *obj, *code;
+    PY_LONG_LONG      cmtime, csize;
+    ngx_file_info_t   fi;
+
+    fd = ngx_open_file(name, NGX_FILE_RDONLY, NGX_FILE_OPEN, 0);
+    if (fd == NGX_INVALID_FILE) {
+        return NULL;
+    }
+
+    buf = NULL;
+    code = NULL;
+
+    if (ngx_fd_info(fd, &fi) == NGX_FILE_ERROR) {
+        ngx_log_error(NGX_LOG_WARN, cf->log, ngx_errno,
+                      ngx_fd_info_n " \"%s\" failed", name);
+        goto done;
+    }
+
+    len = ngx_file_size(&fi);
+
+    buf = ngx_alloc(len, cf->log);
+    if (buf == NULL) {
+        goto done;
+    }
+
+    n = ngx_read_fd(fd, buf, len);
+
+    if (n != len) {
+        ngx_log_error(NGX_LOG_WARN, cf->log, ngx_errno,
+                      ngx_read_fd_n " \"%s\" returned %z bytes instead of %O",
+                      name, n, len);
+        goto done;
+    }
+
+    obj = PyMarshal_ReadObjectFromString((char *) buf, len);
+    if (obj == NULL) {
+        PyErr_Clear();
+        goto done;
+    }
+
+    if (!PyTuple_Check(obj)
+        || !PyArg_ParseTuple(obj, "lLLsO", &magic, &cmtime, &csize, &path,
+                             &code))
+    {
+        PyErr_Clear();
+        Py_DECREF(obj);
+        code = NULL;
+        goto done;
+    }
+
+    if (magic != PyImport_GetMagicNumber()
+        || cmtime != (PY_LONG_LONG) mtime
+        || csize != (PY_LONG_LONG) size
+        || ngx_strcmp(path, file) != 0
+        || !PyCode_Check(code))
+    {
+        ngx_log_debug1(NGX_LOG_DEBUG_CORE, cf->log, 0,
+                       "python include cache stale \"%s\"", name);
+        Py_DECREF(obj);
+        code = NULL;
+        goto done;
+    }
+
+    Py_INCREF(code);
+    Py_DECREF(obj);
+
+done:
+
+    if (buf) {
+        ngx_free(buf);
+    }
+
+    if (ngx_close_file(fd) == NGX_FILE_ERROR) {
+        ngx_log_error(NGX_LOG_ALERT, cf->log, ngx_errno,
+                      ngx_close_file_n " \"%s\" failed", name);
+    }
+
+    return (PyCodeObject *) code;
+}
+
+
+static void
+ngx_python_cache_write(ngx_conf_t *cf, u_char *name, char *file, time_t mtime,
+    off_t size, PyCodeObject *code)
+{
+    u_char    *temp;
+    ssize_t    n;
+    ngx_fd_t   fd;
+    PyObject  *obj, *data;
+
+    /*
+     * The cache file is written to a temporary file and renamed, so that
+     * concurrent configuration loads never see a partially written file.
+     * Failures are not fatal, the code is compiled again next time.
+     */
+
+    obj = Py_BuildValue("(lLLsO)", PyImport_GetMagicNumber(),
+                        (PY_LONG_LONG) mtime, (PY_LONG_LONG) size, file,
+                        (PyObject *) code);
+    if (obj == NULL) {
+        PyErr_Clear();
+        return;
+    }
+
+    data = PyMarshal_WriteObjectToString(obj, Py_MARSHAL_VERSION);
+
+    Py_DECREF(obj);
+
+    if (data == NULL) {
+        PyErr_Clear();
+        return;
+    }
+
+    temp = ngx_pnalloc(cf->temp_pool,
+                       ngx_strlen(name) + 1 + NGX_INT64_LEN + 1);
+    if (temp == NULL) {
+        goto done;
+    }
+
+    ngx_sprintf(temp, "%s.%P%Z", name, ngx_pid);
+
+    fd = ngx_open_file(temp, NGX_FILE_WRONLY, NGX_FILE_TRUNCATE,
+                       NGX_FILE_DEFAULT_ACCESS);
+    if (fd == NGX_INVALID_FILE) {
+        ngx_log_error(NGX_LOG_WARN, cf->log, ngx_errno,
+                      ngx_open_file_n " \"%s\" failed", temp);
+        goto done;
+    }
+
+    n = ngx_write_fd(fd, PyString_AS_STRING(data), PyString_GET_SIZE(data));
+
+    if (n != PyString_GET_SIZE(data)) {
+        ngx_log_error(NGX_LOG_WARN, cf->log, ngx_errno,
+                      ngx_write_fd_n " \"%s\" failed", temp);
+        goto failed;
+    }
+
+    if (ngx_close_file(fd) == NGX_FILE_ERROR) {
+        ngx_log_error(NGX_LOG_WARN, cf->log, ngx_errno,
+                      ngx_close_file_n " \"%s\" failed", temp);
+        goto remove;
+    }
+
+    if (ngx_rename_file(temp, name) == NGX_FILE_ERROR) {
+        ngx_log_error(NGX_LOG_WARN, cf->log, ngx_errno,
+                      ngx_rename_file_n " \"%s\" to \"%s\" failed",
+                      temp, name);
+        goto remove;
+    }
+
+    goto done;
+
+failed:
+
+    if (ngx_close_file(fd) == NGX_FILE_ERROR) {
+        ngx_log_error(NGX_LOG_ALERT, cf->log, ngx_errno,
+                      ngx_close_file_n " \"%s\" failed", temp);
+    }
+
+remove:
+
+    if (ngx_delete_file(temp) == NGX_FILE_ERROR) {
+        ngx_log_error(NGX_LOG_ALERT, cf->log, ngx_errno,
+                      ngx_delete_file_n " \"%s\" failed", temp);
+    }
+
+done:
+
+    Py_DECREF(data);
+}
+
+
+static PyCodeObject *
+ngx_python_cache_parse(ngx_conf_t *cf, ngx_fd_t fd, char *file, off_t size)
+{
+    u_char    *buf;
+    ssize_t    n;
+    PyObject  *code;
+
+    buf = ngx_alloc(size + 1, cf->log);
+    if (buf == NULL) {
+        return NULL;
+    }
+
+    n = ngx_read_fd(fd, buf, size);
+
+    if (n != size) {
+        ngx_conf_log_error(NGX_LOG_EMERG, cf, ngx_errno,
+                           ngx_read_fd_n " \"%s\" returned %z bytes "
+                           "instead of %O", file, n, size);
+        ngx_free(buf);
+        return NULL;
+    }
+
+    buf[size] = '\0';
+
+    code = Py_CompileString((char *) buf, file, Py_file_input);
+
+    ngx_free(buf);
+
+    if (code == NULL) {
+        ngx_conf_log_error(NGX_LOG_EMERG, cf, 0, "python error: %s",
+                           ngx_python_get_error(cf->pool));
+        return NULL;
+    }
+
+    return (PyCodeObject *) code;
+}
+
+
+static uint64_t
+ngx_python_cache_usec(void)
+{
+    struct timeval  tv;
+
+    ngx_gettimeofday(&tv);
+
+    return (uint64_t) tv.tv_sec * 1000000 + tv.tv_usec;
+}
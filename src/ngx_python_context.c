@@ -0,0 +1,224 @@
+
+/*
+ * Copyright (C) Roman Arutyunyan
+ */
+
+
+#include <Python.h>
+#include <ngx_config.h>
+#include <ngx_core.h>
+#include "ngx_python.h"
+
+
+#if !(NGX_PYTHON_SYNC)
+
+#if (NGX_PYTHON_UCONTEXT)
+
+ngx_int_t
+ngx_python_context_make(ngx_python_context_t *uc, ngx_python_context_t *link,
+    ngx_python_stack_t *stack, void (*func)(void))
+{
+    if (getcontext(uc) == -1) {
+        return NGX_ERROR;
+    }
+
+    uc->uc_stack.ss_size = stack->size;
+    uc->uc_stack.ss_sp = stack->start;
+    uc->uc_link = link;
+
+    makecontext(uc, func, 0);
+
+    return NGX_OK;
+}
+
+
+ngx_int_t
+ngx_python_context_switch(ngx_python_context_t *from, ngx_python_context_t *to)
+{
+    if (swapcontext(from, to) == -1) {
+        return NGX_ERROR;
+    }
+
+    return NGX_OK;
+}
+
+#else
+
+/*
+ * Unlike swapcontext(), which saves and restores the signal mask with
+ * a system call on each switch, the functions below only save callee-saved
+ * registers on the current stack and switch stack pointers.  This is enough
+ * since a switch always happens at a function call boundary.
+ *
+ * A new context is prepared to look like a suspended one, with
+ * ngx_python_context_trampoline() as the return address.  The trampoline
+ * calls ngx_python_context_entry() with the context as an argument.
+ */
+
+
+#if (__APPLE__)
+#define NGX_PYTHON_SYMBOL(name)  "_" #name
+#define NGX_PYTHON_HIDDEN(name)  ".private_extern _" #name "\n"
+#else
+#define NGX_PYTHON_SYMBOL(name)  #name
+#define NGX_PYTHON_HIDDEN(name)  ".hidden " #name "\n"
+#endif
+
+
+void ngx_python_context_trampoline(void);
+static void ngx_python_context_entry(ngx_python_context_t *uc);
+
+
+#if (__x86_64__)
+
+/*
+ * saved on stack: mxcsr and x87 control word, r15, r14, r13, r12, rbx, rbp,
+ * return address
+ */
+
+#define NGX_PYTHON_CONTEXT_FRAME  8
+
+__asm__ (
+    ".text\n"
+    ".globl " NGX_PYTHON_SYMBOL(ngx_python_context_jump) "\n"
+    NGX_PYTHON_HIDDEN(ngx_python_context_jump)
+    ".p2align 4\n"
+    NGX_PYTHON_SYMBOL(ngx_python_context_jump) ":\n"
+    "    pushq  %rbp\n"
+    "    pushq  %rbx\n"
+    "    pushq  %r12\n"
+    "    pushq  %r13\n"
+    "    pushq  %r14\n"
+    "    pushq  %r15\n"
+    "    subq   $8, %rsp\n"
+    "    stmxcsr (%rsp)\n"
+    "    fnstcw 4(%rsp)\n"
+    "    movq   %rsp, (%rdi)\n"
+    "    movq   (%rsi), %rsp\n"
+    "    ldmxcsr (%rsp)\n"
+    "    fldcw  4(%rsp)\n"
+    "    addq   $8, %rsp\n"
+    "    popq   %r15\n"
+    "    popq   %r14\n"
+    "    popq   %r13\n"
+    "    popq   %r12\n"
+    "    popq   %rbx\n"
+    "    popq   %rbp\n"
+    "    ret\n"
+
+    ".globl " NGX_PYTHON_SYMBOL(ngx_python_context_trampoline) "\n"
+    NGX_PYTHON_HIDDEN(ngx_python_context_trampoline)
+    ".p2align 4\n"
+    NGX_PYTHON_SYMBOL(ngx_python_context_trampoline) ":\n"
+    "    movq   %r12, %rdi\n"
+    "    callq  *%r13\n"
+    "    ud2\n"
+);
+
+#elif (__aarch64__)
+
+/* saved on stack: x19-x30, d8-d15 */
+
+#define NGX_PYTHON_CONTEXT_FRAME  20
+
+__asm__ (
+    ".text\n"
+    ".globl " NGX_PYTHON_SYMBOL(ngx_python_context_jump) "\n"
+    NGX_PYTHON_HIDDEN(ngx_python_context_jump)
+    ".p2align 4\n"
+    NGX_PYTHON_SYMBOL(ngx_python_context_jump) ":\n"
+    "    sub    sp, sp, #160\n"
+    "    stp    x19, x20, [sp, #0]\n"
+    "    stp    x21, x22, [sp, #16]\n"
+    "    stp    x23, x24, [sp, #32]\n"
+    "    stp    x25, x26, [sp, #48]\n"
+    "    stp    x27, x28, [sp, #64]\n"
+    "    stp    x29, x30, [sp, #80]\n"
+    "    stp    d8, d9, [sp, #96]\n"
+    "    stp    d10, d11, [sp, #112]\n"
+    "    stp    d12, d13, [sp, #128]\n"
+    "    stp    d14, d15, [sp, #144]\n"
+    "    mov    x9, sp\n"
+    "    str    x9, [x0]\n"
+    "    ldr    x9, [x1]\n"
+    "    mov    sp, x9\n"
+    "    ldp    x19, x20, [sp, #0]\n"
+    "    ldp    x21, x22, [sp, #16]\n"
+    "    ldp    x23, x24, [sp, #32]\n"
+    "    ldp    x25, x26, [sp, #48]\n"
+    "    ldp    x27, x28, [sp, #64]\n"
+    "    ldp    x29, x30, [sp, #80]\n"
+    "    ldp    d8, d9, [sp, #96]\n"
+    "    ldp    d10, d11, [sp, #112]\n"
+    "    ldp    d12, d13, [sp, #128]\n"
+    "    ldp    d14, d15, [sp, #144]\n"
+    "    add    sp, sp, #160\n"
+    "    ret\n"
+
+    ".globl " NGX_PYTHON_SYMBOL(ngx_python_context_trampoline) "\n"
+    NGX_PYTHON_HIDDEN(ngx_python_context_trampoline)
+    ".p2align 4\n"
+    NGX_PYTHON_SYMBOL(ngx_python_context_trampoline) ":\n"
+    "    mov    x0, x19\n"
+    "    blr    x20\n"
+    "    brk    #0\n"
+);
+
+#else
+
+#error "native context switch is not supported on this platform, \
+use -DNGX_PYTHON_UCONTEXT=1"
+
+#endif
+
+
+ngx_int_t
+ngx_python_context_make(ngx_python_context_t *uc, ngx_python_context_t *link,
+    ngx_python_stack_t *stack, void (*func)(void))
+{
+    uintptr_t  *sp;
+
+    sp = (uintptr_t *) ngx_align_ptr(stack->start + stack->size
+                                     - NGX_PYTHON_CONTEXT_FRAME
+                                       * sizeof(uintptr_t) - 15, 16);
+
+    ngx_memzero(sp, NGX_PYTHON_CONTEXT_FRAME * sizeof(uintptr_t));
+
+#if (__x86_64__)
+
+    /* default mxcsr and x87 control word */
+    sp[0] = 0x1f80 | ((uintptr_t) 0x037f << 32);
+
+    sp[3] = (uintptr_t) ngx_python_context_entry;                /* r13 */
+    sp[4] = (uintptr_t) uc;                                      /* r12 */
+    sp[7] = (uintptr_t) ngx_python_context_trampoline;           /* ret */
+
+#elif (__aarch64__)
+
+    sp[0] = (uintptr_t) uc;                                      /* x19 */
+    sp[1] = (uintptr_t) ngx_python_context_entry;                /* x20 */
+    sp[11] = (uintptr_t) ngx_python_context_trampoline;          /* x30 */
+
+#endif
+
+    uc->sp = sp;
+    uc->func = func;
+    uc->link = link;
+
+    return NGX_OK;
+}
+
+
+static void
+ngx_python_context_entry(ngx_python_context_t *uc)
+{
+    uc->func();
+
+    /* a finished context is never resumed */
+
+    ngx_python_context_jump(uc, uc->link);
+}
+
+#endif
+
+#endif
@@ -0,0 +1,471 @@
+
+/*
+ * Copyright (C) Roman Arutyunyan
+ */
+
+
+#include <Python.h>
+#include <ngx_config.h>
+#include <ngx_core.h>
+#include <ngx_event.h>
+#include "ngx_python.h"
+
+
+/*
+ * Objects which survive a full collection after configuration load are
+ * moved from the oldest GC generation to the list of frozen objects,
+ * similar to gc.freeze() in Python 3.7.  Collections in workers never
+ * traverse frozen objects and do not write to the memory pages holding
+ * them, so these pages stay shared with the master process.
+ *
+ * Python 2.7 does not export GC generations except for the youngest one.
+ * The generations layout is mirrored from Modules/gcmodule.c.
+ *
+ * With python_gc disabled, automatic collection is turned off in workers.
+ * Instead, collections are run by a timer and after a number of requests
+ * from the event loop, never in the middle of a handler.  As Python does,
+ * the oldest generation whose allocation count exceeds its threshold is
+ * collected, which keeps most collections young and short.
+ */
+
+
+typedef struct {
+    PyGC_Head              head;
+    int                    threshold;
+    int                    count;
+} ngx_python_gc_generation_t;
+
+
+typedef struct {
+    char                  *name;
+    char                  *key;
+} ngx_python_meminfo_field_t;
+
+
+typedef struct {
+    ngx_uint_t             collections;
+    ngx_uint_t             collected;
+    ngx_uint_t             frozen;
+    uint64_t               pause_total;
+    uint64_t               pause_max;
+    uint64_t               pause_last;
+} ngx_python_gc_stats_t;
+
+
+#define NGX_PYTHON_GC_OLDEST  2
+
+
+static void ngx_python_gc_list_merge(PyGC_Head *from, PyGC_Head *to);
+static void ngx_python_gc_handler(ngx_event_t *ev);
+static ngx_int_t ngx_python_gc_collect(ngx_log_t *log);
+static uint64_t ngx_python_gc_usec(void);
+static PyObject *ngx_python_gcstats(PyObject *self, PyObject *args);
+static PyObject *ngx_python_meminfo(PyObject *self, PyObject *args);
+
+
+static PyMethodDef ngx_python_gcstats_function = {
+    "gcstats",
+    (PyCFunction) ngx_python_gcstats,
+    METH_NOARGS,
+    "return scheduled garbage collection statistics"
+};
+
+
+static PyMethodDef ngx_python_meminfo_function = {
+    "meminfo",
+    (PyCFunction) ngx_python_meminfo,
+    METH_NOARGS,
+    "return worker shared and private memory size"
+};
+
+
+static ngx_python_meminfo_field_t  ngx_python_meminfo_fields[] = {
+    { "Rss", "rss" },
+    { "Pss", "pss" },
+    { "Shared_Clean", "shared_clean" },
+    { "Shared_Dirty", "shared_dirty" },
+    { "Private_Clean", "private_clean" },
+    { "Private_Dirty", "private_dirty" },
+    { "Swap", "swap" },
+    { NULL, NULL }
+};
+
+
+static PyGC_Head              ngx_python_gc_frozen;
+
+static PyObject              *ngx_python_gc_module;
+static ngx_event_t            ngx_python_gc_event;
+static ngx_msec_t             ngx_python_gc_interval;
+static ngx_uint_t             ngx_python_gc_requests;
+static ngx_uint_t             ngx_python_gc_nrequests;
+static ngx_python_gc_stats_t  ngx_python_gc_stats;
+
+
+ngx_int_t
+ngx_python_gc_freeze(ngx_cycle_t *cycle, ngx_flag_t freeze)
+{
+    PyGC_Head                   *old, *gc;
+    ngx_uint_t                   n;
+    ngx_python_gc_generation_t  *gen;
+
+    gen = (ngx_python_gc_generation_t *) _PyGC_generation0;
+    old = &gen[NGX_PYTHON_GC_OLDEST].head;
+
+    if (old->gc.gc_next->gc.gc_prev != old
+        || old->gc.gc_prev->gc.gc_next != old)
+    {
+        ngx_log_error(NGX_LOG_EMERG, cycle->log, 0,
+                      "unexpected Python GC generations layout");
+        return NGX_ERROR;
+    }
+
+    if (ngx_python_gc_frozen.gc.gc_next == NULL) {
+        ngx_python_gc_frozen.gc.gc_next = &ngx_python_gc_frozen;
+        ngx_python_gc_frozen.gc.gc_prev = &ngx_python_gc_frozen;
+    }
+
+    /*
+     * objects frozen by the previous configuration are unfrozen
+     * to let garbage left by it be collected
+     */
+
+    ngx_python_gc_list_merge(&ngx_python_gc_frozen, old);
+
+    ngx_python_gc_stats.frozen = 0;
+
+    if (!freeze) {
+        return NGX_OK;
+    }
+
+    (void) PyGC_Collect();
+
+    ngx_python_gc_list_merge(&gen[0].head, old);
+    ngx_python_gc_list_merge(&gen[1].head, old);
+
+    n = 0;
+
+    for (gc = old->gc.gc_next; gc != old; gc = gc->gc.gc_next) {
+        n++;
+    }
+
+    ngx_python_gc_list_merge(old, &ngx_python_gc_frozen);
+
+    ngx_python_gc_stats.frozen = n;
+
+    ngx_log_error(NGX_LOG_INFO, cycle->log, 0, "python froze %ui objects", n);
+
+    return NGX_OK;
+}
+
+
+static void
+ngx_python_gc_list_merge(PyGC_Head *from, PyGC_Head *to)
+{
+    PyGC_Head  *tail;
+
+    if (from->gc.gc_next != from) {
+        tail = to->gc.gc_prev;
+        tail->gc.gc_next = from->gc.gc_next;
+        tail->gc.gc_next->gc.gc_prev = tail;
+        to->gc.gc_prev = from->gc.gc_prev;
+        to->gc.gc_prev->gc.gc_next = to;
+    }
+
+    from->gc.gc_next = from;
+    from->gc.gc_prev = from;
+}
+
+
+ngx_int_t
+ngx_python_gc_init(ngx_cycle_t *cycle, ngx_flag_t gc, ngx_msec_t interval,
+    ngx_uint_t requests)
+{
+    PyObject  *ret;
+
+    if (gc) {
+        return NGX_OK;
+    }
+
+    ngx_python_gc_module = PyImport_ImportModule("gc");
+    if (ngx_python_gc_module == NULL) {
+        return NGX_ERROR;
+    }
+
+    ret = PyObject_CallMethod(ngx_python_gc_module, "disable", NULL);
+    if (ret == NULL) {
+        return NGX_ERROR;
+    }
+
+    Py_DECREF(ret);
+
+    ngx_python_gc_interval = interval;
+    ngx_python_gc_requests = requests;
+
+    ngx_python_gc_event.handler = ngx_python_gc_handler;
+    ngx_python_gc_event.log = cycle->log;
+    ngx_python_gc_event.cancelable = 1;
+
+    if (interval) {
+        ngx_add_timer(&ngx_python_gc_event, interval);
+    }
+
+    ngx_log_debug2(NGX_LOG_DEBUG_CORE, cycle->log, 0,
+                   "python gc scheduled interval:%M requests:%ui",
+                   interval, requests);
+
+    return NGX_OK;
+}
+
+
+void
+ngx_python_gc_request(void)
+{
+    if (ngx_python_gc_requests == 0) {
+        return;
+    }
+
+    if (++ngx_python_gc_nrequests < ngx_python_gc_requests) {
+        return;
+    }
+
+    ngx_python_gc_nrequests = 0;
+
+    ngx_post_event(&ngx_python_gc_event, &ngx_posted_events);
+}
+
+
+static void
+ngx_python_gc_handler(ngx_event_t *ev)
+{
+    ngx_pool_t  *pool;
+
+    ngx_log_debug0(NGX_LOG_DEBUG_CORE, ev->log, 0, "python gc handler");
+
+    if (ngx_python_gc_collect(ev->log) != NGX_OK) {
+        pool = ngx_create_pool(NGX_DEFAULT_POOL_SIZE, ev->log);
+
+        if (pool == NULL) {
+            PyErr_Clear();
+
+        } else {
+            ngx_log_error(NGX_LOG_ERR, ev->log, 0, "python gc error: %s",
+                          ngx_python_get_error(pool));
+
+            ngx_destroy_pool(pool);
+        }
+    }
+
+    if (ngx_python_gc_interval) {
+        ngx_add_timer(ev, ngx_python_gc_interval);
+    }
+}
+
+
+static ngx_int_t
+ngx_python_gc_collect(ngx_log_t *log)
+{
+    long       n, count[3], threshold[3];
+    uint64_t   start, pause;
+    PyObject  *ret;
+    ngx_int_t  gen;
+
+    ret = PyObject_CallMethod(ngx_python_gc_module, "get_count", NULL);
+    if (ret == NULL) {
+        return NGX_ERROR;
+    }
+
+    if (!PyArg_ParseTuple(ret, "lll", &count[0], &count[1], &count[2])) {
+        Py_DECREF(ret);
+        return NGX_ERROR;
+    }
+
+    Py_DECREF(ret);
+
+    ret = PyObject_CallMethod(ngx_python_gc_module, "get_threshold", NULL);
+    if (ret == NULL) {
+        return NGX_ERROR;
+    }
+
+    if (!PyArg_ParseTuple(ret, "lll", &threshold[0], &threshold[1],
+                          &threshold[2]))
+    {
+        Py_DECREF(ret);
+        return NGX_ERROR;
+    }
+
+    Py_DECREF(ret);
+
+    for (gen = NGX_PYTHON_GC_OLDEST; gen >= 0; gen--) {
+        if (count[gen] > threshold[gen]) {
+            break;
+        }
+    }
+
+    if (gen < 0) {
+        return NGX_OK;
+    }
+
+    start = ngx_python_gc_usec();
+
+    ret = PyObject_CallMethod(ngx_python_gc_module, "collect", "i", (int) gen);
+    if (ret == NULL) {
+        return NGX_ERROR;
+    }
+
+    pause = ngx_python_gc_usec() - start;
+
+    n = PyInt_Check(ret) ? PyInt_AS_LONG(ret) : 0;
+
+    Py_DECREF(ret);
+
+    ngx_python_gc_stats.collections++;
+    ngx_python_gc_stats.collected += n;
+    ngx_python_gc_stats.pause_total += pause;
+    ngx_python_gc_stats.pause_last = pause;
+
+    if (pause > ngx_python_gc_stats.pause_max) {
+        ngx_python_gc_stats.pause_max = pause;
+    }
+
+    ngx_log_debug3(NGX_LOG_DEBUG_CORE, log, 0,
+                   "python gc generation:%i collected:%l time:%uLus",
+                   gen, n, pause);
+
+    return NGX_OK;
+}
+
+
+static uint64_t
+ngx_python_gc_usec(void)
+{
+    struct timeval  tv;
+
+    ngx_gettimeofday(&tv);
+
+    return (uint64_t) tv.tv_sec * 1000000 + tv.tv_usec;
+}
+
+
+static PyObject *
+ngx_python_gcstats(PyObject *self, PyObject *args)
+{
+    ngx_python_gc_stats_t  *st;
+
+    st = &ngx_python_gc_stats;
+
+    return Py_BuildValue("{s:k,s:k,s:k,s:K,s:K,s:K}",
+                         "collections", (unsigned long) st->collections,
+                         "collected", (unsigned long) st->collected,
+                         "frozen", (unsigned long) st->frozen,
+                         "pause_total",
+                         (unsigned PY_LONG_LONG) st->pause_total,
+                         "pause_max", (unsigned PY_LONG_LONG) st->pause_max,
+                         "pause_last", (unsigned PY_LONG_LONG) st->pause_last);
+}
+
+
+static PyObject *
+ngx_python_meminfo(PyObject *self, PyObject *args)
+{
+    char                        *file, line[256], name[64];
+    FILE                        *fp;
+    PyObject                    *dict, *value;
+    ngx_uint_t                   i;
+    unsigned long                kb;
+    unsigned long long           sizes[sizeof(ngx_python_meminfo_fields)
+                                       / sizeof(ngx_python_meminfo_field_t)];
+    ngx_python_meminfo_field_t  *f;
+
+    /* smaps_rollup sums up smaps and is only available since Linux 4.14 */
+
+    file = "/proc/self/smaps_rollup";
+
+    fp = fopen(file, "r");
+
+    if (fp == NULL) {
+        file = "/proc/self/smaps";
+
+        fp = fopen(file, "r");
+        if (fp == NULL) {
+            return PyErr_SetFromErrnoWithFilename(PyExc_OSError, file);
+        }
+    }
+
+    ngx_memzero(sizes, sizeof(sizes));
+
+    while (fgets(line, sizeof(line), fp)) {
+        if (sscanf(line, "%63[A-Za-z_]: %lu kB", name, &kb) != 2) {
+            continue;
+        }
+
+        for (i = 0, f = ngx_python_meminfo_fields; f->name; i++, f++) {
+            if (ngx_strcmp(name, f->name) == 0) {
+                sizes[i] += kb * 1024;
+                break;
+            }
+        }
+    }
+
+    fclose(fp);
+
+    dict = PyDict_New();
+    if (dict == NULL) {
+        return NULL;
+    }
+
+    for (i = 0, f = ngx_python_meminfo_fields; f->name; i++, f++) {
+        value = PyLong_FromUnsignedLongLong(sizes[i]);
+        if (value == NULL) {
+            Py_DECREF(dict);
+            return NULL;
+        }
+
+        if (PyDict_SetItemString(dict, f->key, value) < 0) {
+            Py_DECREF(value);
+            Py_DECREF(dict);
+            return NULL;
+        }
+
+        Py_DECREF(value);
+    }
+
+    return dict;
+}
+
+
+ngx_int_t
+ngx_python_gc_install(ngx_cycle_t *cycle)
+{
+    PyObject     *m, *fun;
+    PyMethodDef  *def, *defs[] = { &ngx_python_gcstats_function,
+                                   &ngx_python_meminfo_function,
+                                   NULL };
+    ngx_uint_t    i;
+
+    m = PyImport_ImportModule("ngx");
+    if (m == NULL) {
+        return NGX_ERROR;
+    }
+
+    for (i = 0; defs[i]; i++) {
+        def = defs[i];
+
+        fun = PyCFunction_NewEx(def, NULL, NULL);
+        if (fun == NULL) {
+            Py_DECREF(m);
+            return NGX_ERROR;
+        }
+
+        if (PyObject_SetAttrString(m, def->ml_name, fun) < 0) {
+            Py_DECREF(fun);
+            Py_DECREF(m);
+            return NGX_ERROR;
+        }
+
+        Py_DECREF(fun);
+    }
+
+    Py_DECREF(m);
+
+    return NGX_OK;
+}
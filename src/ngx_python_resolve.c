@@ -796,7 +796,7 @@ ngx_python_resolve_set_gaierror(int gerr, char *msg)
 ngx_int_t
 ngx_python_resolve_install(ngx_cycle_t *cycle)
 {
-    PyObject     *sm, *fun, *socket_error;
+    PyObject     *sm, *socket_error;
     PyMethodDef  *fn;
 
     sm = PyImport_ImportModule("socket");
@@ -836,20 +836,10 @@ ngx_python_resolve_install(ngx_cycle_t *cycle)
     }
 
     for (fn = ngx_python_resolve_functions; fn->ml_name; fn++) {
-
-        fun = PyCFunction_NewEx(fn, NULL, NULL);
-        if (fun == NULL) {
-            Py_DECREF(sm);
-            return NGX_ERROR;
-        }
-
-        if (PyObject_SetAttrString(sm, fn->ml_name, fun) < 0) {
-            Py_DECREF(fun);
+        if (ngx_python_substitute(cycle, sm, fn) != NGX_OK) {
             Py_DECREF(sm);
             return NGX_ERROR;
         }
-
-        Py_DECREF(fun);
     }
 
     Py_DECREF(sm);
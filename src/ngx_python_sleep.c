@@ -42,6 +42,10 @@ ngx_python_sleep(PyObject *self, PyObject *args)
     ngx_memzero(&c, sizeof(ngx_connection_t));
 
     c.data = ngx_python_get_ctx();
+    if (c.data == NULL) {
+        PyErr_SetString(PyExc_RuntimeError, "blocking calls are not allowed");
+        return NULL;
+    }
 
     ngx_memzero(&event, sizeof(ngx_event_t));
 
@@ -81,28 +85,18 @@ ngx_python_sleep_handler(ngx_event_t *ev)
 ngx_int_t
 ngx_python_sleep_install(ngx_cycle_t *cycle)
 {
-    PyObject  *sleep, *tm;
+    PyObject   *tm;
+    ngx_int_t   rc;
 
     tm = PyImport_ImportModule("time");
     if (tm == NULL) {
         return NGX_ERROR;
     }
 
-    sleep = PyCFunction_NewEx(&ngx_python_sleep_function, NULL, NULL);
-    if (sleep == NULL) {
-        Py_DECREF(tm);
-        return NGX_ERROR;
-    }
-
-    if (PyObject_SetAttrString(tm, "sleep", sleep) < 0) {
-        Py_DECREF(sleep);
-        Py_DECREF(tm);
-        return NGX_ERROR;
-    }
+    rc = ngx_python_substitute(cycle, tm, &ngx_python_sleep_function);
 
-    Py_DECREF(sleep);
     Py_DECREF(tm);
-    return NGX_OK;
+    return rc;
 }
 
 #endif
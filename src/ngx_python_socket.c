@@ -397,6 +397,9 @@ static PyMethodDef ngx_python_socket_functions[] = {
 
 static PyObject  *ngx_python_socket_error;
 static PyObject  *ngx_python_socket_timeout;
+#if (NGX_THREADS)
+static PyObject  *ngx_python_socket_orig;
+#endif
 
 
 static PyObject *
@@ -1529,6 +1532,16 @@ ngx_python_socket_new(PyTypeObject *type, PyObject *args, PyObject *kwds)
     ngx_log_debug0(NGX_LOG_DEBUG_CORE, ngx_cycle->log, 0,
                    "python socket.new()");
 
+#if (NGX_THREADS)
+
+    /* a regular blocking socket is created in thread pool threads */
+
+    if (ngx_python_in_thread()) {
+        return PyObject_Call(ngx_python_socket_orig, args, kwds);
+    }
+
+#endif
+
     obj = type->tp_alloc(type, 0);
     if (obj == NULL) {
         return NULL;
@@ -1978,7 +1991,7 @@ ngx_python_socket_file_iternext(ngx_python_socket_file_t *f)
 ngx_int_t
 ngx_python_socket_install(ngx_cycle_t *cycle)
 {
-    PyObject     *sm, *fun;
+    PyObject     *sm;
     PyMethodDef  *fn;
 
     if (PyType_Ready(&ngx_python_socket_type) < 0) {
@@ -2011,6 +2024,14 @@ ngx_python_socket_install(ngx_cycle_t *cycle)
         return NGX_ERROR;
     }
 
+#if (NGX_THREADS)
+    ngx_python_socket_orig = PyObject_GetAttrString(sm, "socket");
+    if (ngx_python_socket_orig == NULL) {
+        Py_DECREF(sm);
+        return NGX_ERROR;
+    }
+#endif
+
     if (PyObject_SetAttrString(sm, "socket",
                                (PyObject *) &ngx_python_socket_type) < 0)
     {
@@ -2029,20 +2050,10 @@ ngx_python_socket_install(ngx_cycle_t *cycle)
     }
 
     for (fn = ngx_python_socket_functions; fn->ml_name; fn++) {
-
-        fun = PyCFunction_NewEx(fn, NULL, NULL);
-        if (fun == NULL) {
+        if (ngx_python_substitute(cycle, sm, fn) != NGX_OK) {
             Py_DECREF(sm);
             return NGX_ERROR;
         }
-
-        if (PyObject_SetAttrString(sm, fn->ml_name, fun) < 0) {
-            Py_DECREF(fun);
-            Py_DECREF(sm);
-            return NGX_ERROR;
-        }
-
-        Py_DECREF(fun);
     }
 
     Py_DECREF(sm);
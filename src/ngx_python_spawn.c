@@ -0,0 +1,557 @@
+
+/*
+ * Copyright (C) Roman Arutyunyan
+ */
+
+
+#include <Python.h>
+#include <ngx_config.h>
+#include <ngx_core.h>
+#include <ngx_event.h>
+#include "ngx_python.h"
+
+
+#if !(NGX_PYTHON_SYNC)
+
+/*
+ * A task runs a Python callable in a child coroutine of the current one.
+ * The child context is allocated from the parent pool and is terminated
+ * by the pool cleanup handler of the task along with the parent.  The pool
+ * holds a reference to the task object until then, which keeps the wake
+ * event valid while it is posted.
+ */
+
+
+typedef struct {
+    PyObject_HEAD
+    PyObject             *func;
+    PyObject             *args;
+    PyObject             *runner;
+    PyObject             *result;
+    PyObject             *exc_type;
+    PyObject             *exc_value;
+    PyObject             *exc_traceback;
+    ngx_python_ctx_t     *ctx;
+    ngx_python_ctx_t     *waiter;
+    ngx_event_t           wake;
+    unsigned              done:1;
+} ngx_python_task_t;
+
+
+static PyObject *ngx_python_spawn(PyObject *self, PyObject *args);
+static PyObject *ngx_python_wait(PyObject *self, PyObject *args,
+    PyObject *kwds);
+static ngx_int_t ngx_python_task_wait(PyObject **tasks, Py_ssize_t n,
+    ngx_uint_t any);
+static PyObject *ngx_python_task_run(ngx_python_task_t *t);
+static void ngx_python_task_handler(ngx_event_t *ev);
+static void ngx_python_task_cleanup(void *data);
+static void ngx_python_task_finish(ngx_python_task_t *t);
+static PyObject *ngx_python_task_result(ngx_python_task_t *t);
+static PyObject *ngx_python_task_done(ngx_python_task_t *t);
+static void ngx_python_task_dealloc(ngx_python_task_t *t);
+
+
+static PyMethodDef ngx_python_spawn_functions[] = {
+
+    { "spawn",
+      (PyCFunction) ngx_python_spawn,
+      METH_VARARGS,
+      "run function in a new coroutine" },
+
+    { "wait",
+      (PyCFunction) ngx_python_wait,
+      METH_VARARGS|METH_KEYWORDS,
+      "wait for tasks to complete" },
+
+    { NULL, NULL, 0, NULL }
+};
+
+
+static PyMethodDef ngx_python_task_run_method = {
+    "run",
+    (PyCFunction) ngx_python_task_run,
+    METH_NOARGS,
+    "run task"
+};
+
+
+static PyMethodDef ngx_python_task_methods[] = {
+
+    { "result",
+      (PyCFunction) ngx_python_task_result,
+      METH_NOARGS,
+      "wait for task and return its result" },
+
+    { "done",
+      (PyCFunction) ngx_python_task_done,
+      METH_NOARGS,
+      "check if task is complete" },
+
+    { NULL, NULL, 0, NULL }
+};
+
+
+static PyTypeObject  ngx_python_task_type = {
+    .ob_refcnt = 1,
+    .tp_name = "ngx.Task",
+    .tp_basicsize = sizeof(ngx_python_task_t),
+    .tp_dealloc = (destructor) ngx_python_task_dealloc,
+    .tp_flags = Py_TPFLAGS_DEFAULT,
+    .tp_doc = "nginx task",
+    .tp_methods = ngx_python_task_methods
+};
+
+
+static PyObject  *ngx_python_task_noargs;
+
+
+static PyObject *
+ngx_python_spawn(PyObject *self, PyObject *args)
+{
+    PyObject            *func;
+    Py_ssize_t           n;
+    ngx_python_ctx_t    *parent, *ctx;
+    ngx_python_task_t   *t;
+    ngx_pool_cleanup_t  *cln;
+
+    ngx_log_debug0(NGX_LOG_DEBUG_CORE, ngx_cycle->log, 0, "python spawn()");
+
+    n = PyTuple_GET_SIZE(args);
+
+    if (n == 0) {
+        PyErr_SetString(PyExc_TypeError,
+                        "spawn() takes at least 1 argument (0 given)");
+        return NULL;
+    }
+
+    func = PyTuple_GET_ITEM(args, 0);
+
+    if (!PyCallable_Check(func)) {
+        PyErr_SetString(PyExc_TypeError, "spawn() argument must be callable");
+        return NULL;
+    }
+
+    parent = ngx_python_get_ctx();
+    if (parent == NULL) {
+        PyErr_SetString(PyExc_RuntimeError, "blocking calls are not allowed");
+        return NULL;
+    }
+
+    ctx = ngx_python_create_child_ctx(parent);
+    if (ctx == NULL) {
+        return NULL;
+    }
+
+    /* the cleanup handler is called before the parent is terminated */
+
+    cln = ngx_pool_cleanup_add(ngx_python_get_pool(parent), 0);
+    if (cln == NULL) {
+        return PyErr_NoMemory();
+    }
+
+    t = PyObject_New(ngx_python_task_t, &ngx_python_task_type);
+    if (t == NULL) {
+        return NULL;
+    }
+
+    t->func = func;
+    t->args = NULL;
+    t->runner = NULL;
+    t->result = NULL;
+    t->exc_type = NULL;
+    t->exc_value = NULL;
+    t->exc_traceback = NULL;
+    t->ctx = ctx;
+    t->waiter = NULL;
+    t->done = 0;
+
+    Py_INCREF(func);
+
+    ngx_memzero(&t->wake, sizeof(ngx_event_t));
+
+    t->wake.data = t;
+    t->wake.handler = ngx_python_task_handler;
+    t->wake.log = ngx_cycle->log;
+
+    /* the reference is released by the cleanup handler */
+
+    Py_INCREF(t);
+
+    cln->handler = ngx_python_task_cleanup;
+    cln->data = t;
+
+    t->args = PyTuple_GetSlice(args, 1, n);
+    if (t->args == NULL) {
+        goto failed;
+    }
+
+    /* the runner references the task until the task is complete */
+
+    t->runner = PyCFunction_NewEx(&ngx_python_task_run_method, (PyObject *) t,
+                                  NULL);
+    if (t->runner == NULL) {
+        goto failed;
+    }
+
+    /* the task starts from the next event loop iteration */
+
+    ngx_post_event(&t->wake, &ngx_posted_events);
+
+    return (PyObject *) t;
+
+failed:
+
+    t->done = 1;
+
+    ngx_python_task_finish(t);
+
+    Py_DECREF(t);
+
+    return NULL;
+}
+
+
+static PyObject *
+ngx_python_wait(PyObject *self, PyObject *args, PyObject *kwds)
+{
+    int          any;
+    PyObject    *tasks, *seq, *done, **items;
+    Py_ssize_t   i, n;
+
+    static char  *kwlist[] = { "tasks", "any", NULL };
+
+    ngx_log_debug0(NGX_LOG_DEBUG_CORE, ngx_cycle->log, 0, "python wait()");
+
+    any = 0;
+
+    if (!PyArg_ParseTupleAndKeywords(args, kwds, "O|i:wait", kwlist, &tasks,
+                                     &any))
+    {
+        return NULL;
+    }
+
+    seq = PySequence_Fast(tasks, "wait() argument must be iterable");
+    if (seq == NULL) {
+        return NULL;
+    }
+
+    n = PySequence_Fast_GET_SIZE(seq);
+    items = PySequence_Fast_ITEMS(seq);
+
+    for (i = 0; i < n; i++) {
+        if (Py_TYPE(items[i]) != &ngx_python_task_type) {
+            PyErr_SetString(PyExc_TypeError,
+                            "wait() argument must contain tasks only");
+            Py_DECREF(seq);
+            return NULL;
+        }
+    }
+
+    if (ngx_python_task_wait(items, n, any) != NGX_OK) {
+        Py_DECREF(seq);
+        return NULL;
+    }
+
+    done = PyList_New(0);
+    if (done == NULL) {
+        Py_DECREF(seq);
+        return NULL;
+    }
+
+    for (i = 0; i < n; i++) {
+        if (((ngx_python_task_t *) items[i])->done
+            && PyList_Append(done, items[i]) < 0)
+        {
+            Py_DECREF(done);
+            Py_DECREF(seq);
+            return NULL;
+        }
+    }
+
+    Py_DECREF(seq);
+
+    return done;
+}
+
+
+static ngx_int_t
+ngx_python_task_wait(PyObject **tasks, Py_ssize_t n, ngx_uint_t any)
+{
+    ngx_int_t           rc;
+    Py_ssize_t          i, ndone;
+    ngx_python_ctx_t   *ctx;
+    ngx_python_task_t  *t;
+
+    ctx = ngx_python_get_ctx();
+
+    for ( ;; ) {
+        ndone = 0;
+
+        for (i = 0; i < n; i++) {
+            t = (ngx_python_task_t *) tasks[i];
+
+            if (t->done) {
+                ndone++;
+                continue;
+            }
+
+            if (ctx && t->ctx == ctx) {
+                PyErr_SetString(PyExc_RuntimeError,
+                                "task cannot wait for itself");
+                return NGX_ERROR;
+            }
+
+            if (t->waiter && t->waiter != ctx) {
+                PyErr_SetString(PyExc_RuntimeError,
+                                "task is already waited for");
+                return NGX_ERROR;
+            }
+        }
+
+        if (ndone == n || (any && ndone)) {
+            return NGX_OK;
+        }
+
+        if (ctx == NULL) {
+            PyErr_SetString(PyExc_RuntimeError,
+                            "blocking calls are not allowed");
+            return NGX_ERROR;
+        }
+
+        for (i = 0; i < n; i++) {
+            t = (ngx_python_task_t *) tasks[i];
+
+            if (!t->done) {
+                t->waiter = ctx;
+            }
+        }
+
+        rc = ngx_python_yield();
+
+        for (i = 0; i < n; i++) {
+            t = (ngx_python_task_t *) tasks[i];
+
+            if (t->waiter == ctx) {
+                t->waiter = NULL;
+            }
+        }
+
+        if (rc != NGX_OK) {
+            return NGX_ERROR;
+        }
+    }
+}
+
+
+static PyObject *
+ngx_python_task_run(ngx_python_task_t *t)
+{
+    PyObject  *result;
+
+    /* called in the child coroutine */
+
+    result = PyObject_Call(t->func, t->args, NULL);
+
+    if (result == NULL) {
+        PyErr_Fetch(&t->exc_type, &t->exc_value, &t->exc_traceback);
+        PyErr_NormalizeException(&t->exc_type, &t->exc_value,
+                                 &t->exc_traceback);
+
+        ngx_log_debug0(NGX_LOG_DEBUG_CORE, ngx_cycle->log, 0,
+                       "python task failed");
+
+    } else {
+        t->result = result;
+    }
+
+    t->done = 1;
+
+    Py_RETURN_NONE;
+}
+
+
+static void
+ngx_python_task_handler(ngx_event_t *ev)
+{
+    PyObject           *result;
+    ngx_python_task_t  *t;
+
+    t = ev->data;
+
+    ngx_log_debug1(NGX_LOG_DEBUG_CORE, ngx_cycle->log, 0,
+                   "python task handler done:%d", t->done);
+
+    if (t->ctx == NULL || t->done) {
+        return;
+    }
+
+    result = ngx_python_call(t->ctx, t->runner, ngx_python_task_noargs,
+                             &t->wake);
+
+    if (result == NGX_PYTHON_AGAIN) {
+        return;
+    }
+
+    Py_XDECREF(result);
+
+    ngx_python_task_finish(t);
+
+    if (t->waiter) {
+        ngx_python_wakeup(t->waiter);
+    }
+}
+
+
+static void
+ngx_python_task_cleanup(void *data)
+{
+    ngx_python_task_t  *t = data;
+
+    ngx_log_debug1(NGX_LOG_DEBUG_CORE, ngx_cycle->log, 0,
+                   "python task cleanup done:%d", t->done);
+
+    /* the waiter is being terminated as well */
+
+    t->waiter = NULL;
+
+    ngx_python_terminate_ctx(t->ctx);
+
+    if (t->wake.posted) {
+        ngx_delete_posted_event(&t->wake);
+    }
+
+    t->ctx = NULL;
+
+    ngx_python_task_finish(t);
+
+    Py_DECREF(t);
+}
+
+
+static void
+ngx_python_task_finish(ngx_python_task_t *t)
+{
+    if (!t->done) {
+
+        /* the runner has never completed */
+
+        t->done = 1;
+        t->exc_type = PyExc_RuntimeError;
+        t->exc_value = PyString_FromString("task terminated");
+
+        Py_INCREF(t->exc_type);
+    }
+
+    Py_CLEAR(t->func);
+    Py_CLEAR(t->args);
+
+    /* the runner references the task, so clear it last */
+
+    Py_CLEAR(t->runner);
+}
+
+
+static PyObject *
+ngx_python_task_result(ngx_python_task_t *t)
+{
+    PyObject  *task;
+
+    ngx_log_debug0(NGX_LOG_DEBUG_CORE, ngx_cycle->log, 0,
+                   "python task result()");
+
+    task = (PyObject *) t;
+
+    if (ngx_python_task_wait(&task, 1, 0) != NGX_OK) {
+        return NULL;
+    }
+
+    if (t->exc_type) {
+        Py_INCREF(t->exc_type);
+        Py_XINCREF(t->exc_value);
+        Py_XINCREF(t->exc_traceback);
+
+        PyErr_Restore(t->exc_type, t->exc_value, t->exc_traceback);
+
+        return NULL;
+    }
+
+    Py_INCREF(t->result);
+
+    return t->result;
+}
+
+
+static PyObject *
+ngx_python_task_done(ngx_python_task_t *t)
+{
+    return PyBool_FromLong(t->done);
+}
+
+
+static void
+ngx_python_task_dealloc(ngx_python_task_t *t)
+{
+    Py_XDECREF(t->func);
+    Py_XDECREF(t->args);
+    Py_XDECREF(t->result);
+    Py_XDECREF(t->exc_type);
+    Py_XDECREF(t->exc_value);
+    Py_XDECREF(t->exc_traceback);
+
+    Py_TYPE(t)->tp_free((PyObject *) t);
+}
+
+
+ngx_int_t
+ngx_python_spawn_install(ngx_cycle_t *cycle)
+{
+    PyObject     *m, *fun;
+    PyMethodDef  *fn;
+
+    if (PyType_Ready(&ngx_python_task_type) < 0) {
+        ngx_log_error(NGX_LOG_EMERG, cycle->log, 0, "could not add %s type",
+                      ngx_python_task_type.tp_name);
+        return NGX_ERROR;
+    }
+
+    ngx_python_task_noargs = PyTuple_New(0);
+    if (ngx_python_task_noargs == NULL) {
+        return NGX_ERROR;
+    }
+
+    m = PyImport_ImportModule("ngx");
+    if (m == NULL) {
+        return NGX_ERROR;
+    }
+
+    if (PyObject_SetAttrString(m, "Task",
+                               (PyObject *) &ngx_python_task_type) < 0)
+    {
+        Py_DECREF(m);
+        return NGX_ERROR;
+    }
+
+    for (fn = ngx_python_spawn_functions; fn->ml_name; fn++) {
+
+        fun = PyCFunction_NewEx(fn, NULL, NULL);
+        if (fun == NULL) {
+            Py_DECREF(m);
+            return NGX_ERROR;
+        }
+
+        if (PyObject_SetAttrString(m, fn->ml_name, fun) < 0) {
+            Py_DECREF(fun);
+            Py_DECREF(m);
+            return NGX_ERROR;
+        }
+
+        Py_DECREF(fun);
+    }
+
+    Py_DECREF(m);
+
+    return NGX_OK;
+}
+
+#endif
@@ -0,0 +1,264 @@
+
+/*
+ * Copyright (C) Roman Arutyunyan
+ */
+
+
+#include <Python.h>
+#include <ngx_config.h>
+#include <ngx_core.h>
+#include "ngx_python.h"
+
+
+#if !(NGX_PYTHON_SYNC)
+
+/*
+ * Coroutine stacks are mmap()'ed with a PROT_NONE guard page below the
+ * usable area, so that an overflow faults instead of silently corrupting
+ * adjacent memory.  Released stacks are kept in per-worker free lists,
+ * one list for each stack size in use, and are reused by later requests.
+ */
+
+
+typedef struct {
+    ngx_queue_t            queue;
+    size_t                 size;
+    ngx_queue_t            free;
+    ngx_uint_t             nfree;
+} ngx_python_stack_pool_t;
+
+
+#define NGX_PYTHON_STACK_PATTERN  0xa5
+
+
+static ngx_python_stack_pool_t *ngx_python_stack_get_pool(size_t size,
+    ngx_log_t *log);
+static ngx_python_stack_t *ngx_python_stack_create(
+    ngx_python_stack_pool_t *pool, ngx_log_t *log);
+static void ngx_python_stack_destroy(ngx_python_stack_t *stack);
+
+
+static ngx_queue_t  ngx_python_stack_pools;
+static ngx_uint_t   ngx_python_stack_max;
+
+
+ngx_int_t
+ngx_python_stack_init(ngx_cycle_t *cycle, size_t size, ngx_uint_t min,
+    ngx_uint_t max)
+{
+    ngx_uint_t                n;
+    ngx_python_stack_t       *stack;
+    ngx_python_stack_pool_t  *pool;
+
+    ngx_queue_init(&ngx_python_stack_pools);
+
+    ngx_python_stack_max = max;
+
+    pool = ngx_python_stack_get_pool(size, cycle->log);
+    if (pool == NULL) {
+        return NGX_ERROR;
+    }
+
+    for (n = 0; n < min; n++) {
+        stack = ngx_python_stack_create(pool, cycle->log);
+        if (stack == NULL) {
+            return NGX_ERROR;
+        }
+
+        ngx_queue_insert_head(&pool->free, &stack->queue);
+        pool->nfree++;
+    }
+
+    ngx_log_debug2(NGX_LOG_DEBUG_CORE, cycle->log, 0,
+                   "python stack pool init size:%uz, min:%ui", pool->size, min);
+
+    return NGX_OK;
+}
+
+
+ngx_python_stack_t *
+ngx_python_stack_alloc(size_t size, ngx_log_t *log)
+{
+    ngx_queue_t              *q;
+    ngx_python_stack_t       *stack;
+    ngx_python_stack_pool_t  *pool;
+
+    pool = ngx_python_stack_get_pool(size, log);
+    if (pool == NULL) {
+        return NULL;
+    }
+
+    if (ngx_queue_empty(&pool->free)) {
+        return ngx_python_stack_create(pool, log);
+    }
+
+    q = ngx_queue_head(&pool->free);
+    ngx_queue_remove(q);
+    pool->nfree--;
+
+    stack = ngx_queue_data(q, ngx_python_stack_t, queue);
+
+    ngx_log_debug2(NGX_LOG_DEBUG_CORE, log, 0,
+                   "python stack reuse %p:%uz", stack->start, stack->size);
+
+    return stack;
+}
+
+
+void
+ngx_python_stack_free(ngx_python_stack_t *stack)
+{
+    ngx_python_stack_pool_t  *pool;
+
+    pool = stack->pool;
+
+    if (pool->nfree >= ngx_python_stack_max) {
+        ngx_python_stack_destroy(stack);
+        return;
+    }
+
+    ngx_log_debug2(NGX_LOG_DEBUG_CORE, ngx_cycle->log, 0,
+                   "python stack release %p:%uz", stack->start, stack->size);
+
+    ngx_queue_insert_head(&pool->free, &stack->queue);
+    pool->nfree++;
+}
+
+
+void
+ngx_python_stack_fill(ngx_python_stack_t *stack)
+{
+    if (stack->filled) {
+        return;
+    }
+
+    ngx_memset(stack->start, NGX_PYTHON_STACK_PATTERN, stack->size);
+
+    stack->filled = 1;
+}
+
+
+size_t
+ngx_python_stack_used(ngx_python_stack_t *stack)
+{
+    u_char  *p, *last;
+
+    /*
+     * The stack is expected to be filled with the pattern before use.
+     * The part which still holds the pattern has never been touched.
+     * The rest is filled again, so that the stack can be measured
+     * next time without filling it entirely.
+     */
+
+    p = stack->start;
+    last = stack->start + stack->size;
+
+    while (p < last && *p == NGX_PYTHON_STACK_PATTERN) {
+        p++;
+    }
+
+    ngx_memset(p, NGX_PYTHON_STACK_PATTERN, last - p);
+
+    return last - p;
+}
+
+
+static ngx_python_stack_pool_t *
+ngx_python_stack_get_pool(size_t size, ngx_log_t *log)
+{
+    ngx_queue_t              *q;
+    ngx_python_stack_pool_t  *pool;
+
+    size = ngx_align(size, ngx_pagesize);
+
+    for (q = ngx_queue_head(&ngx_python_stack_pools);
+         q != ngx_queue_sentinel(&ngx_python_stack_pools);
+         q = ngx_queue_next(q))
+    {
+        pool = ngx_queue_data(q, ngx_python_stack_pool_t, queue);
+
+        if (pool->size == size) {
+            return pool;
+        }
+    }
+
+    pool = ngx_alloc(sizeof(ngx_python_stack_pool_t), log);
+    if (pool == NULL) {
+        return NULL;
+    }
+
+    pool->size = size;
+    pool->nfree = 0;
+    ngx_queue_init(&pool->free);
+
+    ngx_queue_insert_tail(&ngx_python_stack_pools, &pool->queue);
+
+    return pool;
+}
+
+
+static ngx_python_stack_t *
+ngx_python_stack_create(ngx_python_stack_pool_t *pool, ngx_log_t *log)
+{
+    u_char              *p;
+    size_t               len;
+    ngx_python_stack_t  *stack;
+
+    stack = ngx_alloc(sizeof(ngx_python_stack_t), log);
+    if (stack == NULL) {
+        return NULL;
+    }
+
+    len = ngx_pagesize + pool->size;
+
+    p = mmap(NULL, len, PROT_READ|PROT_WRITE, MAP_ANON|MAP_PRIVATE, -1, 0);
+    if (p == MAP_FAILED) {
+        ngx_log_error(NGX_LOG_ALERT, log, ngx_errno,
+                      "mmap(MAP_ANON|MAP_PRIVATE, %uz) failed", len);
+        ngx_free(stack);
+        return NULL;
+    }
+
+    /* the stack grows down, the guard page is at the lowest address */
+
+    if (mprotect(p, ngx_pagesize, PROT_NONE) == -1) {
+        ngx_log_error(NGX_LOG_ALERT, log, ngx_errno,
+                      "mprotect(%p, PROT_NONE) failed", p);
+        (void) munmap(p, len);
+        ngx_free(stack);
+        return NULL;
+    }
+
+    stack->start = p + ngx_pagesize;
+    stack->size = pool->size;
+    stack->pool = pool;
+    stack->filled = 0;
+
+    ngx_log_debug2(NGX_LOG_DEBUG_CORE, log, 0,
+                   "python stack create %p:%uz", stack->start, stack->size);
+
+    return stack;
+}
+
+
+static void
+ngx_python_stack_destroy(ngx_python_stack_t *stack)
+{
+    u_char  *p;
+    size_t   len;
+
+    ngx_log_debug2(NGX_LOG_DEBUG_CORE, ngx_cycle->log, 0,
+                   "python stack destroy %p:%uz", stack->start, stack->size);
+
+    p = stack->start - ngx_pagesize;
+    len = ngx_pagesize + stack->size;
+
+    if (munmap(p, len) == -1) {
+        ngx_log_error(NGX_LOG_ALERT, ngx_cycle->log, ngx_errno,
+                      "munmap(%p, %uz) failed", p, len);
+    }
+
+    ngx_free(stack);
+}
+
+#endif
@@ -0,0 +1,296 @@
+
+/*
+ * Copyright (C) Roman Arutyunyan
+ */
+
+
+#include <Python.h>
+#include <ngx_config.h>
+#include <ngx_core.h>
+#include <ngx_event.h>
+#include "ngx_python.h"
+
+
+#if !(NGX_PYTHON_SYNC) && (NGX_THREADS)
+
+/*
+ * A thread task calls a Python function in a thread pool with the GIL
+ * acquired by PyGILState_Ensure().  While thread tasks are running, the
+ * worker releases the GIL when waiting for events.  Events are posted
+ * in this case to let their handlers run with the GIL held.
+ *
+ * The task is allocated from the heap, since the coroutine may be
+ * terminated before the task is complete.  A detached task is freed by
+ * the completion handler.
+ */
+
+
+typedef struct {
+    PyObject              *func;
+    PyObject              *args;
+    PyObject              *result;
+    PyObject              *exc_type;
+    PyObject              *exc_value;
+    PyObject              *exc_traceback;
+    ngx_python_ctx_t      *ctx;
+    ngx_uint_t             done;  /* unsigned  done:1; */
+} ngx_python_thread_ctx_t;
+
+
+static PyObject *ngx_python_run_in_thread(PyObject *self, PyObject *args);
+static void ngx_python_thread_handler(void *data, ngx_log_t *log);
+static void ngx_python_thread_event_handler(ngx_event_t *ev);
+static void ngx_python_thread_free(ngx_thread_task_t *task);
+static ngx_int_t ngx_python_thread_process_events(ngx_cycle_t *cycle,
+    ngx_msec_t timer, ngx_uint_t flags);
+
+
+static PyMethodDef ngx_python_thread_function = {
+    "run_in_thread",
+    (PyCFunction) ngx_python_run_in_thread,
+    METH_VARARGS,
+    "run function in a thread pool"
+};
+
+
+static ngx_thread_pool_t  *ngx_python_thread_pool;
+static ngx_uint_t          ngx_python_thread_running;
+static ngx_int_t         (*ngx_python_thread_next_process_events)
+    (ngx_cycle_t *cycle, ngx_msec_t timer, ngx_uint_t flags);
+
+
+static PyObject *
+ngx_python_run_in_thread(PyObject *self, PyObject *args)
+{
+    PyObject                 *func, *result;
+    Py_ssize_t                n;
+    ngx_python_ctx_t         *ctx;
+    ngx_thread_task_t        *task;
+    ngx_python_thread_ctx_t  *tc;
+
+    ngx_log_debug0(NGX_LOG_DEBUG_CORE, ngx_cycle->log, 0,
+                   "python run_in_thread()");
+
+    n = PyTuple_GET_SIZE(args);
+
+    if (n == 0) {
+        PyErr_SetString(PyExc_TypeError,
+                        "run_in_thread() takes at least 1 argument (0 given)");
+        return NULL;
+    }
+
+    func = PyTuple_GET_ITEM(args, 0);
+
+    if (!PyCallable_Check(func)) {
+        PyErr_SetString(PyExc_TypeError,
+                        "run_in_thread() argument must be callable");
+        return NULL;
+    }
+
+    if (ngx_python_thread_pool == NULL) {
+        PyErr_SetString(PyExc_RuntimeError,
+                        "\"python_thread_pool\" is not configured");
+        return NULL;
+    }
+
+    ctx = ngx_python_get_ctx();
+    if (ctx == NULL) {
+        PyErr_SetString(PyExc_RuntimeError, "blocking calls are not allowed");
+        return NULL;
+    }
+
+    task = ngx_calloc(sizeof(ngx_thread_task_t)
+                      + sizeof(ngx_python_thread_ctx_t), ngx_cycle->log);
+    if (task == NULL) {
+        return PyErr_NoMemory();
+    }
+
+    tc = (ngx_python_thread_ctx_t *) (task + 1);
+
+    tc->args = PyTuple_GetSlice(args, 1, n);
+    if (tc->args == NULL) {
+        ngx_free(task);
+        return NULL;
+    }
+
+    tc->func = func;
+    tc->ctx = ctx;
+
+    Py_INCREF(func);
+
+    task->ctx = tc;
+    task->handler = ngx_python_thread_handler;
+    task->event.data = task;
+    task->event.handler = ngx_python_thread_event_handler;
+    task->event.log = ngx_cycle->log;
+
+    if (ngx_python_thread_next_process_events == NULL) {
+
+        /* the GIL is created and acquired by the main thread */
+
+        PyEval_InitThreads();
+
+        ngx_python_thread_next_process_events = ngx_event_actions.process_events;
+        ngx_event_actions.process_events = ngx_python_thread_process_events;
+    }
+
+    if (ngx_thread_task_post(ngx_python_thread_pool, task) != NGX_OK) {
+        ngx_python_thread_free(task);
+        PyErr_SetString(PyExc_RuntimeError, "failed to post thread task");
+        return NULL;
+    }
+
+    ngx_python_thread_running++;
+
+    do {
+        if (ngx_python_yield() != NGX_OK) {
+
+            /* the task will be freed by the completion handler */
+
+            tc->ctx = NULL;
+            return NULL;
+        }
+    } while (!tc->done);
+
+    if (tc->exc_type) {
+        PyErr_Restore(tc->exc_type, tc->exc_value, tc->exc_traceback);
+
+        tc->exc_type = NULL;
+        tc->exc_value = NULL;
+        tc->exc_traceback = NULL;
+
+        result = NULL;
+
+    } else {
+        result = tc->result;
+        tc->result = NULL;
+    }
+
+    ngx_python_thread_free(task);
+
+    return result;
+}
+
+
+static void
+ngx_python_thread_handler(void *data, ngx_log_t *log)
+{
+    ngx_python_thread_ctx_t *tc = data;
+
+    PyObject          *result;
+    PyGILState_STATE   state;
+
+    ngx_log_debug0(NGX_LOG_DEBUG_CORE, log, 0, "python thread handler");
+
+    state = PyGILState_Ensure();
+
+    result = PyObject_Call(tc->func, tc->args, NULL);
+
+    if (result == NULL) {
+        PyErr_Fetch(&tc->exc_type, &tc->exc_value, &tc->exc_traceback);
+
+    } else {
+        tc->result = result;
+    }
+
+    PyGILState_Release(state);
+}
+
+
+static void
+ngx_python_thread_event_handler(ngx_event_t *ev)
+{
+    ngx_thread_task_t        *task;
+    ngx_python_thread_ctx_t  *tc;
+
+    task = ev->data;
+    tc = task->ctx;
+
+    ngx_log_debug1(NGX_LOG_DEBUG_CORE, ev->log, 0,
+                   "python thread event handler detached:%d",
+                   tc->ctx == NULL);
+
+    ngx_python_thread_running--;
+
+    if (tc->ctx == NULL) {
+        ngx_python_thread_free(task);
+        return;
+    }
+
+    tc->done = 1;
+
+    ngx_python_wakeup(tc->ctx);
+}
+
+
+static void
+ngx_python_thread_free(ngx_thread_task_t *task)
+{
+    ngx_python_thread_ctx_t  *tc;
+
+    tc = task->ctx;
+
+    Py_XDECREF(tc->func);
+    Py_XDECREF(tc->args);
+    Py_XDECREF(tc->result);
+    Py_XDECREF(tc->exc_type);
+    Py_XDECREF(tc->exc_value);
+    Py_XDECREF(tc->exc_traceback);
+
+    ngx_free(task);
+}
+
+
+static ngx_int_t
+ngx_python_thread_process_events(ngx_cycle_t *cycle, ngx_msec_t timer,
+    ngx_uint_t flags)
+{
+    ngx_int_t       rc;
+    PyThreadState  *ts;
+
+    if (ngx_python_thread_running == 0) {
+        return ngx_python_thread_next_process_events(cycle, timer, flags);
+    }
+
+    ts = PyEval_SaveThread();
+
+    rc = ngx_python_thread_next_process_events(cycle, timer,
+                                               flags|NGX_POST_EVENTS);
+
+    PyEval_RestoreThread(ts);
+
+    return rc;
+}
+
+
+ngx_int_t
+ngx_python_thread_install(ngx_cycle_t *cycle, ngx_thread_pool_t *tp)
+{
+    PyObject  *m, *fun;
+
+    ngx_python_thread_pool = tp;
+
+    m = PyImport_ImportModule("ngx");
+    if (m == NULL) {
+        return NGX_ERROR;
+    }
+
+    fun = PyCFunction_NewEx(&ngx_python_thread_function, NULL, NULL);
+    if (fun == NULL) {
+        Py_DECREF(m);
+        return NGX_ERROR;
+    }
+
+    if (PyObject_SetAttrString(m, "run_in_thread", fun) < 0) {
+        Py_DECREF(fun);
+        Py_DECREF(m);
+        return NGX_ERROR;
+    }
+
+    Py_DECREF(fun);
+    Py_DECREF(m);
+
+    return NGX_OK;
+}
+
+#endif
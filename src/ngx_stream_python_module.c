@@ -13,10 +13,18 @@
 
 
 typedef struct {
-    ngx_array_t                *access;   /* array of PyCodeObject * */
-    ngx_array_t                *preread;  /* array of PyCodeObject * */
-    ngx_array_t                *log;      /* array of PyCodeObject * */
-    PyCodeObject               *content;
+    ngx_python_batch_t             *batch;
+    ngx_array_t                    *vars;     /* array of ngx_int_t */
+} ngx_stream_python_log_batch_t;
+
+
+typedef struct {
+    ngx_array_t                    *access;   /* array of PyObject * */
+    ngx_array_t                    *preread;  /* array of PyObject * */
+    ngx_array_t                    *log;      /* array of PyObject * */
+    ngx_stream_python_log_batch_t  *log_batch;
+    PyObject                       *content;
+    ngx_python_ctx_conf_t           python;
 } ngx_stream_python_srv_conf_t;
 
 
@@ -24,6 +32,7 @@ typedef struct {
     ngx_uint_t                  phase;
     ngx_uint_t                  passed;
     PyObject                   *session;
+    PyObject                   *args;
     ngx_python_ctx_t           *python;
 } ngx_stream_python_ctx_t;
 
@@ -35,8 +44,8 @@ static void ngx_stream_python_content_handler(ngx_stream_session_t *s);
 static void ngx_stream_python_content_event_handler(ngx_event_t *event);
 static ngx_int_t ngx_stream_python_variable(ngx_stream_session_t *s,
     ngx_stream_variable_value_t *v, uintptr_t data);
-static PyObject *ngx_stream_python_eval_code(ngx_stream_session_t *s,
-    PyCodeObject *code, ngx_event_t *wake);
+static PyObject *ngx_stream_python_eval(ngx_stream_session_t *s,
+    PyObject *handler, ngx_event_t *wake);
 
 static void *ngx_stream_python_create_srv_conf(ngx_conf_t *cf);
 static char *ngx_stream_python_merge_srv_conf(ngx_conf_t *cf, void *parent,
@@ -51,6 +60,8 @@ static char *ngx_stream_python_log(ngx_conf_t *cf, ngx_command_t *cmd,
     void *conf);
 static char *ngx_stream_python_content(ngx_conf_t *cf, ngx_command_t *cmd,
     void *conf);
+static char *ngx_stream_python_log_batch(ngx_conf_t *cf, ngx_command_t *cmd,
+    void *conf);
 static ngx_int_t ngx_stream_python_init(ngx_conf_t *cf);
 
 
@@ -86,6 +97,13 @@ static ngx_command_t  ngx_stream_python_commands[] = {
       0,
       NULL },
 
+    { ngx_string("python_access_handler"),
+      NGX_STREAM_MAIN_CONF|NGX_STREAM_SRV_CONF|NGX_CONF_TAKE1,
+      ngx_stream_python_access,
+      NGX_STREAM_SRV_CONF_OFFSET,
+      0,
+      NGX_PYTHON_CALLABLE },
+
     { ngx_string("python_preread"),
       NGX_STREAM_MAIN_CONF|NGX_STREAM_SRV_CONF|NGX_CONF_TAKE1,
       ngx_stream_python_preread,
@@ -93,6 +111,13 @@ static ngx_command_t  ngx_stream_python_commands[] = {
       0,
       NULL },
 
+    { ngx_string("python_preread_handler"),
+      NGX_STREAM_MAIN_CONF|NGX_STREAM_SRV_CONF|NGX_CONF_TAKE1,
+      ngx_stream_python_preread,
+      NGX_STREAM_SRV_CONF_OFFSET,
+      0,
+      NGX_PYTHON_CALLABLE },
+
     { ngx_string("python_log"),
       NGX_STREAM_MAIN_CONF|NGX_STREAM_SRV_CONF|NGX_CONF_TAKE1,
       ngx_stream_python_log,
@@ -100,6 +125,20 @@ static ngx_command_t  ngx_stream_python_commands[] = {
       0,
       NULL },
 
+    { ngx_string("python_log_handler"),
+      NGX_STREAM_MAIN_CONF|NGX_STREAM_SRV_CONF|NGX_CONF_TAKE1,
+      ngx_stream_python_log,
+      NGX_STREAM_SRV_CONF_OFFSET,
+      0,
+      NGX_PYTHON_CALLABLE },
+
+    { ngx_string("python_log_batch"),
+      NGX_STREAM_MAIN_CONF|NGX_STREAM_SRV_CONF|NGX_CONF_2MORE,
+      ngx_stream_python_log_batch,
+      NGX_STREAM_SRV_CONF_OFFSET,
+      0,
+      NULL },
+
     { ngx_string("python_content"),
       NGX_STREAM_SRV_CONF|NGX_CONF_TAKE1,
       ngx_stream_python_content,
@@ -107,6 +146,48 @@ static ngx_command_t  ngx_stream_python_commands[] = {
       0,
       NULL },
 
+    { ngx_string("python_content_handler"),
+      NGX_STREAM_SRV_CONF|NGX_CONF_TAKE1,
+      ngx_stream_python_content,
+      NGX_STREAM_SRV_CONF_OFFSET,
+      0,
+      NGX_PYTHON_CALLABLE },
+
+    { ngx_string("python_stack_size"),
+      NGX_STREAM_MAIN_CONF|NGX_STREAM_SRV_CONF|NGX_CONF_TAKE1,
+      ngx_conf_set_size_slot,
+      NGX_STREAM_SRV_CONF_OFFSET,
+      offsetof(ngx_stream_python_srv_conf_t, python.stack_size),
+      NULL },
+
+    { ngx_string("python_stack_usage"),
+      NGX_STREAM_MAIN_CONF|NGX_STREAM_SRV_CONF|NGX_CONF_FLAG,
+      ngx_conf_set_flag_slot,
+      NGX_STREAM_SRV_CONF_OFFSET,
+      offsetof(ngx_stream_python_srv_conf_t, python.stack_usage),
+      NULL },
+
+    { ngx_string("python_blocking"),
+      NGX_STREAM_MAIN_CONF|NGX_STREAM_SRV_CONF|NGX_CONF_FLAG,
+      ngx_conf_set_flag_slot,
+      NGX_STREAM_SRV_CONF_OFFSET,
+      offsetof(ngx_stream_python_srv_conf_t, python.blocking),
+      NULL },
+
+    { ngx_string("python_time_slice"),
+      NGX_STREAM_MAIN_CONF|NGX_STREAM_SRV_CONF|NGX_CONF_TAKE1,
+      ngx_conf_set_msec_slot,
+      NGX_STREAM_SRV_CONF_OFFSET,
+      offsetof(ngx_stream_python_srv_conf_t, python.time_slice),
+      NULL },
+
+    { ngx_string("python_error_limit"),
+      NGX_STREAM_MAIN_CONF|NGX_STREAM_SRV_CONF|NGX_CONF_TAKE1,
+      ngx_conf_set_num_slot,
+      NGX_STREAM_SRV_CONF_OFFSET,
+      offsetof(ngx_stream_python_srv_conf_t, python.error_limit),
+      NULL },
+
       ngx_null_command
 };
 
@@ -144,7 +225,7 @@ ngx_stream_python_access_handler(ngx_stream_session_t *s)
 {
     PyObject                       *ret;
     ngx_int_t                       rc;
-    PyCodeObject                  **pcode;
+    PyObject                      **handler;
     ngx_stream_python_ctx_t        *ctx;
     ngx_stream_python_srv_conf_t   *pscf;
 
@@ -157,7 +238,7 @@ ngx_stream_python_access_handler(ngx_stream_session_t *s)
     ngx_log_debug0(NGX_LOG_DEBUG_STREAM, s->connection->log, 0,
                    "stream python access handler");
 
-    pcode = pscf->access->elts;
+    handler = pscf->access->elts;
 
     ctx = ngx_stream_get_module_ctx(s, ngx_stream_python_module);
     if (ctx == NULL) {
@@ -170,8 +251,8 @@ ngx_stream_python_access_handler(ngx_stream_session_t *s)
     }
 
     while (ctx->phase < pscf->access->nelts) {
-        ret = ngx_stream_python_eval_code(s, pcode[ctx->phase],
-                                          s->connection->read);
+        ret = ngx_stream_python_eval(s, handler[ctx->phase],
+                                     s->connection->read);
 
         if (ret == NGX_PYTHON_AGAIN) {
             s->connection->read->handler = ngx_stream_session_handler;
@@ -208,7 +289,7 @@ ngx_stream_python_preread_handler(ngx_stream_session_t *s)
 {
     PyObject                       *ret;
     ngx_int_t                       rc;
-    PyCodeObject                  **pcode;
+    PyObject                      **handler;
     ngx_stream_python_ctx_t        *ctx;
     ngx_stream_python_srv_conf_t   *pscf;
 
@@ -221,7 +302,7 @@ ngx_stream_python_preread_handler(ngx_stream_session_t *s)
     ngx_log_debug0(NGX_LOG_DEBUG_STREAM, s->connection->log, 0,
                    "stream python preread handler");
 
-    pcode = pscf->preread->elts;
+    handler = pscf->preread->elts;
 
     ctx = ngx_stream_get_module_ctx(s, ngx_stream_python_module);
     if (ctx == NULL) {
@@ -234,8 +315,8 @@ ngx_stream_python_preread_handler(ngx_stream_session_t *s)
     }
 
     while (ctx->phase < pscf->preread->nelts) {
-        ret = ngx_stream_python_eval_code(s, pcode[ctx->phase],
-                                          s->connection->read);
+        ret = ngx_stream_python_eval(s, handler[ctx->phase],
+                                     s->connection->read);
 
         if (ret == NGX_PYTHON_AGAIN) {
             s->connection->read->handler = ngx_stream_session_handler;
@@ -270,13 +351,54 @@ ngx_stream_python_preread_handler(ngx_stream_session_t *s)
 static ngx_int_t
 ngx_stream_python_log_handler(ngx_stream_session_t *s)
 {
+    ngx_int_t                      *index;
     ngx_uint_t                      n;
-    PyObject                       *ret;
-    PyCodeObject                  **pcode;
+    PyObject                       *ret, *record, *item;
+    PyObject                      **handler;
+    ngx_stream_variable_value_t    *v;
     ngx_stream_python_srv_conf_t   *pscf;
 
     pscf = ngx_stream_get_module_srv_conf(s, ngx_stream_python_module);
 
+    if (pscf->log_batch) {
+        ngx_log_debug0(NGX_LOG_DEBUG_STREAM, s->connection->log, 0,
+                       "stream python log batch");
+
+        /* a record is a tuple of variable values */
+
+        index = pscf->log_batch->vars->elts;
+
+        record = PyTuple_New(pscf->log_batch->vars->nelts);
+        if (record == NULL) {
+            goto failed;
+        }
+
+        for (n = 0; n < pscf->log_batch->vars->nelts; n++) {
+            v = ngx_stream_get_indexed_variable(s, index[n]);
+
+            if (v == NULL || v->not_found) {
+                item = Py_None;
+                Py_INCREF(item);
+
+            } else {
+                item = PyString_FromStringAndSize((char *) v->data, v->len);
+                if (item == NULL) {
+                    Py_DECREF(record);
+                    goto failed;
+                }
+            }
+
+            PyTuple_SET_ITEM(record, n, item);
+        }
+
+        if (ngx_python_batch_add(pscf->log_batch->batch, record) != NGX_OK) {
+            Py_DECREF(record);
+            goto failed;
+        }
+
+        Py_DECREF(record);
+    }
+
     if (pscf->log == NULL) {
         return NGX_OK;
     }
@@ -284,14 +406,21 @@ ngx_stream_python_log_handler(ngx_stream_session_t *s)
     ngx_log_debug0(NGX_LOG_DEBUG_STREAM, s->connection->log, 0,
                    "stream python log handler");
 
-    pcode = pscf->log->elts;
+    handler = pscf->log->elts;
 
     for (n = 0; n < pscf->log->nelts; n++) {
-        ret = ngx_stream_python_eval_code(s, pcode[n], NULL);
+        ret = ngx_stream_python_eval(s, handler[n], NULL);
         Py_XDECREF(ret);
     }
 
     return NGX_OK;
+
+failed:
+
+    ngx_log_error(NGX_LOG_ERR, s->connection->log, 0, "python error: %s",
+                  ngx_python_get_error(s->connection->pool));
+
+    return NGX_OK;
 }
 
 
@@ -319,7 +448,7 @@ ngx_stream_python_content_event_handler(ngx_event_t *event)
 
     pscf = ngx_stream_get_module_srv_conf(s, ngx_stream_python_module);
 
-    ret = ngx_stream_python_eval_code(s, pscf->content, c->read);
+    ret = ngx_stream_python_eval(s, pscf->content, c->read);
 
     if (ret == NGX_PYTHON_AGAIN) {
         c->read->handler = ngx_stream_python_content_event_handler;
@@ -353,7 +482,7 @@ ngx_stream_python_variable(ngx_stream_session_t *s,
     ngx_log_debug0(NGX_LOG_DEBUG_STREAM, s->connection->log, 0,
                    "stream python variable handler");
 
-    ret = ngx_stream_python_eval_code(s, code, 0);
+    ret = ngx_stream_python_eval(s, (PyObject *) code, NULL);
     if (ret == NULL) {
         return NGX_ERROR;
     }
@@ -396,15 +525,18 @@ ngx_stream_python_variable(ngx_stream_session_t *s,
 
 
 static PyObject *
-ngx_stream_python_eval_code(ngx_stream_session_t *s, PyCodeObject *code,
+ngx_stream_python_eval(ngx_stream_session_t *s, PyObject *handler,
     ngx_event_t *wake)
 {
-    PyObject                    *result, *old;
-    ngx_stream_python_ctx_t     *ctx;
-    ngx_stream_core_srv_conf_t  *cscf;
+    PyObject                      *result, *old;
+    ngx_pool_cleanup_t            *cln;
+    ngx_stream_python_ctx_t       *ctx;
+    ngx_stream_core_srv_conf_t    *cscf;
+    ngx_stream_python_srv_conf_t  *pscf;
 
     ngx_log_debug2(NGX_LOG_DEBUG_STREAM, s->connection->log, 0,
-                   "stream python eval start code:%p, wake:%p", code, wake);
+                   "stream python eval start handler:%p, wake:%p",
+                   handler, wake);
 
     ctx = ngx_stream_get_module_ctx(s, ngx_stream_python_module);
     if (ctx == NULL) {
@@ -436,15 +568,43 @@ ngx_stream_python_eval_code(ngx_stream_session_t *s, PyCodeObject *code,
     ngx_python_set_resolver(ctx->python, cscf->resolver,
                             cscf->resolver_timeout);
 
-    old = ngx_python_set_value(ctx->python, "s", ctx->session);
+    pscf = ngx_stream_get_module_srv_conf(s, ngx_stream_python_module);
+
+    ngx_python_set_ctx_conf(ctx->python, &pscf->python);
+
+    if (PyCode_Check(handler)) {
+        old = ngx_python_set_value(ctx->python, "s", ctx->session);
+
+        result = ngx_python_eval(ctx->python, (PyCodeObject *) handler, wake);
 
-    result = ngx_python_eval(ctx->python, code, wake);
+        ngx_python_reset_value(ctx->python, "s", old);
 
-    ngx_python_reset_value(ctx->python, "s", old);
+    } else {
+
+        /* a callable is called with the session object as an argument */
+
+        if (ctx->args == NULL) {
+            ctx->args = PyTuple_Pack(1, ctx->session);
+            if (ctx->args == NULL) {
+                return NULL;
+            }
+
+            cln = ngx_pool_cleanup_add(s->connection->pool, 0);
+            if (cln == NULL) {
+                Py_CLEAR(ctx->args);
+                return NULL;
+            }
+
+            cln->handler = ngx_python_decref;
+            cln->data = ctx->args;
+        }
+
+        result = ngx_python_call(ctx->python, handler, ctx->args, wake);
+    }
 
     ngx_log_debug3(NGX_LOG_DEBUG_STREAM, s->connection->log, 0,
-                   "stream python eval end code:%p, wake:%p, result:%p",
-                   code, wake, result);
+                   "stream python eval end handler:%p, wake:%p, result:%p",
+                   handler, wake, result);
 
     return result;
 }
@@ -469,6 +629,9 @@ ngx_stream_python_create_srv_conf(ngx_conf_t *cf)
     pscf->access = NGX_CONF_UNSET_PTR;
     pscf->preread = NGX_CONF_UNSET_PTR;
     pscf->log = NGX_CONF_UNSET_PTR;
+    pscf->log_batch = NGX_CONF_UNSET_PTR;
+
+    ngx_python_create_ctx_conf(&pscf->python);
 
     return pscf;
 }
@@ -483,8 +646,9 @@ ngx_stream_python_merge_srv_conf(ngx_conf_t *cf, void *parent, void *child)
     ngx_conf_merge_ptr_value(conf->access, prev->access, NULL);
     ngx_conf_merge_ptr_value(conf->preread, prev->preread, NULL);
     ngx_conf_merge_ptr_value(conf->log, prev->log, NULL);
+    ngx_conf_merge_ptr_value(conf->log_batch, prev->log_batch, NULL);
 
-    return NGX_CONF_OK;
+    return ngx_python_merge_ctx_conf(cf, &conf->python, &prev->python);
 }
 
 
@@ -528,25 +692,25 @@ ngx_stream_python_access(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
 {
     ngx_stream_python_srv_conf_t *pscf = conf;
 
-    ngx_str_t      *value;
-    PyCodeObject  **pcode;
+    ngx_str_t   *value;
+    PyObject   **handler;
 
     value = cf->args->elts;
 
     if (pscf->access == NGX_CONF_UNSET_PTR) {
-        pscf->access = ngx_array_create(cf->pool, 1, sizeof(PyCodeObject *));
+        pscf->access = ngx_array_create(cf->pool, 1, sizeof(PyObject *));
         if (pscf->access == NULL) {
             return NGX_CONF_ERROR;
         }
     }
 
-    pcode = ngx_array_push(pscf->access);
-    if (pcode == NULL) {
+    handler = ngx_array_push(pscf->access);
+    if (handler == NULL) {
         return NGX_CONF_ERROR;
     }
 
-    *pcode = ngx_python_compile(cf, value[1].data);
-    if (*pcode == NULL) {
+    *handler = ngx_python_conf_handler(cf, cmd, value[1].data);
+    if (*handler == NULL) {
         return NGX_CONF_ERROR;
     }
 
@@ -559,25 +723,25 @@ ngx_stream_python_preread(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
 {
     ngx_stream_python_srv_conf_t *pscf = conf;
 
-    ngx_str_t      *value;
-    PyCodeObject  **pcode;
+    ngx_str_t   *value;
+    PyObject   **handler;
 
     value = cf->args->elts;
 
     if (pscf->preread == NGX_CONF_UNSET_PTR) {
-        pscf->preread = ngx_array_create(cf->pool, 1, sizeof(PyCodeObject *));
+        pscf->preread = ngx_array_create(cf->pool, 1, sizeof(PyObject *));
         if (pscf->preread == NULL) {
             return NGX_CONF_ERROR;
         }
     }
 
-    pcode = ngx_array_push(pscf->preread);
-    if (pcode == NULL) {
+    handler = ngx_array_push(pscf->preread);
+    if (handler == NULL) {
         return NGX_CONF_ERROR;
     }
 
-    *pcode = ngx_python_compile(cf, value[1].data);
-    if (*pcode == NULL) {
+    *handler = ngx_python_conf_handler(cf, cmd, value[1].data);
+    if (*handler == NULL) {
         return NGX_CONF_ERROR;
     }
 
@@ -590,25 +754,25 @@ ngx_stream_python_log(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
 {
     ngx_stream_python_srv_conf_t *pscf = conf;
 
-    ngx_str_t      *value;
-    PyCodeObject  **pcode;
+    ngx_str_t   *value;
+    PyObject   **handler;
 
     value = cf->args->elts;
 
     if (pscf->log == NGX_CONF_UNSET_PTR) {
-        pscf->log = ngx_array_create(cf->pool, 1, sizeof(PyCodeObject *));
+        pscf->log = ngx_array_create(cf->pool, 1, sizeof(PyObject *));
         if (pscf->log == NULL) {
             return NGX_CONF_ERROR;
         }
     }
 
-    pcode = ngx_array_push(pscf->log);
-    if (pcode == NULL) {
+    handler = ngx_array_push(pscf->log);
+    if (handler == NULL) {
         return NGX_CONF_ERROR;
     }
 
-    *pcode = ngx_python_compile(cf, value[1].data);
-    if (*pcode == NULL) {
+    *handler = ngx_python_conf_handler(cf, cmd, value[1].data);
+    if (*handler == NULL) {
         return NGX_CONF_ERROR;
     }
 
@@ -630,7 +794,7 @@ ngx_stream_python_content(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
         return "is duplicate";
     }
 
-    pscf->content = ngx_python_compile(cf, value[1].data);
+    pscf->content = ngx_python_conf_handler(cf, cmd, value[1].data);
     if (pscf->content == NULL) {
         return NGX_CONF_ERROR;
     }
@@ -643,6 +807,101 @@ ngx_stream_python_content(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
 }
 
 
+static char *
+ngx_stream_python_log_batch(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
+{
+    ngx_stream_python_srv_conf_t *pscf = conf;
+
+    ngx_int_t                      *index, n;
+    ngx_str_t                      *value, s;
+    ngx_uint_t                      i, size;
+    ngx_msec_t                      interval;
+    ngx_stream_python_log_batch_t  *lb;
+
+    if (pscf->log_batch != NGX_CONF_UNSET_PTR) {
+        return "is duplicate";
+    }
+
+    lb = ngx_palloc(cf->pool, sizeof(ngx_stream_python_log_batch_t));
+    if (lb == NULL) {
+        return NGX_CONF_ERROR;
+    }
+
+    lb->vars = ngx_array_create(cf->pool, 4, sizeof(ngx_int_t));
+    if (lb->vars == NULL) {
+        return NGX_CONF_ERROR;
+    }
+
+    value = cf->args->elts;
+
+    size = 100;
+    interval = 1000;
+
+    for (i = 2; i < cf->args->nelts; i++) {
+
+        if (value[i].data[0] == '$') {
+            value[i].len--;
+            value[i].data++;
+
+            index = ngx_array_push(lb->vars);
+            if (index == NULL) {
+                return NGX_CONF_ERROR;
+            }
+
+            *index = ngx_stream_get_variable_index(cf, &value[i]);
+            if (*index == NGX_ERROR) {
+                return NGX_CONF_ERROR;
+            }
+
+            continue;
+        }
+
+        if (ngx_strncmp(value[i].data, "size=", 5) == 0) {
+
+            n = ngx_atoi(value[i].data + 5, value[i].len - 5);
+            if (n == NGX_ERROR || n == 0) {
+                goto invalid;
+            }
+
+            size = n;
+
+            continue;
+        }
+
+        if (ngx_strncmp(value[i].data, "interval=", 9) == 0) {
+
+            s.len = value[i].len - 9;
+            s.data = value[i].data + 9;
+
+            interval = ngx_parse_time(&s, 0);
+            if (interval == (ngx_msec_t) NGX_ERROR) {
+                goto invalid;
+            }
+
+            continue;
+        }
+
+        goto invalid;
+    }
+
+    lb->batch = ngx_python_batch_create(cf, value[1].data, size, interval);
+    if (lb->batch == NULL) {
+        return NGX_CONF_ERROR;
+    }
+
+    pscf->log_batch = lb;
+
+    return NGX_CONF_OK;
+
+invalid:
+
+    ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                       "invalid parameter \"%V\"", &value[i]);
+
+    return NGX_CONF_ERROR;
+}
+
+
 static ngx_int_t
 ngx_stream_python_init(ngx_conf_t *cf)
 {
@@ -26,6 +26,7 @@ typedef struct {
     PyObject_HEAD
     ngx_stream_session_t          *session;
     PyObject                      *ctx;
+    PyObject                      *var;
 #if !(NGX_PYTHON_SYNC)
     PyObject                      *sock;
 #endif
@@ -177,17 +178,25 @@ ngx_stream_python_session_var(ngx_stream_python_session_t *self)
     ngx_log_debug0(NGX_LOG_DEBUG_STREAM, s->connection->log, 0,
                    "stream python var");
 
-    pv = PyObject_New(ngx_stream_python_session_var_t,
-                      &ngx_stream_python_session_var_type);
-    if (pv == NULL) {
-        return NULL;
-    }
+    /* the proxy is released in cleanup to break the reference cycle */
 
-    pv->ps = self;
+    if (self->var == NULL) {
+        pv = PyObject_New(ngx_stream_python_session_var_t,
+                          &ngx_stream_python_session_var_type);
+        if (pv == NULL) {
+            return NULL;
+        }
 
-    Py_INCREF(self);
+        pv->ps = self;
 
-    return (PyObject *) pv;
+        Py_INCREF(self);
+
+        self->var = (PyObject *) pv;
+    }
+
+    Py_INCREF(self->var);
+
+    return self->var;
 }
 
 
@@ -378,6 +387,7 @@ ngx_stream_python_session_create(ngx_stream_session_t *s)
     }
 
     ps->session = s;
+    ps->var = NULL;
 
     ps->ctx = PyDict_New();
     if (ps->ctx == NULL) {
@@ -423,5 +433,7 @@ ngx_stream_python_session_cleanup(void *data)
 
     ps->session = NULL;
 
+    Py_CLEAR(ps->var);
+
     Py_DECREF(ps);
 }
@@ -0,0 +1,105 @@
+#
+# Copyright (C) Roman Arutyunyan
+#
+
+# Access handler benchmark.
+#
+# Runs a trivial access handler with and without python_blocking and reports
+# requests per second over a single keepalive connection:
+#
+#   $ TEST_NGINX_BINARY=/path/to/nginx python t/bench_blocking.py
+
+import httplib
+import nginx
+import time
+import sys
+
+
+REQUESTS = 20000
+ROUNDS = 3
+
+
+files = [
+
+(
+'nginx.conf',
+'''
+daemon off;
+
+events {
+}
+
+http {
+    python_include foo.py;
+
+    server {
+        listen 127.0.0.1:8080;
+        server_name localhost;
+
+        location /blocking {
+            python_access access(r);
+            return 200;
+        }
+
+        location /nonblocking {
+            python_blocking off;
+            python_access access(r);
+            return 200;
+        }
+    }
+}
+'''
+),
+
+(
+'foo.py',
+r'''
+import ngx
+
+def access(r):
+    if r.hi['x-deny']:
+        return 403
+    return ngx.OK
+'''
+)
+
+]
+
+
+def bench(uri):
+    best = None
+
+    for i in range(ROUNDS):
+        c = httplib.HTTPConnection('127.0.0.1', 8080)
+        start = time.time()
+
+        for n in xrange(REQUESTS):
+            c.request('GET', uri)
+            r = c.getresponse()
+            r.read()
+
+            if r.status != 200:
+                raise Exception('unexpected status {0}'.format(r.status))
+
+        elapsed = time.time() - start
+        c.close()
+
+        if best is None or elapsed < best:
+            best = elapsed
+
+    return REQUESTS / best
+
+
+def main():
+    ngx = nginx.Run(files, ['nosync'])
+
+    try:
+        for uri in ['/blocking', '/nonblocking']:
+            print('{0:<14} {1:.0f} requests/sec'.format(uri, bench(uri)))
+
+    finally:
+        ngx.close()
+
+
+if __name__ == '__main__':
+    sys.exit(main())
@@ -0,0 +1,123 @@
+
+/*
+ * Copyright (C) Roman Arutyunyan
+ */
+
+
+/*
+ * Context switch microbenchmark.
+ *
+ * Switches back and forth between the main context and a coroutine with
+ * ngx_python_context_switch() and reports switches per second, without the
+ * event loop and Python involved.  The benchmark is built against
+ * a configured nginx source tree, with the native switch and with
+ * -DNGX_PYTHON_UCONTEXT=1 to compare it against swapcontext():
+ *
+ *   $ cd /path/to/nginx
+ *   $ for uc in 0 1; do
+ *         cc -O2 -DNGX_PYTHON_UCONTEXT=$uc \
+ *             -I objs -I src/core -I src/event -I src/os/unix \
+ *             `python-config --includes` -I /path/to/module/src \
+ *             /path/to/module/t/bench_context.c \
+ *             /path/to/module/src/ngx_python_context.c -o bench_context_$uc;
+ *         ./bench_context_$uc;
+ *     done
+ */
+
+
+#include <Python.h>
+#include <ngx_config.h>
+#include <ngx_core.h>
+#include "ngx_python.h"
+
+
+#define NGX_PYTHON_BENCH_SWITCHES  10000000
+#define NGX_PYTHON_BENCH_ROUNDS    5
+#define NGX_PYTHON_BENCH_STACK     65536
+
+
+static void ngx_python_bench_task(void);
+static double ngx_python_bench_time(void);
+
+
+static ngx_python_context_t  ngx_python_bench_main;
+static ngx_python_context_t  ngx_python_bench_coroutine;
+
+
+int
+main(int argc, char *const *argv)
+{
+    double              start, elapsed, best;
+    ngx_uint_t          i, n;
+    ngx_python_stack_t  stack;
+
+    ngx_memzero(&stack, sizeof(ngx_python_stack_t));
+
+    stack.size = NGX_PYTHON_BENCH_STACK;
+    stack.start = malloc(stack.size);
+
+    if (stack.start == NULL) {
+        fprintf(stderr, "malloc() failed\n");
+        return 1;
+    }
+
+    if (ngx_python_context_make(&ngx_python_bench_coroutine,
+                                &ngx_python_bench_main, &stack,
+                                &ngx_python_bench_task)
+        != NGX_OK)
+    {
+        fprintf(stderr, "context make failed\n");
+        return 1;
+    }
+
+    best = 0;
+
+    for (n = 0; n < NGX_PYTHON_BENCH_ROUNDS; n++) {
+        start = ngx_python_bench_time();
+
+        /* each iteration switches to the coroutine and back */
+
+        for (i = 0; i < NGX_PYTHON_BENCH_SWITCHES / 2; i++) {
+            if (ngx_python_context_switch(&ngx_python_bench_main,
+                                          &ngx_python_bench_coroutine)
+                != NGX_OK)
+            {
+                fprintf(stderr, "context switch failed\n");
+                return 1;
+            }
+        }
+
+        elapsed = ngx_python_bench_time() - start;
+
+        if (best == 0 || elapsed < best) {
+            best = elapsed;
+        }
+    }
+
+    printf("%s: %d switches in %.3fs, %.0f switches/sec\n",
+           NGX_PYTHON_UCONTEXT ? "swapcontext" : "native",
+           NGX_PYTHON_BENCH_SWITCHES, best, NGX_PYTHON_BENCH_SWITCHES / best);
+
+    return 0;
+}
+
+
+static void
+ngx_python_bench_task(void)
+{
+    for ( ;; ) {
+        (void) ngx_python_context_switch(&ngx_python_bench_coroutine,
+                                         &ngx_python_bench_main);
+    }
+}
+
+
+static double
+ngx_python_bench_time(void)
+{
+    struct timespec  ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
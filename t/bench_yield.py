@@ -0,0 +1,98 @@
+#
+# Copyright (C) Roman Arutyunyan
+#
+
+# Event loop round trip benchmark.
+#
+# Each time.sleep(0) call in the content handler yields to nginx, adds a
+# timer and is resumed from the request handler in the next event loop
+# iteration.  A round trip includes two context switches, but is dominated
+# by the event loop, so differences between binaries built with and without
+# -DNGX_PYTHON_UCONTEXT=1 only show as a part of the total.  The switch itself
+# is measured by t/bench_context.c.
+#
+#   $ TEST_NGINX_BINARY=/path/to/nginx python t/bench_yield.py
+
+import httplib
+import nginx
+import time
+import sys
+
+
+ITERATIONS = 100000
+REQUESTS = 5
+
+
+files = [
+
+(
+'nginx.conf',
+'''
+daemon off;
+
+events {
+}
+
+http {
+    python_include foo.py;
+
+    server {
+        listen 127.0.0.1:8080;
+        server_name localhost;
+
+        location / {
+            python_content "content(r, int(r.arg['n']))";
+        }
+    }
+}
+'''
+),
+
+(
+'foo.py',
+r'''
+import ngx
+import time
+
+def content(r, n):
+    for i in xrange(n):
+        time.sleep(0)
+
+    r.status = 200
+    r.sendHeader()
+    r.send(None, ngx.SEND_LAST)
+'''
+)
+
+]
+
+
+def main():
+    ngx = nginx.Run(files, ['nosync'])
+
+    try:
+        best = None
+
+        for i in range(REQUESTS):
+            start = time.time()
+            c = httplib.HTTPConnection('127.0.0.1', 8080)
+            c.request('GET', '/?n={0}'.format(ITERATIONS))
+            r = c.getresponse()
+            r.read()
+            elapsed = time.time() - start
+
+            if r.status != 200:
+                raise Exception('unexpected status {0}'.format(r.status))
+
+            if best is None or elapsed < best:
+                best = elapsed
+
+        print('{0} yields in {1:.3f}s, {2:.0f} round trips/sec'.format(
+              ITERATIONS, best, ITERATIONS / best))
+
+    finally:
+        ngx.close()
+
+
+if __name__ == '__main__':
+    sys.exit(main())
@@ -29,6 +29,9 @@ class Run:
         if 'stream' in rset and not re.search('--with-stream([^-].*)?$', cf):
             raise unittest.SkipTest('nginx is built without stream')
 
+        if 'threads' in rset and not re.search('--with-threads', cf):
+            raise unittest.SkipTest('nginx is built without threads')
+
         if 'nosync' in rset and re.search('-DNGX_PYTHON_SYNC=0*[1-9]', cf):
             raise unittest.SkipTest('nginx-python-module is built sync')
 
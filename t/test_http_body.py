@@ -0,0 +1,137 @@
+
+#
+# Copyright (C) Roman Arutyunyan
+#
+
+import unittest
+import nginx
+import sys
+
+
+files = [
+
+(
+'nginx.conf',
+'''
+daemon off;
+
+events {
+}
+
+http {
+    python "import ngx";
+
+    python_include foo.py;
+
+    server {
+        listen 127.0.0.1:8080;
+        server_name localhost;
+
+        location /body {
+            python_content body(r);
+        }
+
+        location /body_memoryview {
+            python_content body_memoryview(r);
+        }
+
+        location /body_retained {
+            python_content body_retained(r);
+        }
+
+        location /body_finalized {
+            python_content body_finalized(r);
+        }
+
+        location /body_file {
+            client_body_in_file_only clean;
+            python_content body_file(r);
+        }
+    }
+}
+'''
+),
+
+(
+'foo.py',
+r'''
+def reply(r, s):
+    r.status = 200
+    r.ho['Content-Length'] = len(s)
+    r.sendHeader()
+    r.send(s, ngx.SEND_LAST)
+
+def body(r):
+    b = r.body
+    reply(r, '%d:%s' % (len(b), str(b)))
+
+def body_memoryview(r):
+    m = memoryview(r.body)
+    reply(r, m[3:].tobytes())
+
+retained = []
+
+def body_retained(r):
+    s = ''.join(m.tobytes() for m in retained)
+    retained.append(memoryview(r.body))
+    reply(r, s)
+
+kept = []
+
+def body_finalized(r):
+    try:
+        s = str(kept.pop()) if kept else 'none'
+    except ngx.HTTPRequestError:
+        s = 'finalized'
+    kept.append(r.body)
+    reply(r, s)
+
+def body_file(r):
+    reply(r, '%s:%s' % (r.body, open(r.bodyFile).read()))
+'''
+)
+
+]
+
+
+class HTTPBodyTestCase(nginx.HTTPTestCase):
+
+    @classmethod
+    def setUpClass(cls):
+        cls.ngx = nginx.Run(files)
+
+    @classmethod
+    def tearDownClass(cls):
+        cls.ngx.close()
+
+    def test_body(self):
+        r = self.http('/body', body='FOOBAR')
+        self.assertEqual(r.read(), '6:FOOBAR')
+
+    def test_body_empty(self):
+        r = self.http('/body', method='POST', body='')
+        self.assertEqual(r.read(), '0:')
+
+    def test_body_memoryview(self):
+        r = self.http('/body_memoryview', body='FOOBAR')
+        self.assertEqual(r.read(), 'BAR')
+
+    def test_body_retained(self):
+        self.http('/body_retained', body='FOOBAR').read()
+        r = self.http('/body_retained', body='XYZ')
+        self.assertEqual(r.read(), 'FOOBAR')
+        r = self.http('/body_retained', body='')
+        self.assertEqual(r.read(), 'FOOBARXYZ')
+
+    def test_body_finalized(self):
+        self.http('/body_finalized', body='FOOBAR').read()
+        r = self.http('/body_finalized', body='XYZ')
+        self.assertEqual(r.read(), 'finalized')
+
+    def test_body_file(self):
+        r = self.http('/body_file', body='FOOBAR')
+        self.assertEqual(r.read(), 'None:FOOBAR')
+
+
+if __name__ == '__main__':
+    unittest.main(argv=sys.argv)
@@ -0,0 +1,121 @@
+
+#
+# Copyright (C) Roman Arutyunyan
+#
+
+import unittest
+import nginx
+import signal
+import time
+import sys
+import os
+import re
+
+
+files = [
+
+(
+'nginx.conf',
+'''
+daemon off;
+
+events {
+}
+
+http {
+    python_include foo.py;
+
+    server {
+        listen 127.0.0.1:8080;
+        server_name localhost;
+
+        location /fail {
+            python_error_limit 1;
+            python_log fail(r);
+            return 200;
+        }
+
+        location /errorstats {
+            python_content errorstats(r);
+        }
+    }
+}
+'''
+),
+
+(
+'foo.py',
+r'''
+import ngx
+
+def fail(r):
+    raise Exception('failed in log handler')
+
+def errorstats(r):
+    s = ngx.errorstats()
+    n = sum(v for k, v in s.items() if k.endswith(':fail:4'))
+    r.status = 200
+    r.sendHeader()
+    r.send(str(n), ngx.SEND_LAST)
+'''
+)
+
+]
+
+
+class HTTPErrorTestCase(nginx.HTTPTestCase):
+
+    @classmethod
+    def setUpClass(cls):
+        cls.ngx = nginx.Run(files)
+
+    @classmethod
+    def tearDownClass(cls):
+        cls.ngx.close()
+
+    def test_error_limit(self):
+        for i in range(5):
+            r = self.http('/fail')
+            self.assertEqual(r.status, 200)
+            r.read()
+
+        r = self.http('/errorstats')
+        self.assertEqual(r.status, 200)
+        self.assertEqual(r.read(), '5')
+
+        log = open(self.ngx.log_file).read()
+        self.assertIn('failed in log handler [', log)
+        self.assertIn('foo.py:5]', log)
+        self.assertLess(log.count('failed in log handler'), 5)
+
+        # suppressed errors are counted a second later
+        time.sleep(1.2)
+
+        log = open(self.ngx.log_file).read()
+        n = sum(int(m) for m in
+                re.findall('python (\d+) error\(s\) suppressed', log))
+        self.assertGreater(n, 0)
+        self.assertEqual(log.count('failed in log handler') + n, 5)
+
+    def test_error_limit_exit(self):
+        offset = len(open(self.ngx.log_file).read())
+
+        for i in range(3):
+            r = self.http('/fail')
+            self.assertEqual(r.status, 200)
+            r.read()
+
+        # the exiting worker logs the count without waiting for the timer
+
+        os.kill(self.ngx.pid, signal.SIGHUP)
+        time.sleep(0.5)
+
+        log = open(self.ngx.log_file).read()[offset:]
+        n = sum(int(m) for m in
+                re.findall('python (\d+) error\(s\) suppressed', log))
+        self.assertGreater(n, 0)
+        self.assertEqual(log.count('failed in log handler') + n, 3)
+
+
+if __name__ == '__main__':
+    unittest.main(argv=sys.argv)
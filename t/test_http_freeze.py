@@ -0,0 +1,103 @@
+
+#
+# Copyright (C) Roman Arutyunyan
+#
+
+import unittest
+import nginx
+import sys
+
+
+files = [
+
+(
+'nginx.conf',
+'''
+daemon off;
+
+events {
+}
+
+python_freeze on;
+
+http {
+    python_include foo.py;
+
+    server {
+        listen 127.0.0.1:8080;
+        server_name localhost;
+
+        location /content {
+            python_content content(r);
+        }
+
+        location /meminfo {
+            python_content meminfo(r);
+        }
+    }
+}
+'''
+),
+
+(
+'foo.py',
+r'''
+import ngx
+import gc
+
+data = [{'key': str(i)} for i in range(10000)]
+
+def content(r):
+    gc.collect()
+    tracked = set(id(o) for o in gc.get_objects())
+    r.status = 200
+    r.sendHeader()
+    r.send('%d %d %d' % (ngx.gcstats()['frozen'], id(data) in tracked,
+                         id(data[0]) in tracked),
+           ngx.SEND_LAST)
+
+def meminfo(r):
+    m = ngx.meminfo()
+    r.status = 200
+    r.sendHeader()
+    r.send(str(m['rss'] > 0 and m['rss'] >= m['private_dirty']),
+           ngx.SEND_LAST)
+'''
+)
+
+]
+
+
+class HTTPFreezeTestCase(nginx.HTTPTestCase):
+
+    @classmethod
+    def setUpClass(cls):
+        cls.ngx = nginx.Run(files)
+
+    @classmethod
+    def tearDownClass(cls):
+        cls.ngx.close()
+
+    def test_content(self):
+        r = self.http('/content')
+        self.assertEqual(r.status, 200)
+
+        frozen, list_tracked, dict_tracked = map(int, r.read().split())
+
+        # data list and its 10000 dicts are frozen along with the module
+
+        self.assertGreaterEqual(frozen, 10001)
+        self.assertEqual(list_tracked, 0)
+        self.assertEqual(dict_tracked, 0)
+
+    def test_meminfo(self):
+        if not sys.platform.startswith('linux'):
+            raise unittest.SkipTest('meminfo is only available on Linux')
+
+        r = self.http('/meminfo')
+        self.assertEqual(r.status, 200)
+        self.assertEqual(r.read(), 'True')
+
+
+if __name__ == '__main__':
+    unittest.main(argv=sys.argv)
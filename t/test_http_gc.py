@@ -0,0 +1,97 @@
+
+#
+# Copyright (C) Roman Arutyunyan
+#
+
+import unittest
+import nginx
+import sys
+
+
+files = [
+
+(
+'nginx.conf',
+'''
+daemon off;
+
+events {
+}
+
+python_gc off;
+python_gc_interval 0;
+python_gc_requests 1;
+
+http {
+    python_include foo.py;
+
+    server {
+        listen 127.0.0.1:8080;
+        server_name localhost;
+
+        location /garbage {
+            python_content garbage(r);
+        }
+
+        location /gcstats {
+            python_content gcstats(r);
+        }
+    }
+}
+'''
+),
+
+(
+'foo.py',
+r'''
+import ngx
+import gc
+
+class Node:
+    pass
+
+def garbage(r):
+    for i in range(2000):
+        n = Node()
+        n.self = n
+    r.status = 200
+    r.sendHeader()
+    r.send(str(gc.isenabled()), ngx.SEND_LAST)
+
+def gcstats(r):
+    s = ngx.gcstats()
+    r.status = 200
+    r.sendHeader()
+    r.send('{0} {1}'.format(s['collections'] > 0, s['collected'] > 0),
+           ngx.SEND_LAST)
+'''
+)
+
+]
+
+
+class HTTPGCTestCase(nginx.HTTPTestCase):
+
+    @classmethod
+    def setUpClass(cls):
+        cls.ngx = nginx.Run(files)
+
+    @classmethod
+    def tearDownClass(cls):
+        cls.ngx.close()
+
+    def test_gc(self):
+        r = self.http('/garbage')
+        self.assertEqual(r.status, 200)
+        self.assertEqual(r.read(), 'False')
+
+        r = self.http('/garbage')
+        r.read()
+
+        r = self.http('/gcstats')
+        self.assertEqual(r.status, 200)
+        self.assertEqual(r.read(), 'True True')
+
+
+if __name__ == '__main__':
+    unittest.main(argv=sys.argv)
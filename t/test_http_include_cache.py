@@ -0,0 +1,112 @@
+
+#
+# Copyright (C) Roman Arutyunyan
+#
+
+import unittest
+import hashlib
+import signal
+import nginx
+import time
+import sys
+import os
+
+
+files = [
+
+(
+'nginx.conf',
+'''
+daemon off;
+
+events {
+}
+
+python_include_cache logs;
+
+http {
+    python_include foo.py;
+
+    server {
+        listen 127.0.0.1:8080;
+        server_name localhost;
+
+        location /content {
+            python_content content(r);
+        }
+    }
+}
+'''
+),
+
+(
+'foo.py',
+r'''
+import ngx
+
+def content(r):
+    r.status = 200
+    r.sendHeader()
+    r.send('cached', ngx.SEND_LAST)
+'''
+)
+
+]
+
+
+class HTTPIncludeCacheTestCase(nginx.HTTPTestCase):
+
+    @classmethod
+    def setUpClass(cls):
+        cls.ngx = nginx.Run(files)
+
+    @classmethod
+    def tearDownClass(cls):
+        cls.ngx.close()
+
+    def test_content(self):
+        r = self.http('/content')
+        self.assertEqual(r.status, 200)
+        self.assertEqual(r.read(), 'cached')
+
+    def test_cache_file(self):
+        path = '{0}/foo.py'.format(self.ngx.test_dir)
+        name = '{0}/logs/{1}.pyc'.format(self.ngx.test_dir,
+                                         hashlib.md5(path).hexdigest())
+        self.assertTrue(os.path.exists(name))
+
+    def test_reload(self):
+        path = '{0}/foo.py'.format(self.ngx.test_dir)
+        name = '{0}/logs/{1}.pyc'.format(self.ngx.test_dir,
+                                         hashlib.md5(path).hexdigest())
+
+        # the cache file is replaced by rename() each time it is written
+
+        ino = os.stat(name).st_ino
+
+        # unchanged source, the cache is used
+
+        os.kill(self.ngx.pid, signal.SIGHUP)
+        time.sleep(1)
+
+        r = self.http('/content')
+        self.assertEqual(r.read(), 'cached')
+        self.assertEqual(os.stat(name).st_ino, ino)
+
+        # changed source, the cache is stale and written again
+
+        self.ngx.writeFile('foo.py', files[1][1].replace('cached', 'changed!'))
+        os.kill(self.ngx.pid, signal.SIGHUP)
+
+        for i in range(50):
+            time.sleep(0.1)
+            body = self.http('/content').read()
+            if body == 'changed!':
+                break
+
+        self.assertEqual(body, 'changed!')
+        self.assertNotEqual(os.stat(name).st_ino, ino)
+
+
+if __name__ == '__main__':
+    unittest.main(argv=sys.argv)
@@ -0,0 +1,102 @@
+
+#
+# Copyright (C) Roman Arutyunyan
+#
+
+import unittest
+import nginx
+import time
+import sys
+
+
+files = [
+
+(
+'nginx.conf',
+'''
+daemon off;
+
+events {
+}
+
+http {
+    python_include foo.py;
+
+    server {
+        listen 127.0.0.1:8080;
+        server_name localhost;
+
+        location /size {
+            python_log_batch collect size=3 $uri $status $http_x_missing;
+            return 200;
+        }
+
+        location /interval {
+            python_log_batch collect interval=100ms $uri;
+            return 200;
+        }
+
+        location /batches {
+            python_content show(r);
+        }
+    }
+}
+'''
+),
+
+(
+'foo.py',
+r'''
+import ngx
+
+batches = []
+
+def collect(records):
+    batches.append(records)
+
+def show(r):
+    r.status = 200
+    r.sendHeader()
+    r.send(repr(batches), ngx.SEND_LAST)
+    del batches[:]
+'''
+)
+
+]
+
+
+class HTTPLogBatchTestCase(nginx.HTTPTestCase):
+
+    @classmethod
+    def setUpClass(cls):
+        cls.ngx = nginx.Run(files)
+
+    @classmethod
+    def tearDownClass(cls):
+        cls.ngx.close()
+
+    def request(self, uri):
+        r = self.http(uri)
+        self.assertEqual(r.status, 200)
+        return r.read()
+
+    def test_batch(self):
+        self.request('/batches')
+
+        for i in range(3):
+            self.request('/size')
+
+        record = ('/size', '200', None)
+        self.assertEqual(self.request('/batches'), repr([[record] * 3]))
+
+        self.request('/interval')
+        self.request('/interval')
+
+        time.sleep(0.3)
+
+        record = ('/interval',)
+        self.assertEqual(self.request('/batches'), repr([[record] * 2]))
+
+
+if __name__ == '__main__':
+    unittest.main(argv=sys.argv)
@@ -0,0 +1,90 @@
+
+#
+# Copyright (C) Roman Arutyunyan
+#
+
+import unittest
+import nginx
+import sys
+
+
+files = [
+
+(
+'nginx.conf',
+'''
+daemon off;
+
+events {
+}
+
+http {
+    python "import ngx";
+
+    python_include foo.py;
+
+    server {
+        listen 127.0.0.1:8080;
+        server_name localhost;
+
+        python_output_buffer 16;
+
+        location /rows {
+            python_content rows(r);
+        }
+
+        location /mixed {
+            python_content mixed(r);
+        }
+    }
+}
+'''
+),
+
+(
+'foo.py',
+r'''
+def rows(r):
+    r.status = 200
+    r.ho['Content-Length'] = 1000 * 4
+    r.sendHeader()
+    for i in range(1000):
+        r.send('%03d\n' % i, ngx.SEND_FLUSH if i % 100 == 0 else 0)
+    r.send(None, ngx.SEND_LAST)
+
+def mixed(r):
+    r.status = 200
+    r.ho['Content-Length'] = 3 + 32 + 3 + 6 + 3
+    r.sendHeader()
+    r.send('FOO')
+    r.send('X' * 32)
+    r.send(u'BAR')
+    r.sendv(['BAZ', 'QUX'])
+    r.send('END', ngx.SEND_LAST)
+'''
+)
+
+]
+
+
+class HTTPOutputBufferTestCase(nginx.HTTPTestCase):
+
+    @classmethod
+    def setUpClass(cls):
+        cls.ngx = nginx.Run(files)
+
+    @classmethod
+    def tearDownClass(cls):
+        cls.ngx.close()
+
+    def test_rows(self):
+        r = self.http('/rows')
+        self.assertEqual(r.read(), ''.join('%03d\n' % i for i in range(1000)))
+
+    def test_mixed(self):
+        r = self.http('/mixed')
+        self.assertEqual(r.read(), 'FOO' + 'X' * 32 + 'BARBAZQUXEND')
+
+
+if __name__ == '__main__':
+    unittest.main(argv=sys.argv)
@@ -5,8 +5,10 @@
 
 import unittest
 import nginx
+import socket
 import time
 import sys
+import os
 
 
 files = [
@@ -45,6 +47,19 @@ http {
         location /request_body {
             python_content request_body(r);
         }
+
+        location /access_handler {
+            python_access_handler access;
+        }
+
+        location /content_handler {
+            python_content_handler content;
+        }
+
+        location /abort {
+            python_content_handler sleep;
+            python_log_handler log;
+        }
     }
 }
 '''
@@ -53,6 +68,8 @@ http {
 (
 'foo.py',
 r'''
+import time
+
 def access(r):
     if r.arg['foo'] == 'x':
         return 456
@@ -71,6 +88,12 @@ def content(r):
     r.send('FOOBAR');
     r.send('XYZ', ngx.SEND_LAST)
 
+def sleep(r):
+    time.sleep(1)
+    r.status = 200
+    r.sendHeader()
+    r.send('SLEEP', ngx.SEND_LAST)
+
 def request_body(r):
     s = r.var['request_body']
     r.status = 200
@@ -117,6 +140,32 @@ class HTTPPhasesTestCase(nginx.HTTPTestCase):
         r = self.http('/content')
         self.assertEqual(r.read(), 'FOOBARXYZ')
 
+    def test_access_handler(self):
+        r = self.http('/access_handler?foo=x')
+        self.assertEqual(r.status, 456)
+
+    def test_content_handler(self):
+        r = self.http('/content_handler')
+        self.assertEqual(r.read(), 'FOOBARXYZ')
+
+    def test_abort(self):
+        s = socket.create_connection(('127.0.0.1', 8080))
+        s.sendall('GET /abort HTTP/1.0\r\n\r\n')
+        time.sleep(0.2)
+        s.close()
+
+        # the log handler runs while the content handler is sleeping,
+        # or after it is over if the module is built sync
+        path = self.__class__.ngx.test_dir + '/test-log'
+        for i in range(20):
+            if os.path.exists(path):
+                break
+            time.sleep(0.1)
+        self.assertEqual(open(path).read(), 'FOOBAR')
+
+        r = self.http('/content')
+        self.assertEqual(r.read(), 'FOOBARXYZ')
+
     def test_request_body(self):
         r = self.http('/request_body', body='FOOBAR')
         self.assertEqual(r.read(), 'FOOBAR')
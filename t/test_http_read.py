@@ -0,0 +1,121 @@
+
+#
+# Copyright (C) Roman Arutyunyan
+#
+
+import unittest
+import httplib
+import nginx
+import time
+import sys
+
+
+files = [
+
+(
+'nginx.conf',
+'''
+daemon off;
+
+events {
+}
+
+http {
+    python "import ngx";
+
+    python_include foo.py;
+
+    server {
+        listen 127.0.0.1:8080;
+        server_name localhost;
+
+        location /read {
+            python_request_buffering off;
+            python_content read(r);
+        }
+
+        location /readinto {
+            python_request_buffering off;
+            python_content readinto(r);
+        }
+
+        location /read_buffered {
+            python_content read(r);
+        }
+    }
+}
+'''
+),
+
+(
+'foo.py',
+r'''
+def reply(r, s):
+    r.status = 200
+    r.ho['Content-Length'] = len(s)
+    r.sendHeader()
+    r.send(s, ngx.SEND_LAST)
+
+def read(r):
+    chunks = []
+    while True:
+        s = r.read(4)
+        if not s:
+            break
+        chunks.append(s)
+    reply(r, '|'.join(chunks))
+
+def readinto(r):
+    b = bytearray(1024)
+    n = 0
+    while True:
+        k = r.readinto(memoryview(b)[n:])
+        if k == 0:
+            break
+        n += k
+    reply(r, str(b[:n]))
+'''
+)
+
+]
+
+
+class HTTPReadTestCase(nginx.HTTPTestCase):
+
+    @classmethod
+    def setUpClass(cls):
+        cls.ngx = nginx.Run(files, ['nosync'])
+
+    @classmethod
+    def tearDownClass(cls):
+        cls.ngx.close()
+
+    def post(self, uri, parts):
+        c = httplib.HTTPConnection('127.0.0.1', 8080)
+        c.putrequest('POST', uri)
+        c.putheader('Content-Length', sum(len(p) for p in parts))
+        c.endheaders()
+        for p in parts:
+            time.sleep(0.1)
+            c.send(p)
+        return c.getresponse()
+
+    def test_read(self):
+        r = self.post('/read', ['FOO', 'BARXYZ'])
+        self.assertEqual(r.read(), 'FOO|BARX|YZ')
+
+    def test_readinto(self):
+        r = self.post('/readinto', ['FOO', 'BAR', 'XYZ'])
+        self.assertEqual(r.read(), 'FOOBARXYZ')
+
+    def test_read_buffered(self):
+        r = self.post('/read_buffered', ['FOO', 'BARXYZ'])
+        self.assertEqual(r.read(), 'FOOB|ARXY|Z')
+
+    def test_read_empty(self):
+        r = self.http('/read')
+        self.assertEqual(r.read(), '')
+
+
+if __name__ == '__main__':
+    unittest.main(argv=sys.argv)
@@ -67,6 +67,26 @@ http {
         location /send {
             python_content content3(r);
         }
+
+        location /send_buffer {
+            python_content content4(r);
+        }
+
+        location /send_file {
+            python_content content5(r);
+        }
+
+        location /sendv {
+            python_content content6(r);
+        }
+
+        location /headers {
+            python_content content7(r);
+        }
+
+        location /headers_out {
+            python_content content8(r);
+        }
     }
 }
 '''
@@ -101,10 +121,66 @@ def content3(r):
     r.send('FOO')
     r.send('BAR', ngx.SEND_FLUSH)
     r.send('QUX', ngx.SEND_LAST)
+
+def content4(r):
+    b = bytearray('FOOBAR' * 10000)
+    r.status = 200
+    r.ho['Content-Length'] = len(b) + 6
+    r.sendHeader()
+    r.send(b, ngx.SEND_FLUSH)
+    r.send(memoryview('XYZQUX')[:3])
+    r.send(u'QUX', ngx.SEND_LAST)
+
+def content5(r):
+    try:
+        r.sendFile('nonexistent')
+    except IOError:
+        pass
+    r.status = 200
+    r.ho['Content-Length'] = 8
+    r.sendHeader()
+    r.sendFile('file', 3, 3)
+    r.sendFile('file', 4)
+    r.sendFile('file', 0, 0, ngx.SEND_LAST)
+
+def content6(r):
+    r.status = 200
+    r.ho['Content-Length'] = 12
+    r.sendHeader()
+    r.sendv([])
+    r.sendv(['FOO', bytearray('BAR'), '', None], ngx.SEND_FLUSH)
+    r.sendv(s for s in ('XYZ', 'QUX'))
+    r.sendv((), ngx.SEND_LAST)
+
+def content7(r):
+    names = [k.lower() for k in r.hi.keys()]
+    items = dict((k.lower(), v) for k, v in r.hi.items())
+    r.status = 200
+    r.ho['X-Len'] = len(r.hi) == len(names)
+    r.ho['X-Host'] = r.hi['HOST'] == items['host']
+    r.ho['X-Foo'] = ','.join(r.hi.get_all('x-foo'))
+    r.ho['X-None'] = r.hi.get_all('x-none') == [] and r.hi['x-none'] == ''
+    r.ho['X-Out'] = len(r.ho) == 4 and r.ho.get_all('x-foo') == ['FOO']
+    r.ho['X-Same'] = r.hi is r.hi and r.ho is r.ho and r.var is r.var
+    r.sendHeader()
+    r.send(None, ngx.SEND_LAST)
+
+def content8(r):
+    r.status = 200
+    r.ho['content-type'] = 'text/x-foo; a=b'
+    r.ho['Content-Length'] = 3
+    r.ho['Last-Modified'] = 'Sat, 01 Jan 2000 00:00:00 GMT'
+    r.ho['Server'] = 'foo'
+    r.ho['Location'] = '/x'
+    r.ho['X-Type'] = r.ho['Content-Type']
+    r.sendHeader()
+    r.send('FOO', ngx.SEND_LAST)
 '''
 ),
 
-('ctx', 'FOOBAR')
+('ctx', 'FOOBAR'),
+
+('file', 'FOOBARXYZ')
 
 ]
 
@@ -163,6 +239,42 @@ class HTTPRequestTestCase(nginx.HTTPTestCase):
         r = self.http('/send')
         self.assertEqual(r.read(), 'FOOBARQUX')
 
+    def test_send_buffer(self):
+        r = self.http('/send_buffer')
+        self.assertEqual(r.read(), 'FOOBAR' * 10000 + 'XYZQUX')
+
+    def test_send_file(self):
+        r = self.http('/send_file')
+        self.assertEqual(r.read(), 'BARARXYZ')
+
+    def test_sendv(self):
+        r = self.http('/sendv')
+        self.assertEqual(r.read(), 'FOOBARXYZQUX')
+
+    def test_headers(self):
+        r = self.http('/headers', headers={ 'X-Foo': 'FOO' })
+        self.assertEqual(r.getheader('X-Len'), 'True')
+        self.assertEqual(r.getheader('X-Host'), 'True')
+        self.assertEqual(r.getheader('X-Foo'), 'FOO')
+        self.assertEqual(r.getheader('X-None'), 'True')
+        self.assertEqual(r.getheader('X-Out'), 'True')
+        self.assertEqual(r.getheader('X-Same'), 'True')
+
+    def test_headers_out(self):
+        r = self.http('/headers_out')
+        self.assertEqual(r.status, 200)
+        self.assertEqual(r.getheader('Content-Type'), 'text/x-foo; a=b')
+        self.assertEqual(r.getheader('X-Type'), 'text/x-foo; a=b')
+        self.assertEqual(r.getheader('Content-Length'), '3')
+        self.assertEqual(r.getheader('Transfer-Encoding'), None)
+        self.assertEqual(r.getheader('Server'), 'foo')
+        self.assertEqual(r.getheader('Location'), '/x')
+        self.assertEqual(r.read(), 'FOO')
+
+        r = self.http('/headers_out', headers={
+            'If-Modified-Since': 'Sat, 01 Jan 2000 00:00:00 GMT' })
+        self.assertEqual(r.status, 304)
+
 
 if __name__ == '__main__':
     unittest.main(argv=sys.argv)
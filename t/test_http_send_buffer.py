@@ -0,0 +1,125 @@
+
+#
+# Copyright (C) Roman Arutyunyan
+#
+
+import unittest
+import socket
+import nginx
+import time
+import sys
+
+
+files = [
+
+(
+'nginx.conf',
+'''
+daemon off;
+
+events {
+}
+
+http {
+    python "import ngx";
+
+    python_include foo.py;
+
+    server {
+        listen 127.0.0.1:8080 sndbuf=64k;
+        server_name localhost;
+
+        location /send {
+            python_send_buffer 64k;
+            python_content "send(r, progress)";
+        }
+
+        location /progress {
+            python_content "reply(r, str(progress[0]))";
+        }
+
+        location /timeout {
+            python_send_buffer 64k;
+            send_timeout 500ms;
+            python_content send(r);
+        }
+    }
+}
+'''
+),
+
+(
+'foo.py',
+r'''
+progress = [0]
+
+def reply(r, s):
+    r.status = 200
+    r.sendHeader()
+    r.send(s, ngx.SEND_LAST)
+
+def send(r, done=None):
+    r.status = 200
+    r.ho['Content-Length'] = 64 * 100000
+    r.sendHeader()
+    try:
+        for i in range(100000):
+            r.send('%063d\n' % i)
+            if done:
+                done[0] = i + 1
+    except ngx.HTTPRequestError as e:
+        r.log('send failed: ' + str(e), ngx.LOG_ERR)
+        raise
+    r.send(None, ngx.SEND_LAST)
+'''
+)
+
+]
+
+
+class HTTPSendBufferTestCase(nginx.HTTPTestCase):
+
+    @classmethod
+    def setUpClass(cls):
+        cls.ngx = nginx.Run(files, ['nosync'])
+
+    @classmethod
+    def tearDownClass(cls):
+        cls.ngx.close()
+
+    def test_send(self):
+        s = socket.create_connection(('127.0.0.1', 8080))
+        s.setsockopt(socket.SOL_SOCKET, socket.SO_RCVBUF, 4096)
+        s.sendall('GET /send HTTP/1.0\r\n\r\n')
+        time.sleep(0.5) # let the output fill the send buffer
+
+        # the handler is suspended while the client does not read
+        r = self.http('/progress')
+        done = int(r.read())
+        self.assertGreater(done, 0)
+        self.assertLess(done, 10000)
+
+        data = ''
+        while True:
+            b = s.recv(65536)
+            if not b:
+                break
+            data += b
+        s.close()
+
+        self.assertTrue(data.endswith('%063d\n' % 99999))
+        self.assertEqual(len(data.split('\r\n\r\n', 1)[1]), 64 * 100000)
+
+    def test_timeout(self):
+        s = socket.create_connection(('127.0.0.1', 8080))
+        s.setsockopt(socket.SOL_SOCKET, socket.SO_RCVBUF, 4096)
+        s.sendall('GET /timeout HTTP/1.0\r\n\r\n')
+        time.sleep(1)
+        s.close()
+
+        log = open(self.__class__.ngx.log_file).read()
+        self.assertIn('send failed: client timed out', log)
+
+
+if __name__ == '__main__':
+    unittest.main(argv=sys.argv)
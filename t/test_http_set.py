@@ -0,0 +1,114 @@
+
+#
+# Copyright (C) Roman Arutyunyan
+#
+
+import unittest
+import nginx
+import time
+import sys
+
+
+files = [
+
+(
+'nginx.conf',
+'''
+daemon off;
+
+events {
+}
+
+http {
+    python_include foo.py;
+
+    python_set $nocache "count()";
+    python_set $cache "count()" cache;
+    python_set $memo "count()" key=$arg_a max=2;
+    python_set $ttl "count()" key=$arg_a ttl=500ms;
+
+    server {
+        listen 127.0.0.1:8080;
+        server_name localhost;
+
+        location /nocache {
+            return 200 "$nocache $nocache";
+        }
+
+        location /cache {
+            return 200 "$cache $cache";
+        }
+
+        location /memo {
+            return 200 "$memo";
+        }
+
+        location /ttl {
+            return 200 "$ttl";
+        }
+    }
+}
+'''
+),
+
+(
+'foo.py',
+r'''
+n = 0
+
+def count():
+    global n
+    n += 1
+    return n
+'''
+)
+
+]
+
+
+class HTTPSetTestCase(nginx.HTTPTestCase):
+
+    @classmethod
+    def setUpClass(cls):
+        cls.ngx = nginx.Run(files)
+
+    @classmethod
+    def tearDownClass(cls):
+        cls.ngx.close()
+
+    def get(self, uri):
+        r = self.http(uri)
+        self.assertEqual(r.status, 200)
+        return r.read()
+
+    def test_nocache(self):
+        a, b = self.get('/nocache').split()
+        self.assertNotEqual(a, b)
+
+    def test_cache(self):
+        a, b = self.get('/cache').split()
+        self.assertEqual(a, b)
+
+    def test_memo(self):
+        a = self.get('/memo?a=1')
+        self.assertEqual(self.get('/memo?a=1'), a)
+
+        b = self.get('/memo?a=2')
+        self.assertNotEqual(b, a)
+        self.assertEqual(self.get('/memo?a=2'), b)
+
+        # the oldest key is evicted
+        self.get('/memo?a=3')
+        self.assertNotEqual(self.get('/memo?a=1'), a)
+
+    def test_ttl(self):
+        a = self.get('/ttl?a=1')
+        self.assertEqual(self.get('/ttl?a=1'), a)
+
+        time.sleep(0.6)
+
+        self.assertNotEqual(self.get('/ttl?a=1'), a)
+
+
+if __name__ == '__main__':
+    unittest.main(argv=sys.argv)
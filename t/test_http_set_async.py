@@ -0,0 +1,85 @@
+
+#
+# Copyright (C) Roman Arutyunyan
+#
+
+import unittest
+import nginx
+import sys
+
+
+files = [
+
+(
+'nginx.conf',
+'''
+daemon off;
+
+events {
+}
+
+http {
+    python_include foo.py;
+
+    server {
+        listen 127.0.0.1:8080;
+        server_name localhost;
+
+        python_set_async $route "lookup(r)";
+
+        location /route {
+            python_content show(r);
+        }
+
+        location /other {
+            python_set_async $route "'other'";
+            python_content show(r);
+        }
+    }
+}
+'''
+),
+
+(
+'foo.py',
+r'''
+import ngx
+import time
+
+def lookup(r):
+    time.sleep(0.1)
+    return 'backend-' + r.arg['id']
+
+def show(r):
+    r.status = 200
+    r.sendHeader()
+    r.send(r.var['route'], ngx.SEND_LAST)
+'''
+)
+
+]
+
+
+class HTTPSetAsyncTestCase(nginx.HTTPTestCase):
+
+    @classmethod
+    def setUpClass(cls):
+        cls.ngx = nginx.Run(files, ['nosync'])
+
+    @classmethod
+    def tearDownClass(cls):
+        cls.ngx.close()
+
+    def test_route(self):
+        r = self.http('/route?id=1')
+        self.assertEqual(r.status, 200)
+        self.assertEqual(r.read(), 'backend-1')
+
+    def test_location(self):
+        r = self.http('/other')
+        self.assertEqual(r.status, 200)
+        self.assertEqual(r.read(), 'other')
+
+
+if __name__ == '__main__':
+    unittest.main(argv=sys.argv)
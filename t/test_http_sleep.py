@@ -5,7 +5,10 @@
 
 import unittest
 import nginx
+import socket
+import time
 import sys
+import os
 import re
 
 
@@ -16,6 +19,8 @@ files = [
 '''
 daemon off;
 
+python_stack_pool 2 8;
+
 events {
 }
 
@@ -46,12 +51,33 @@ http {
             python_content content(r);
         }
 
+        location /stack {
+            python_stack_size 64k;
+            python_stack_usage on;
+            python_content content(r);
+        }
+
+        location /sync_access {
+            python_blocking off;
+            python_access sync_access(r);
+            return 200;
+        }
+
+        location /sync_content {
+            python_blocking off;
+            python_content sync_content(r);
+        }
+
         location /proxy_content {
             proxy_read_timeout 100ms;
             add_header pc-time $request_time always;
             proxy_pass http://127.0.0.1:8080/content;
         }
 
+        location /abort {
+            python_content abort(r);
+        }
+
         location /var {
             return 200 $var;
         }
@@ -80,8 +106,27 @@ def content(r):
     r.sendHeader()
     r.send(None, ngx.SEND_LAST)
 
+def sync_access(r):
+    try:
+        time.sleep(0.1)
+    except RuntimeError:
+        return 403
+
+def sync_content(r):
+    r.status = 200
+    r.sendHeader()
+    r.send(None, ngx.SEND_LAST)
+
 def var(r):
     time.sleep(0.1)
+
+def abort(r):
+    try:
+        time.sleep(2)
+        s = 'done'
+    except RuntimeError as e:
+        s = str(e)
+    open('abort', 'w').write(s)
 '''
 ),
 
@@ -115,11 +160,47 @@ class HTTPSleepTestCase(nginx.HTTPTestCase):
         self.assertEqual(r.status, 200)
         self.assertAlmostEqual(float(r.getheader('c-time')), 0.2, delta=0.02)
 
+    def test_stack_usage(self):
+        r = self.http('/stack')
+        self.assertEqual(r.status, 200)
+
+        m = None
+        for line in open(self.__class__.ngx.log_file):
+            m = re.search('\[(notice|warn)\].*python stack high-water mark '
+                          'is (\d+) of (\d+) bytes', line)
+            if m:
+                break
+        self.assertNotEqual(m, None)
+        self.assertLessEqual(int(m.group(2)), int(m.group(3)))
+
     def test_content_nonblocking(self):
         r = self.http('/proxy_content')
         self.assertEqual(r.status, 504)
         self.assertAlmostEqual(float(r.getheader('pc-time')), 0.1, delta=0.02)
 
+    def test_sync_access(self):
+        r = self.http('/sync_access')
+        self.assertEqual(r.status, 403)
+
+    def test_sync_content(self):
+        r = self.http('/sync_content')
+        self.assertEqual(r.status, 200)
+
+    def test_abort(self):
+        s = socket.create_connection(('127.0.0.1', 8080))
+        s.sendall('GET /abort HTTP/1.0\r\n\r\n')
+        time.sleep(0.2)
+        s.close()
+
+        # the sleeping handler is terminated well before the sleep is over
+
+        path = self.__class__.ngx.test_dir + '/abort'
+        for i in range(10):
+            if os.path.exists(path):
+                break
+            time.sleep(0.1)
+        self.assertEqual(open(path).read(), 'terminated')
+
     def test_var(self):
         r = self.http('/var')
         self.assertEqual(r.status, 200)
@@ -0,0 +1,149 @@
+
+#
+# Copyright (C) Roman Arutyunyan
+#
+
+import unittest
+import nginx
+import sys
+import re
+
+
+files = [
+
+(
+'nginx.conf',
+'''
+daemon off;
+
+events {
+}
+
+http {
+    python_include foo.py;
+
+    root .;
+
+    server {
+        listen 127.0.0.1:8080;
+        server_name localhost;
+
+        location /parallel {
+            add_header p-time $request_time;
+            python_content parallel(r);
+        }
+
+        location /any {
+            add_header a-time $request_time;
+            python_content wait_any(r);
+        }
+
+        location /exception {
+            python_content exception(r);
+        }
+
+        location /detach {
+            python_content detach(r);
+        }
+
+        location /nonblocking {
+            python_blocking off;
+            python_content detach(r);
+        }
+    }
+}
+'''
+),
+
+(
+'foo.py',
+r'''
+import ngx
+import time
+
+def task(secs, value):
+    time.sleep(secs)
+    return value
+
+def fail():
+    time.sleep(0)
+    raise ValueError('foo')
+
+def reply(r, body):
+    r.status = 200
+    r.sendHeader()
+    r.send(body, ngx.SEND_LAST)
+
+def parallel(r):
+    tasks = [ngx.spawn(task, 0.2, str(n)) for n in range(3)]
+    ngx.wait(tasks)
+    reply(r, ''.join(t.result() for t in tasks))
+
+def wait_any(r):
+    tasks = [ngx.spawn(task, 0.1, 'a'), ngx.spawn(task, 1, 'b')]
+    done = ngx.wait(tasks, any=True)
+    reply(r, '%d %s %s' % (len(done), done[0].result(), tasks[1].done()))
+
+def exception(r):
+    t = ngx.spawn(fail)
+    try:
+        t.result()
+    except ValueError as e:
+        reply(r, 'ValueError ' + str(e))
+
+def detach(r):
+    try:
+        ngx.spawn(task, 10, 'x')
+    except RuntimeError as e:
+        reply(r, str(e))
+    else:
+        reply(r, 'spawned')
+'''
+)
+
+]
+
+
+class HTTPSpawnTestCase(nginx.HTTPTestCase):
+
+    @classmethod
+    def setUpClass(cls):
+        cls.ngx = nginx.Run(files, ['nosync'])
+
+    @classmethod
+    def tearDownClass(cls):
+        cls.ngx.close()
+
+    def test_parallel(self):
+        r = self.http('/parallel')
+        self.assertEqual(r.status, 200)
+        self.assertEqual(r.read(), '012')
+        self.assertAlmostEqual(float(r.getheader('p-time')), 0.2, delta=0.05)
+
+    def test_any(self):
+        r = self.http('/any')
+        self.assertEqual(r.status, 200)
+        self.assertEqual(r.read(), '1 a False')
+        self.assertAlmostEqual(float(r.getheader('a-time')), 0.1, delta=0.05)
+
+    def test_exception(self):
+        r = self.http('/exception')
+        self.assertEqual(r.status, 200)
+        self.assertEqual(r.read(), 'ValueError foo')
+
+    def test_detach(self):
+        r = self.http('/detach')
+        self.assertEqual(r.status, 200)
+        self.assertEqual(r.read(), 'spawned')
+
+        r = self.http('/detach')
+        self.assertEqual(r.status, 200)
+
+    def test_nonblocking(self):
+        r = self.http('/nonblocking')
+        self.assertEqual(r.status, 200)
+        self.assertEqual(r.read(), 'blocking calls are not allowed')
+
+
+if __name__ == '__main__':
+    unittest.main(argv=sys.argv)
@@ -0,0 +1,127 @@
+
+#
+# Copyright (C) Roman Arutyunyan
+#
+
+import threading
+import unittest
+import nginx
+import time
+import sys
+
+
+files = [
+
+(
+'nginx.conf',
+'''
+daemon off;
+
+thread_pool python threads=4;
+
+python_thread_pool python;
+
+events {
+}
+
+http {
+    python_include foo.py;
+
+    server {
+        listen 127.0.0.1:8080;
+        server_name localhost;
+
+        location /thread {
+            add_header t-time $request_time;
+            python_content thread(r);
+        }
+
+        location /exception {
+            python_content exception(r);
+        }
+
+        location /cheap {
+            return 200;
+        }
+    }
+}
+'''
+),
+
+(
+'foo.py',
+r'''
+import ngx
+import time
+
+def work(secs, value):
+    time.sleep(secs)
+    return value * 2
+
+def fail():
+    raise ValueError('foo')
+
+def reply(r, body):
+    r.status = 200
+    r.sendHeader()
+    r.send(body, ngx.SEND_LAST)
+
+def thread(r):
+    reply(r, ngx.run_in_thread(work, 0.3, 'ab'))
+
+def exception(r):
+    try:
+        ngx.run_in_thread(fail)
+    except ValueError as e:
+        reply(r, 'ValueError ' + str(e))
+'''
+)
+
+]
+
+
+class HTTPThreadTestCase(nginx.HTTPTestCase):
+
+    @classmethod
+    def setUpClass(cls):
+        cls.ngx = nginx.Run(files, ['nosync', 'threads'])
+
+    @classmethod
+    def tearDownClass(cls):
+        cls.ngx.close()
+
+    def test_thread(self):
+        result = {}
+
+        def thread():
+            r = self.http('/thread')
+            result['status'] = r.status
+            result['body'] = r.read()
+            result['time'] = float(r.getheader('t-time'))
+
+        t = threading.Thread(target=thread)
+        t.start()
+
+        time.sleep(0.1)
+
+        start = time.time()
+        r = self.http('/cheap')
+        elapsed = time.time() - start
+
+        self.assertEqual(r.status, 200)
+        self.assertLess(elapsed, 0.1)
+
+        t.join()
+
+        self.assertEqual(result['status'], 200)
+        self.assertEqual(result['body'], 'abab')
+        self.assertAlmostEqual(result['time'], 0.3, delta=0.05)
+
+    def test_exception(self):
+        r = self.http('/exception')
+        self.assertEqual(r.status, 200)
+        self.assertEqual(r.read(), 'ValueError foo')
+
+
+if __name__ == '__main__':
+    unittest.main(argv=sys.argv)
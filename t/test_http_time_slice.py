@@ -0,0 +1,135 @@
+
+#
+# Copyright (C) Roman Arutyunyan
+#
+
+import threading
+import unittest
+import nginx
+import time
+import sys
+
+
+files = [
+
+(
+'nginx.conf',
+'''
+daemon off;
+
+events {
+}
+
+http {
+    python_include foo.py;
+
+    server {
+        listen 127.0.0.1:8080;
+        server_name localhost;
+
+        location /heavy {
+            python_time_slice 5ms;
+            python_content heavy(r);
+        }
+
+        location /cheap {
+            python_content cheap(r);
+        }
+
+        location /trace {
+            python_time_slice 5ms;
+            python_content trace(r);
+        }
+    }
+}
+'''
+),
+
+(
+'foo.py',
+r'''
+import ngx
+import sys
+import time
+
+def heavy(r):
+    n = 0
+    start = time.time()
+    while time.time() - start < 0.5:
+        n += 1
+    r.status = 200
+    r.sendHeader()
+    r.send(str(n > 0), ngx.SEND_LAST)
+
+def cheap(r):
+    r.status = 200
+    r.sendHeader()
+    r.send('cheap', ngx.SEND_LAST)
+
+def tracer(frame, event, arg):
+    return None
+
+def trace(r):
+    if r.arg['set'] == '1':
+        sys.settrace(tracer)
+        result = 'set'
+    else:
+        result = str(sys.gettrace() is tracer)
+        sys.settrace(None)
+    r.status = 200
+    r.sendHeader()
+    r.send(result, ngx.SEND_LAST)
+'''
+)
+
+]
+
+
+class HTTPTimeSliceTestCase(nginx.HTTPTestCase):
+
+    @classmethod
+    def setUpClass(cls):
+        cls.ngx = nginx.Run(files, ['nosync'])
+
+    @classmethod
+    def tearDownClass(cls):
+        cls.ngx.close()
+
+    def test_time_slice(self):
+        result = {}
+
+        def heavy():
+            r = self.http('/heavy')
+            result['status'] = r.status
+            result['body'] = r.read()
+
+        t = threading.Thread(target=heavy)
+        t.start()
+
+        time.sleep(0.1)
+
+        start = time.time()
+        r = self.http('/cheap')
+        elapsed = time.time() - start
+
+        self.assertEqual(r.status, 200)
+        self.assertEqual(r.read(), 'cheap')
+        self.assertLess(elapsed, 0.2)
+
+        t.join()
+
+        self.assertEqual(result['status'], 200)
+        self.assertEqual(result['body'], 'True')
+
+    def test_trace(self):
+        r = self.http('/trace?set=1')
+        self.assertEqual(r.status, 200)
+        self.assertEqual(r.read(), 'set')
+
+        r = self.http('/trace?set=0')
+        self.assertEqual(r.status, 200)
+        self.assertEqual(r.read(), 'True')
+
+
+if __name__ == '__main__':
+    unittest.main(argv=sys.argv)